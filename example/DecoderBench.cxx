@@ -0,0 +1,378 @@
+//  Throughput benchmark of TSBSSimDecoder, without a replay.
+//
+//  Synthetic TSBSSimEvents are built in memory: every readout of every
+//  GEM module of the database gets a fraction (occupancy) of its strips
+//  fired, each strip with a number of contributing clusters, plus
+//  optionally an ECal cluster above threshold (calorimeter emulation).
+//  The events are then decoded with LoadEvent, and the MC truth of every
+//  strip of the event is looked up through the hardware channels, as the
+//  tracking detectors do.
+//
+//  Reported per phase: events/s, ns per strip and allocations (calls
+//  to operator new) per event.
+//
+//  make decoderbench
+//  DB_DIR=db ./decoderbench [nevents] [occupancy] [clusters/strip] [calo]
+//                           [generalinfo prefix]
+//  e.g. ./decoderbench 2000 0.05 2 1 bbgem_PlaneModule
+//  (reads db_generalinfo_<prefix>.dat, db_g4sbs_<prefix>.dat and
+//  db_sbssim_cratemap.dat)
+
+#include "TSBSSimDecoder.h"
+#include "TSBSSimEvent.h"
+#include "TSBSDBManager.h"
+#include "THaGlobals.h"
+#include "THaVarList.h"
+#include "ha_compiledata.h"
+
+#include <TRandom3.h>
+#include <TMath.h>
+#include <TSystem.h>
+#include <TString.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Allocation counter. All the forms of operator new are replaced, so
+// every allocation through new is counted (not malloc calls made directly).
+static unsigned long gNalloc = 0;
+
+void* operator new( size_t n )
+{
+  ++gNalloc;
+  if( void* p = malloc(n ? n : 1) )
+    return p;
+  throw bad_alloc();
+}
+void* operator new[]( size_t n )
+{
+  return operator new(n);
+}
+void* operator new( size_t n, const nothrow_t& ) noexcept
+{
+  ++gNalloc;
+  return malloc(n ? n : 1);
+}
+void* operator new[]( size_t n, const nothrow_t& t ) noexcept
+{
+  return operator new(n, t);
+}
+void operator delete( void* p ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p ) noexcept
+{
+  free(p);
+}
+void operator delete( void* p, size_t ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p, size_t ) noexcept
+{
+  free(p);
+}
+void operator delete( void* p, const nothrow_t& ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p, const nothrow_t& ) noexcept
+{
+  free(p);
+}
+#ifdef __cpp_aligned_new
+// Over-aligned types (C++17)
+void* operator new( size_t n, align_val_t al, const nothrow_t& ) noexcept
+{
+  ++gNalloc;
+  size_t a = max( size_t(al), sizeof(void*) );
+  void* p = 0;
+  return posix_memalign( &p, a, n ? n : 1 ) == 0 ? p : 0;
+}
+void* operator new[]( size_t n, align_val_t al, const nothrow_t& t ) noexcept
+{
+  return operator new(n, al, t);
+}
+void* operator new( size_t n, align_val_t al )
+{
+  if( void* p = operator new(n, al, nothrow) )
+    return p;
+  throw bad_alloc();
+}
+void* operator new[]( size_t n, align_val_t al )
+{
+  return operator new(n, al);
+}
+void operator delete( void* p, align_val_t ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p, align_val_t ) noexcept
+{
+  free(p);
+}
+void operator delete( void* p, size_t, align_val_t ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p, size_t, align_val_t ) noexcept
+{
+  free(p);
+}
+void operator delete( void* p, align_val_t, const nothrow_t& ) noexcept
+{
+  free(p);
+}
+void operator delete[]( void* p, align_val_t, const nothrow_t& ) noexcept
+{
+  free(p);
+}
+#endif
+
+#if ANALYZER_VERSION_CODE >= ANALYZER_VERSION(1,6,0)
+static const Int_t kMaxROC = Decoder::MAXROC;
+typedef UInt_t evbuf_t;
+#else
+static const Int_t kMaxROC = MAXROC;
+typedef Int_t evbuf_t;
+#endif
+
+static const Int_t kNsamp = 6;       // ADC samples per strip
+static const Int_t kNstrips = 1280;  // strips per readout of a module
+static const Int_t kNpool = 20;      // distinct events, decoded in turn
+
+//_____________________________________________________________________________
+static void MakeCluster( TSBSSimEvent::GEMCluster& c, Int_t i, Int_t ip, Int_t im,
+			 Bool_t primary, TRandom3& r )
+{
+  // Cluster number i (0-based) in module im of plane ip
+
+  TSBSDBManager* manager = TSBSDBManager::GetInstance();
+  TVector3 vertex(0,0,0), mom(0,0,2.0);
+  c.fID = i+1;
+  c.fSector = c.fRealSector = 0;
+  c.fPlane = ip;
+  c.fModule = im;
+  c.fSource = primary ? 0 : 1;
+  c.fType = primary ? 1 : 2;
+  c.fTRID = primary ? 1 : i+1;
+  c.fPID = 11;
+  c.fP = c.fPspec = mom;
+  c.fMCpos.SetXYZ( r.Uniform(-0.2,0.2), r.Uniform(-0.1,0.1),
+		   manager->GetZ0() + 0.1*(ip+1) );
+  c.fHitpos = c.fXEntry = c.fMCpos;
+  c.fVertex = vertex;
+  c.fCharge = r.Uniform(100,1000);
+  c.fTime = r.Uniform(0,50);
+  for( Int_t k = 0; k < 2; k++ ) {
+    c.fSize[k] = 3;
+    c.fStart[k] = r.Integer(kNstrips-3);
+    c.fXProj[k] = c.fMCpos[k];
+  }
+}
+
+//_____________________________________________________________________________
+static void MakeEvent( TSBSSimEvent& ev, Int_t evnum, Double_t occupancy,
+		       Int_t nclust_strip, Bool_t calo, TRandom3& r )
+{
+  // Fill ev with random strips of all the modules of the database
+
+  TSBSDBManager* manager = TSBSDBManager::GetInstance();
+  const Int_t nplanes = manager->GetNGEMPlane();
+
+  ev.Clear();
+  ev.fRunID = 1;
+  ev.fEvtID = evnum;
+  ev.fWeight = 1;
+
+  TVector3 vertex(0,0,0), mom(0,0,2.0);
+  ev.AddTrack( 1, 11, vertex, mom, vertex, mom );
+
+  // Clusters: one from the primary in the first module of each plane,
+  // the others background, the same number in every module. A strip
+  // only gets clusters of its own plane and module (BuildStripTruth
+  // checks this), so the background clusters are listed per module.
+  vector<Int_t> pmbegin( nplanes+1, 0 );  // first (plane,module) index of each plane
+  for( Int_t ip = 0; ip < nplanes; ip++ )
+    pmbegin[ip+1] = pmbegin[ip] + manager->GetNModule(ip);
+  const Int_t nbkg_mod = TMath::Max( 1, Int_t(occupancy*kNstrips*nclust_strip/3) );
+  const Int_t nclust = nplanes + nbkg_mod*pmbegin[nplanes];
+  vector< vector<Int_t> > bkg( pmbegin[nplanes] ); // cluster indices per (plane,module)
+  ev.fGEMClust.resize( nclust );
+  Int_t icl = 0;
+  for( Int_t ip = 0; ip < nplanes; ip++, icl++ )
+    MakeCluster( ev.fGEMClust[icl], icl, ip, 0, true, r );
+  for( Int_t ip = 0; ip < nplanes; ip++ ) {
+    for( Int_t im = 0; im < manager->GetNModule(ip); im++ ) {
+      for( Int_t k = 0; k < nbkg_mod; k++, icl++ ) {
+	MakeCluster( ev.fGEMClust[icl], icl, ip, im, false, r );
+	bkg[pmbegin[ip]+im].push_back(icl);
+      }
+    }
+  }
+  ev.fNSignal = nplanes;
+
+  // Strips
+  for( Int_t ip = 0; ip < nplanes; ip++ ) {
+    for( Int_t im = 0; im < manager->GetNModule(ip); im++ ) {
+      for( Int_t proj = 0; proj < 2; proj++ ) {
+	for( Int_t ich = 0; ich < kNstrips; ich++ ) {
+	  if( r.Uniform() >= occupancy )
+	    continue;
+	  TSBSSimEvent::GEMStrip s;
+	  s.fSector = 0;
+	  s.fPlane = ip;
+	  s.fModule = im;
+	  s.fProj = proj;
+	  s.fChan = ich;
+	  s.fSigType = 0;
+	  s.fCharge = 0;
+	  s.fTime1 = 0;
+	  s.fNsamp = kNsamp;
+	  s.fNClust = nclust_strip;
+	  s.fADCBegin = ev.fStripADC.size();
+	  s.fClustBegin = ev.fStripClust.size();
+	  s.fRatioBegin = ev.fStripClustADC.size();
+	  for( Int_t k = 0; k < kNsamp; k++ ) {
+	    Int_t adc = r.Integer(2000);
+	    ev.fStripADC.push_back( adc );
+	    s.fCharge += adc;
+	  }
+	  for( Int_t i = 0; i < nclust_strip; i++ ) {
+	    // the primary of the plane on one strip in ten of module 0
+	    const vector<Int_t>& b = bkg[pmbegin[ip]+im];
+	    Int_t ic = ( im == 0 && i == 0 && ich%10 == 0 ) ? ip : b[r.Integer(b.size())];
+	    if( ic < nplanes )
+	      s.fSigType |= 1;
+	    ev.fStripClust.push_back( ic+1 );
+	    ev.fStripClustWeight.push_back( 1.0/nclust_strip );
+	  }
+	  for( Int_t k = 0; k < kNsamp; k++ )
+	    for( Int_t i = 0; i < nclust_strip; i++ )
+	      ev.fStripClustADC.push_back( ev.fStripADC[s.fADCBegin+k]/nclust_strip );
+	  ev.fDigiStrips.push_back( s );
+	}
+      }
+    }
+  }
+
+  if( calo )
+    ev.fECalClusters.push_back( TSBSECalCluster( manager->GetCaloThreshold()+1.0,
+						 r.Uniform(-0.5,0.5),
+						 r.Uniform(-0.5,0.5), 0, 10 ) );
+}
+
+//_____________________________________________________________________________
+int main( int argc, char** argv )
+{
+  Int_t nevents     = argc > 1 ? atoi(argv[1]) : 2000;
+  Double_t occupancy = argc > 2 ? atof(argv[2]) : 0.05;
+  Int_t nclust_strip = argc > 3 ? atoi(argv[3]) : 2;
+  Bool_t calo       = argc > 4 ? atoi(argv[4]) != 0 : false;
+  const char* prefix = argc > 5 ? argv[5] : "bbgem_PlaneModule";
+  if( nevents <= 0 || occupancy <= 0 || occupancy > 1 || nclust_strip <= 0 ) {
+    fprintf(stderr, "usage: %s [nevents] [occupancy] [clusters/strip] "
+	    "[calo] [generalinfo prefix]\n", argv[0]);
+    return 1;
+  }
+  if( !gSystem->Getenv("DB_DIR") )
+    gSystem->Setenv("DB_DIR", "db");
+  if( !gHaVars )
+    gHaVars = new THaVarList;
+
+  TSBSDBManager* manager = TSBSDBManager::GetInstance();
+  manager->LoadGeneralInfo( Form("db_generalinfo_%s.dat", prefix) );
+  manager->LoadGeoInfo( Form("g4sbs_%s", prefix) );
+  manager->EmulateCalorimeter( calo );
+
+  TSBSSimDecoder* dec = new TSBSSimDecoder;
+#if ANALYZER_VERSION_CODE >= ANALYZER_VERSION(1,6,0)
+  dec->SetCrateMapName("sbssim_cratemap");
+#endif
+
+  TRandom3 r(1234);
+  vector<TSBSSimEvent*> pool( kNpool );
+  Double_t nstrips = 0;
+  for( Int_t i = 0; i < kNpool; i++ ) {
+    pool[i] = new TSBSSimEvent(1);
+    MakeEvent( *pool[i], i+1, occupancy, nclust_strip, calo, r );
+    nstrips += pool[i]->GetNstrips();
+  }
+  nstrips /= kNpool;
+
+  // Warm-up: initializes the decoder and finds the slots with data
+  vector< pair<Int_t,Int_t> > slots;
+  for( Int_t i = 0; i < kNpool; i++ ) {
+    if( dec->LoadEvent( reinterpret_cast<const evbuf_t*>(pool[i]) ) != 0 ) {
+      fprintf(stderr, "LoadEvent failed for event %d\n", i+1);
+      return 2;
+    }
+    for( Int_t crate = 0; crate < kMaxROC; crate++ )
+      for( Int_t slot = 0; slot < TSBSSimDecoder::GetMAXSLOT(); slot++ )
+	if( dec->GetNumChan(crate,slot) > 0 &&
+	    find(slots.begin(), slots.end(), make_pair(crate,slot)) == slots.end() )
+	  slots.push_back( make_pair(crate,slot) );
+  }
+
+  printf("%d events, %.0f strips/event, %d clusters/strip, calorimeter %s\n",
+	 nevents, nstrips, nclust_strip, calo ? "on" : "off");
+  printf("%-16s %12s %12s %12s\n", "", "events/s", "ns/strip", "allocs/event");
+
+  typedef chrono::steady_clock bench_clock;
+  const char* phase[3] = { "LoadEvent", "GetStripTruth", "GetSBSMCHitInfo" };
+  for( Int_t iphase = 0; iphase < 3; iphase++ ) {
+    Double_t tphase = 0, nlookup = 0;
+    unsigned long nalloc = 0;
+    for( Int_t iev = 0; iev < nevents; iev++ ) {
+      const TSBSSimEvent* ev = pool[iev%kNpool];
+      unsigned long n0 = gNalloc;
+      bench_clock::time_point t0 = bench_clock::now();
+      dec->LoadEvent( reinterpret_cast<const evbuf_t*>(ev) );
+      if( iphase == 0 ) {
+	tphase += chrono::duration<Double_t>(bench_clock::now()-t0).count();
+	nalloc += gNalloc-n0;
+	continue;
+      }
+      // lookups only
+      n0 = gNalloc;
+      t0 = bench_clock::now();
+      Double_t sum = 0;
+      for( size_t is = 0; is < slots.size(); is++ ) {
+	Int_t crate = slots[is].first, slot = slots[is].second;
+	for( Int_t i = 0; i < dec->GetNumChan(crate,slot); i++ ) {
+	  Int_t chan = dec->GetNextChan(crate,slot,i);
+	  // (the calorimeter channels have no strip)
+	  const TSBSStripTruth* st = dec->GetStripTruth(crate,slot,chan);
+	  if( !st )
+	    continue;
+	  if( iphase == 1 )
+	    sum += st->fMCCharge;
+	  else
+	    sum += dec->GetSBSMCHitInfo(crate,slot,chan).fMCCharge;
+	  nlookup++;
+	}
+      }
+      tphase += chrono::duration<Double_t>(bench_clock::now()-t0).count();
+      nalloc += gNalloc-n0;
+      if( sum < 0 ) printf("?");  // keep the lookups
+    }
+    Double_t nstrip_tot = ( iphase == 0 ) ? nstrips*nevents : nlookup;
+    printf("%-16s %12.1f %12.1f %12.1f\n", phase[iphase],
+	   tphase > 0 ? nevents/tphase : 0.,
+	   nstrip_tot > 0 ? 1e9*tphase/nstrip_tot : 0.,
+	   Double_t(nalloc)/nevents);
+  }
+
+  delete dec;
+  for( Int_t i = 0; i < kNpool; i++ )
+    delete pool[i];
+  return 0;
+}
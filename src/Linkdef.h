@@ -11,6 +11,12 @@
 #pragma link C++ defined_in "src/g4sbs_tree.h";
 #pragma link C++ defined_in "src/TSBSBox.h";
 #pragma link C++ defined_in "src/TSBSGeant4File.h";
+#pragma link C++ defined_in "src/TSBSGEMHitCache.h";
+#pragma link C++ defined_in "src/TSBSDBSnapshot.h";
+#pragma link C++ defined_in "src/TSBSTreeWriter.h";
+#pragma link C++ defined_in "src/TSBSTreeReader.h";
+#pragma link C++ defined_in "src/TSBSOptics.h";
+#pragma link C++ defined_in "src/TSBSShowerProfile.h";
 #pragma link C++ defined_in "src/TSBSGEMChamber.h";
 #pragma link C++ defined_in "src/TSBSGEMPlane.h";
 #pragma link C++ defined_in "src/TSBSSimDecoder.h";
@@ -3,11 +3,11 @@
 #define __TSBSBOX_H
 
 #include <cmath>
+#include <cstddef>
 //#include <vector>
 
 #include <Rtypes.h>
 #include <TVector3.h>
-#include <TMatrixD.h>
 
 class TDatime;
 
@@ -44,6 +44,9 @@ class TDatime;
 // The box z location is to be understood as the box location on the z" axis 
 // obtained with the rotation defined before, and is made wrt x, y = 0, 0.
 
+// The frame conversions are called for every hit: they are inline,
+// and use plain 3x3 arrays (no temporary objects, no allocation).
+
 
 class TSBSBox
 {
@@ -92,6 +95,15 @@ class TSBSBox
   void SpecToHallCenter (Double_t& x, Double_t& y, Double_t& z) const;  // input and output in mm!!!
   void BoxToHallCenter (Double_t& x, Double_t& y, Double_t& z) const;  // input and output in mm!!!
   
+  // Batch versions: transform n points, given as arrays of coordinates, in place.
+  // The arrays must not overlap (__restrict), so that the compiler can vectorize the loops.
+  void LabToSpec (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const;  // input and output in mm!!!
+  void SpecToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const;  // input and output in mm!!!
+  void SpecToBox (Double_t* __restrict x, Double_t* __restrict y, size_t n) const;  // input and output in mm!!!
+  void BoxToSpec (Double_t* __restrict x, Double_t* __restrict y, size_t n) const;  // input and output in mm!!!
+  void LabToBox (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const;  // input and output in mm!!!
+  void BoxToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const;  // input and output in mm!!!
+  
   // Checker: does the plane contain the hit position ?
   Bool_t Contains (Double_t x, Double_t y) const;//hit position in the box
   Bool_t Contains (Double_t x, Double_t y, Double_t z) const;//hit position in the lab.
@@ -100,6 +112,11 @@ class TSBSBox
   // evaluate the rotation matrices
   void SetRotations();
   
+  // Rotate (x, y, z) by the 3x3 matrix rot
+  static void Rotate (const Double_t rot[3][3], Double_t& x, Double_t& y, Double_t& z);
+  // Same for n points
+  static void Rotate (const Double_t rot[3][3], Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n);
+  
   // Members
   Double_t fDMag;
   Double_t fD0;
@@ -113,8 +130,185 @@ class TSBSBox
   //TVector3 fSize;
   
   // Matrices for rotations
-  TMatrixD* fRotMat_BL; 
-  TMatrixD* fRotMat_LB; 
+  Double_t fRotMat_BL[3][3]; // Spec to Lab
+  Double_t fRotMat_LB[3][3]; // Lab to Spec
+  // Box center in the spec frame (mm)
+  Double_t fBoxOffset[3];
 };
 
+//_____________________________________________________________________________
+inline void
+TSBSBox::Rotate (const Double_t rot[3][3], Double_t& x, Double_t& y, Double_t& z)
+{
+  const Double_t x0 = x, y0 = y, z0 = z;
+  x = rot[0][0]*x0 + rot[0][1]*y0 + rot[0][2]*z0;
+  y = rot[1][0]*x0 + rot[1][1]*y0 + rot[1][2]*z0;
+  z = rot[2][0]*x0 + rot[2][1]*y0 + rot[2][2]*z0;
+}
+
+inline void
+TSBSBox::Rotate (const Double_t rot[3][3], Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n)
+{
+  const Double_t r00 = rot[0][0], r01 = rot[0][1], r02 = rot[0][2];
+  const Double_t r10 = rot[1][0], r11 = rot[1][1], r12 = rot[1][2];
+  const Double_t r20 = rot[2][0], r21 = rot[2][1], r22 = rot[2][2];
+  for (size_t i = 0; i < n; i++) {
+    const Double_t x0 = x[i], y0 = y[i], z0 = z[i];
+    x[i] = r00*x0 + r01*y0 + r02*z0;
+    y[i] = r10*x0 + r11*y0 + r12*z0;
+    z[i] = r20*x0 + r21*y0 + r22*z0;
+  }
+}
+
+inline void
+TSBSBox::LabToSpec (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  Rotate (fRotMat_LB, x, y, z);
+}
+
+inline void
+TSBSBox::SpecToLab (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  Rotate (fRotMat_BL, x, y, z);
+}
+
+inline void
+TSBSBox::SpecToBox (Double_t& x, Double_t& /*y*/) const  // input and output in mm!!!
+{
+  x -= fBoxOffset[0];
+  //neutral for y
+}
+
+inline void
+TSBSBox::BoxToSpec (Double_t& x, Double_t& /*y*/) const  // input and output in mm!!!
+{
+  x += fBoxOffset[0];
+  //neutral for y
+}
+
+inline void
+TSBSBox::LabToBox (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  LabToSpec(x, y, z);
+  z -= fBoxOffset[2];
+  SpecToBox(x, y);
+}
+
+inline void
+TSBSBox::BoxToLab (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  BoxToSpec(x, y);
+  z += fBoxOffset[2];
+  SpecToLab(x, y, z);
+}
+
+inline void
+TSBSBox::LabToSpec (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const  // input and output in mm!!!
+{
+  Rotate (fRotMat_LB, x, y, z, n);
+}
+
+inline void
+TSBSBox::SpecToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const  // input and output in mm!!!
+{
+  Rotate (fRotMat_BL, x, y, z, n);
+}
+
+inline void
+TSBSBox::SpecToBox (Double_t* __restrict x, Double_t* /*y*/, size_t n) const  // input and output in mm!!!
+{
+  const Double_t dx = fBoxOffset[0];
+  for (size_t i = 0; i < n; i++)
+    x[i] -= dx;
+}
+
+inline void
+TSBSBox::BoxToSpec (Double_t* __restrict x, Double_t* /*y*/, size_t n) const  // input and output in mm!!!
+{
+  const Double_t dx = fBoxOffset[0];
+  for (size_t i = 0; i < n; i++)
+    x[i] += dx;
+}
+
+inline void
+TSBSBox::LabToBox (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const  // input and output in mm!!!
+{
+  LabToSpec(x, y, z, n);
+  const Double_t dz = fBoxOffset[2];
+  for (size_t i = 0; i < n; i++)
+    z[i] -= dz;
+  SpecToBox(x, y, n);
+}
+
+inline void
+TSBSBox::BoxToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const  // input and output in mm!!!
+{
+  BoxToSpec(x, y, n);
+  const Double_t dz = fBoxOffset[2];
+  for (size_t i = 0; i < n; i++)
+    z[i] += dz;
+  SpecToLab(x, y, z, n);
+}
+
+inline void
+TSBSBox::HallCenterToLab (Double_t& /*x*/, Double_t& /*y*/, Double_t& /*z*/) const  // input and output in mm!!!
+{
+  //TODO ? if possible: reprogram this, but using the spectrometer angle
+  //x = x + fDMag*sin(fThetaH)*1.0e3;
+  // neutral in y
+  //z = z - fDMag*cos(fThetaH)*1.0e3;
+}
+
+inline void
+TSBSBox::LabToHallCenter (Double_t& /*x*/, Double_t& /*y*/, Double_t& /*z*/) const  // input and output in mm!!!
+{
+  //TODO ? if possible: reprogram this, but using the spectrometer angle
+  //x = x - fDMag*sin(fThetaH)*1.0e3;
+  // neutral in y
+  //z = z + fDMag*cos(fThetaH)*1.0e3;
+}
+
+inline void
+TSBSBox::HallCenterToBox (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  HallCenterToLab(x, y, z);
+  LabToBox(x, y, z);
+}
+
+inline void
+TSBSBox::HallCenterToSpec (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  HallCenterToLab(x, y, z);
+  LabToSpec(x, y, z);
+}
+
+inline void
+TSBSBox::SpecToHallCenter (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  SpecToLab(x, y, z);
+  LabToHallCenter(x, y, z);
+}
+
+inline void
+TSBSBox::BoxToHallCenter (Double_t& x, Double_t& y, Double_t& z) const  // input and output in mm!!!
+{
+  BoxToLab(x, y, z);
+  LabToHallCenter(x, y, z);
+}
+
+inline Bool_t
+TSBSBox::Contains (Double_t x, Double_t y) const
+{
+  return !(fabs(x)>fDX/2 || fabs(y)>fDY/2);
+}
+
+inline Bool_t
+TSBSBox::Contains (Double_t x, Double_t y, Double_t z) const
+{
+  //transform the point from the Lab to the Box coordinates
+  LabToBox(x, y, z);
+  
+  return Contains(x, y);
+}
+
 #endif
@@ -0,0 +1,263 @@
+#ifndef __TSBSCALOCLUSTERER_H
+#define __TSBSCALOCLUSTERER_H
+
+#include <Rtypes.h>
+#include <TRandom3.h>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSCaloClusterer
+//
+// Clustering of calorimeter (or scintillator) blocks, shared by the
+// calorimeter emulations of TSBSGeant4File. The detector specifics come
+// from a block geometry descriptor Geo: a class with the static functions
+//   double BlockSize()     block size (m)
+//   double LinkDistance()  blocks closer than this are neighbours (m)
+//   bool   Smear( TRandom3* r, double& edep )
+//                          smear the energy deposit of a block,
+//                          return false if it is below threshold
+// (see the descriptors at the end of this file).
+//
+// Per event: Clear(), AddHit() for each hit, then FindClusters() and/or
+// SumBox(). The buffers are kept from one event to the next.
+//
+// A cluster is seeded by the most energetic free block (the first one
+// if several) and holds all blocks connected to it by steps shorter than
+// LinkDistance(). The blocks are hashed into a grid of cells of that size,
+// so the neighbours of a block are searched for in the 3x3 cells around it
+// only (O(n log n) in the number of blocks). Small events (fewer than
+// kMinGridBlocks blocks) are scanned directly, which is faster there.
+// Further clusters are seeded by the remaining blocks.
+
+template< class Geo >
+class TSBSCaloClusterer {
+ public:
+  static const int kMinGridBlocks = 128;
+
+  struct Cluster_t {
+    double fE;     // energy
+    double fEX;    // sum of energy*x
+    double fEY;    // sum of energy*y
+    double fXmax;  // position of the seed block
+    double fYmax;
+    int    fFirst; // first block in GetClusterBlock
+    int    fN;     // number of blocks
+    double GetX() const { return fEX/fE; }
+    double GetY() const { return fEY/fE; }
+  };
+
+  TSBSCaloClusterer() : fMax(-1), fETot(0) {}
+
+  void Clear() {
+    fE.clear(); fX.clear(); fY.clear();
+    fClusters.clear(); fClusBlocks.clear();
+    fMax = -1; fETot = 0;
+  }
+  // Smear the energy deposit edep of the block at x, y and add the block
+  // if above threshold. Return true if added.
+  bool AddHit( TRandom3* r, double edep, double x, double y ) {
+    if( !Geo::Smear(r, edep) ) return false;
+    AddBlock(edep, x, y);
+    return true;
+  }
+  // Add a block with its final energy
+  void AddBlock( double e, double x, double y ) {
+    if( e > (fMax < 0 ? 0 : fE[fMax]) ) fMax = fE.size();
+    fE.push_back(e); fX.push_back(x); fY.push_back(y);
+    fETot += e;
+  }
+
+  int    GetNBlocks() const { return fE.size(); }
+  double GetE( int i ) const { return fE[i]; }
+  double GetX( int i ) const { return fX[i]; }
+  double GetY( int i ) const { return fY[i]; }
+  double GetETotal() const { return fETot; }
+  // Block with the largest energy (the first one if several), -1 if none
+  int    GetMax() const { return fMax; }
+
+  // Find up to nmax clusters, return the number found
+  int FindClusters( int nmax = 1 );
+  int GetNClusters() const { return fClusters.size(); }
+  const Cluster_t& GetCluster( int i ) const { return fClusters[i]; }
+  int GetClusterBlock( int i ) const { return fClusBlocks[i]; }
+
+  // Sums over the blocks within halfx and halfy of (xc, yc), in block order.
+  // halfx < 0: no condition on x.
+  void SumBox( double xc, double yc, double halfx, double halfy,
+	       double& E, double& EX, double& EY ) const {
+    E = EX = EY = 0;
+    for( size_t i = 0; i < fE.size(); i++ ) {
+      if( (halfx < 0 || fabs(fX[i]-xc) <= halfx) && fabs(fY[i]-yc) <= halfy ) {
+	E += fE[i];
+	EX += fE[i]*fX[i];
+	EY += fE[i]*fY[i];
+      }
+    }
+  }
+
+ private:
+  static Long64_t GridKey( Long64_t ix, Long64_t iy ) {
+    return (ix << 32) + (iy & 0xffffffffLL);
+  }
+  static Long64_t GridCell( double x ) {
+    // margin for the rounding of x/cell
+    return (Long64_t)floor( x/(Geo::LinkDistance()*1.001) );
+  }
+
+  std::vector<double> fE, fX, fY;  // blocks
+  int    fMax;
+  double fETot;
+  std::vector< std::pair<Long64_t,int> > fGrid; // (grid cell, block), sorted by cell
+  std::vector<char>      fUsed;
+  std::vector<int>       fClusBlocks;           // blocks of all clusters
+  std::vector<Cluster_t> fClusters;
+};
+
+//_____________________________________________________________________________
+template< class Geo >
+int TSBSCaloClusterer<Geo>::FindClusters( int nmax )
+{
+  fClusters.clear();
+  fClusBlocks.clear();
+  const int n = fE.size();
+  if( n == 0 || nmax <= 0 ) return 0;
+
+  const bool use_grid = ( n >= kMinGridBlocks );
+  fGrid.clear();
+  if( use_grid ) {
+    for( int i = 0; i < n; i++ )
+      fGrid.push_back( std::make_pair(GridKey(GridCell(fX[i]), GridCell(fY[i])), i) );
+    std::sort( fGrid.begin(), fGrid.end() );
+  }
+  fUsed.assign( n, 0 );
+
+  const double rmax = Geo::LinkDistance();
+  int seed = fMax;
+  while( seed >= 0 && (int)fClusters.size() < nmax ) {
+    Cluster_t clus;
+    clus.fXmax = fX[seed];
+    clus.fYmax = fY[seed];
+    clus.fFirst = fClusBlocks.size();
+    fUsed[seed] = 1;
+    fClusBlocks.push_back(seed);
+    for( size_t k = clus.fFirst; k < fClusBlocks.size(); k++ ) {
+      int m = fClusBlocks[k];
+      double xm = fX[m], ym = fY[m];
+      if( !use_grid ) {
+	for( int i = 0; i < n; i++ ) {
+	  if( fUsed[i] ) continue;
+	  if( sqrt(pow(fX[i]-xm, 2)+pow(fY[i]-ym, 2)) < rmax ) {
+	    fUsed[i] = 1;
+	    fClusBlocks.push_back(i);
+	  }
+	}
+	continue;
+      }
+      Long64_t ix = GridCell(xm), iy = GridCell(ym);
+      for( int dx = -1; dx <= 1; dx++ ) {
+	for( int dy = -1; dy <= 1; dy++ ) {
+	  Long64_t key = GridKey(ix+dx, iy+dy);
+	  typename std::vector< std::pair<Long64_t,int> >::const_iterator it =
+	    std::lower_bound( fGrid.begin(), fGrid.end(), std::make_pair(key, -1) );
+	  for( ; it != fGrid.end() && it->first == key; ++it ) {
+	    int i = it->second;
+	    if( fUsed[i] ) continue;
+	    if( sqrt(pow(fX[i]-xm, 2)+pow(fY[i]-ym, 2)) < rmax ) {
+	      fUsed[i] = 1;
+	      fClusBlocks.push_back(i);
+	    }
+	  }
+	}
+      }
+    }
+    clus.fN = fClusBlocks.size()-clus.fFirst;
+    clus.fE = clus.fEX = clus.fEY = 0;
+    for( int k = clus.fFirst; k < clus.fFirst+clus.fN; k++ ) {
+      int i = fClusBlocks[k];
+      clus.fE += fE[i];
+      clus.fEX += fX[i]*fE[i];
+      clus.fEY += fY[i]*fE[i];
+    }
+    fClusters.push_back(clus);
+
+    // next seed: most energetic free block
+    seed = -1;
+    for( int i = 0; i < n; i++ )
+      if( !fUsed[i] && (seed < 0 || fE[i] > fE[seed]) )
+	seed = i;
+  }
+  return fClusters.size();
+}
+
+//_____________________________________________________________________________
+// Block geometry descriptors
+
+// GEp electromagnetic calorimeter
+struct TSBSGEpECalGeo {
+  static double BlockSize()    { return 0.042; }//m
+  static double LinkDistance() { return BlockSize()*1.1; }
+  static bool   Smear( TRandom3* r, double& edep ) {
+    const double Npe_Edep = 5.38e2;//>1.0GeV
+    const double npe_thr = 3.0;
+    double npe = r->Poisson(Npe_Edep*edep);
+    edep = npe/Npe_Edep;
+    return npe >= npe_thr;
+  }
+};
+
+// GEp coordinate detector (one plane)
+struct TSBSGEpCDetGeo {
+  static double BlockSize()    { return 0.005; }//m
+  static double LinkDistance() { return BlockSize()*1.1; }
+  static bool   Smear( TRandom3* r, double& edep ) {
+    const double Npe_Edep = 5.634e3;//>1.0GeV
+    const double npe_thr = 3.0;
+    double npe = r->Poisson(Npe_Edep*edep);
+    edep = npe/Npe_Edep;
+    return npe >= npe_thr;
+  }
+};
+
+// SBS hadron calorimeter
+struct TSBSHCalGeo {
+  static double BlockSize()    { return 0.152; }//m
+  static double LinkDistance() { return BlockSize()*1.5; }
+  static bool   Smear( TRandom3* r, double& edep ) {
+    const double Npe_Edep = 5.0e3;//>1.0GeV
+    const double npe_thr = 3.0;
+    double npe = r->Poisson(Npe_Edep*edep);
+    edep = npe/Npe_Edep;
+    return npe >= npe_thr;
+  }
+};
+
+// BigBite preshower
+struct TSBSBBPSGeo {
+  static double BlockSize()    { return 0.085; }//m
+  static double LinkDistance() { return BlockSize()*1.1; }
+  static bool   Smear( TRandom3* r, double& edep ) {
+    // energy deposit -> photoelectron yield with smearing -> energy deposit
+    const double Npe_Edep = 1.550e3;
+    const double sigma_Npe_Edep = 1.58e2;
+    edep = r->Gaus(Npe_Edep*edep, sigma_Npe_Edep*edep)/Npe_Edep;
+    return true;
+  }
+};
+
+// BigBite shower
+struct TSBSBBSHGeo {
+  static double BlockSize()    { return 0.085; }//m
+  static double LinkDistance() { return BlockSize()*1.1; }
+  static bool   Smear( TRandom3* r, double& edep ) {
+    const double Npe_Edep = 2.335e3;
+    const double sigma_Npe_Edep = 1.47e2;
+    edep = r->Gaus(Npe_Edep*edep, sigma_Npe_Edep*edep)/Npe_Edep;
+    return true;
+  }
+};
+
+#endif//__TSBSCALOCLUSTERER_H
@@ -1,11 +1,14 @@
 #include "TSBSDBManager.h"
 #include "TSBSSimDecoder.h"
+#include "TSBSDBSnapshot.h"
 #include <cassert>
 #include <cmath>
 #include "TMath.h"
 #include "TVector2.h"
 #include "TRandom3.h"
 #include "TSystem.h"
+#include "TStopwatch.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -18,7 +21,7 @@ TSBSDBManager::TSBSDBManager()
     fFAECID(0), fLAECID(0),
     fChanPerSlot(2048), fModulesPerReadOut(1), fModulesPerChamber(1), fChambersPerCrate(1),
     fg4sbsDetectorType(0), fg4sbsZSpecOffset(0),
-    fCaloThr(0), fgCaloZ(0), fgCaloRes(0), fgDoCalo(0), fgZ0(0),
+    fCaloThr(0), fCaloMaxClusters(1), fgCaloZ(0), fgCaloRes(0), fgDoCalo(0), fgZ0(0),
     fOrderOptics(0), 
     fErrID(-999), fErrVal(-999.)
 {
@@ -29,9 +32,9 @@ TSBSDBManager::~TSBSDBManager()
 }
 
 //______________________________________________________________
-static bool OpenInput( const string& filename, ifstream& ifs )
+static bool OpenInput( const string& filename, ifstream& ifs, string& path )
 {
-  // Open input stream 'ifs' for file 'filename'.
+  // Open input stream 'ifs' for file 'filename', 'path' is set to the file found.
   // Look first in current directory, then in $DB_DIR, then in
   // $LIBSBSGEM/db
 
@@ -53,7 +56,7 @@ static bool OpenInput( const string& filename, ifstream& ifs )
     FileLoc& f = fileloc[i];
     if( !f.env )
       continue;
-    string path(f.env);
+    path = f.env;
     if( !path.empty() )
       path += "/";
     if( !f.subdir.empty() )
@@ -76,7 +79,8 @@ void TSBSDBManager::LoadGeneralInfo(const string& fileName)
   //"Module" means a independent GEM module which is a sub division of the "Plane"
   
     ifstream input;
-    if ( !OpenInput(fileName,input) ){
+    string path;
+    if ( !OpenInput(fileName,input,path) ){
         cout<<"cannot find general information file "<<fileName
             <<". Exiting the program"<<endl;
         exit(0);
@@ -120,7 +124,21 @@ void TSBSDBManager::LoadGeneralInfo(const string& fileName)
         { 0 }
     };
     
-    int err = LoadDB( input, request,  prefix);
+    // The file is parsed by LoadDB only if the values are not in the snapshot
+    input.close();
+    DBFile_t db;
+    db.fName = fileName;
+    db.fPath = path;
+    
+    int err = LoadDB( db, request,  prefix);
+    if( err ) {cout<<"Load DB error"<<endl;exit(2);} 
+    
+    // Optional keys, older database files do not have them
+    DBRequest optRequest[] = {
+	{"calo_maxclusters",    &fCaloMaxClusters     , kInt,    0, 1},
+        { 0 }
+    };
+    err = LoadDB( db, optRequest, prefix, false );
     if( err ) {cout<<"Load DB error"<<endl;exit(2);} 
     
     if(fOrderOptics>0){
@@ -134,15 +152,19 @@ void TSBSDBManager::LoadGeneralInfo(const string& fileName)
       exit(2);
     }
     int nGEMtot=0;
+    fNModule.clear();
+    fFirstGEM.clear();
+    fIgemtoPlane.clear();
+    fIgemtoModule.clear();
     for(int i=0;i<fNGEMPlane;i++)
       {
 	int nmodule = NModule->at(i);
 	fNModule.push_back(nmodule);
+	fFirstGEM.push_back(nGEMtot);
 	for(int j=0;j<nmodule;j++)
 	  {
-	    fmPMtoIgem[i][j]=nGEMtot;
-	    fmIgemtoPlane[nGEMtot]=i;
-	    fmIgemtoModule[nGEMtot]=j;
+	    fIgemtoPlane.push_back(i);
+	    fIgemtoModule.push_back(j);
 	    //cout << "igem = " << nGEMtot << ", plane = " << i << ", module = " << j << endl;
 	    nGEMtot++;
 	  }
@@ -153,7 +175,7 @@ void TSBSDBManager::LoadGeneralInfo(const string& fileName)
         ostringstream signal_prefix(prefix, ios_base::ate);
         signal_prefix<<"signal"<<i+1<<".";
         
-        err = LoadDB(input, signalRequest, signal_prefix.str());
+        err = LoadDB(db, signalRequest, signal_prefix.str());
         
         fSigPID.push_back(pid);
         fSigTID.push_back(tid);
@@ -173,7 +195,8 @@ void TSBSDBManager::LoadGeneralInfo(const string& fileName)
     
     // fChambersPerCrate = 
     // (TSBSSimDecoder::GetMAXSLOT()/fModulesPerChamber/fNChamber) * fNChamber;
-    input.close();
+    
+    ReportDB(db);
 
     
 }
@@ -183,11 +206,16 @@ void TSBSDBManager::LoadGeoInfo(const string& prefix)
   const string& fileName = "db_"+prefix+".dat";
     
   ifstream input;
-  if( !OpenInput(fileName,input) ) {
+  string path;
+  if( !OpenInput(fileName,input,path) ) {
     cout<<"cannot find geometry file "<<fileName
 	<<". Exiting the program"<<endl;
     exit(0);
   }
+  input.close();
+  DBFile_t db;
+  db.fName = fileName;
+  db.fPath = path;
       
   GeoInfo thisGeo;
   
@@ -219,40 +247,115 @@ void TSBSDBManager::LoadGeoInfo(const string& prefix)
       //      int idx = j;
       plane_prefix<<".plane"<<i<<".module"<<j<<".";
       
-      int err = LoadDB(input, request, plane_prefix.str());
+      int err = LoadDB(db, request, plane_prefix.str());
       if( err ) exit(2);
      
-      err = LoadDB(input, plane_request, plane_prefix.str());
+      err = LoadDB(db, plane_request, plane_prefix.str());
       if (err) exit(2);
       
       fPMGeoInfo[i].push_back(thisGeo);
     }
   }
-  input.close();
+  ReportDB(db);
+  
+  BuildPlaneGeoTable();
+}
+
+//______________________________________________________________
+void TSBSDBManager::BuildPlaneGeoTable()
+{
+  // Fill fPlaneGeo from fPMGeoInfo (see header)
+  fPlaneGeo.clear();
+  fPlaneGeo.resize(fNGEMPlane);
+  for (int i=0; i<fNGEMPlane; i++){
+    const vector<GeoInfo>& geo = fPMGeoInfo[i];
+    PlaneGeo_t& pg = fPlaneGeo[i];
+    int nmod = geo.size();
+    
+    vector<double> low(nmod), high(nmod);
+    for (int j=0; j<nmod; j++){
+      pg.fD0.push_back(geo[j].d0);
+      pg.fXOffset.push_back(geo[j].xoffset);
+      pg.fDX.push_back(geo[j].dx);
+      pg.fDY.push_back(geo[j].dy);
+      low[j]  = geo[j].xoffset-geo[j].dx/2.0;
+      high[j] = geo[j].xoffset+geo[j].dx/2.0;
+      pg.fEdges.push_back(low[j]);
+      pg.fEdges.push_back(high[j]);
+    }
+    sort(pg.fEdges.begin(), pg.fEdges.end());
+    pg.fEdges.erase(unique(pg.fEdges.begin(), pg.fEdges.end()), pg.fEdges.end());
+    
+    int nedge = pg.fEdges.size();
+    pg.fAtEdge.assign(nedge, -1);
+    pg.fInside.assign(nedge, -1);
+    for (int k=0; k<nedge; k++){
+      double e = pg.fEdges[k];
+      for (int j=0; j<nmod; j++){
+	if (low[j]<=e && e<=high[j])
+	  pg.fAtEdge[k] = j;
+	if (k+1<nedge && low[j]<=e && pg.fEdges[k+1]<=high[j])
+	  pg.fInside[k] = j;
+      }
+    }
+  }
 }
 
 
 
 //______________________________________________________________
-string TSBSDBManager::FindKey( ifstream& inp, const string& key ) const
+void TSBSDBManager::ParseDB( ifstream& inp, const string& name, DBFile_t& db ) const
 {
-  static const string empty("");
+  // Read the whole file once. Each line "key[ \t=]+value" gives one entry;
+  // the value is the rest of the line. Keys are then matched exactly
+  // (see DBFile_t). As with the former line-by-line search, the first
+  // occurrence of a key wins.
+  TStopwatch timer;
+  db.fName = name;
+  db.fKeys.clear();
+  db.fParsed = true;
+  
   string line;
-  string::size_type keylen = key.size();
-  inp.seekg(0); // could probably be more efficient, but it's fast enough
+  inp.clear();
+  inp.seekg(0);
   while( getline(inp,line) ) {
-    if( line.size() <= keylen )
+    string::size_type kend = line.find_first_of(" \t=");
+    if( kend == 0 || kend == string::npos || line[0] == '#' )
       continue;
-    if( line.compare(0,keylen,key) == 0 ) {
-      if( keylen < line.size() ) {
-	string::size_type pos = line.find_first_not_of(" \t=", keylen);
-	if( pos != string::npos )
-	  return line.substr(pos);
-      }
-      break;
-    }
+    string::size_type pos = line.find_first_not_of(" \t=", kend);
+    DBValue_t val;
+    if( pos != string::npos )
+      val.fVal = line.substr(pos);
+    db.fKeys.insert( make_pair(line.substr(0,kend), val) );
+  }
+  timer.Stop();
+  db.fParseTime = timer.RealTime()*1.0e3;
+}
+//______________________________________________________________
+void TSBSDBManager::ReportDB( const DBFile_t& db ) const
+{
+  // Print number of keys found/used in the file, parse time and unused keys
+  if( !db.fParsed ) {
+    cout << "TSBSDBManager: " << db.fName << ": " << db.fUsed.size()
+	 << " keys loaded from database snapshot" << endl;
+    return;
+  }
+  int nused = 0;
+  vector<string> unused;
+  for( unordered_map<string,DBValue_t>::const_iterator it = db.fKeys.begin();
+       it != db.fKeys.end(); ++it ) {
+    if( db.fUsed.count(it->first) ) nused++;
+    else unused.push_back(it->first);
+  }
+  cout << "TSBSDBManager: " << db.fName << ": " << db.fKeys.size() << " keys, "
+       << nused << " loaded, parsed in " << db.fParseTime << " ms" << endl;
+  if( !unused.empty() ) {
+    sort( unused.begin(), unused.end() );
+    cout << "TSBSDBManager: unused keys in " << db.fName << ":";
+    for( size_t i = 0; i < unused.size(); i++ )
+      cout << " " << unused[i];
+    cout << endl;
   }
-  return empty;
 }
 //_________________________________________________________________________
 bool TSBSDBManager::CheckIndex(int i, int j, int k) const//(plane, module, readoutAxis)
@@ -271,14 +374,33 @@ bool TSBSDBManager::CheckIndex(int i, int j, int k) const//(plane, module, reado
     return true;
 }
 //_________________________________________________________________
-int TSBSDBManager::LoadDB( ifstream& inp, DBRequest* request, const string& prefix )
+int TSBSDBManager::LoadDB( DBFile_t& db, DBRequest* request, const string& prefix,
+			   bool required )
 {
+  // Values are taken from the database snapshot if it has them,
+  // otherwise the file is parsed (once) and the values are recorded
+  TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
+  const string snapkey = "TSBSDBManager:" + db.fName + ":" + prefix + request->name;
+  if( snap->Restore(snapkey, request, 0) ) {
+    for( DBRequest* item = request; item->name; ++item )
+      db.fUsed.insert( prefix + item->name );
+    return 0;
+  }
+  if( !db.fParsed ) {
+    ifstream inp(db.fPath.c_str());
+    ParseDB( inp, db.fName, db );
+  }
+  
+  static const string empty("");
   DBRequest* item = request;
   while( item->name ) {
     ostringstream sn(prefix, ios_base::ate);
     sn << item->name;
     const string& key = sn.str();
-    string val = FindKey(inp,key);
+    unordered_map<string,DBValue_t>::iterator found = db.fKeys.find(key);
+    if( found != db.fKeys.end() )
+      db.fUsed.insert(key);
+    const string& val = ( found != db.fKeys.end() ) ? found->second.fVal : empty;
     Int_t tempval;
     if( !val.empty() ) {
       istringstream sv(val);
@@ -313,12 +435,13 @@ int TSBSDBManager::LoadDB( ifstream& inp, DBRequest* request, const string& pref
 	cerr << "Error converting key/value = " << key << "/" << val << endl;
 	return 1;
       }
-    } else {
+    } else if( required ) {
       cerr << "key \"" << key << "\" not found" << endl;
       return 2;
     }
     ++item;
   }
+  snap->Store(snapkey, request, 0, db.fPath.c_str());
   return 0;
 }
 //_____________________________________________________________________
@@ -347,28 +470,12 @@ double TSBSDBManager::GetDMag(int i, int j)
   return fPMGeoInfo[i].at(j).dmag;
 }
 //______________________________________________________________________
-double TSBSDBManager::GetD0(int i, int j)
-{
-  if (!CheckIndex(i, j)) return fErrVal;
-  return fPMGeoInfo[i].at(j).d0;
-}
-//______________________________________________________________________
-double TSBSDBManager::GetXOffset(int i, int j)
-{
-  if (!CheckIndex(i, j)) return fErrVal;
-  return fPMGeoInfo[i].at(j).xoffset;
-}
-//______________________________________________________________________
-double TSBSDBManager::GetDX(int i, int j)
-{
-  if (!CheckIndex(i, j)) return fErrVal;
-  return fPMGeoInfo[i].at(j).dx;
-}
-//______________________________________________________________________
-double TSBSDBManager::GetDY(int i, int j)
+double TSBSDBManager::GeoError(int i, int j) const
 {
-  if (!CheckIndex(i, j)) return fErrVal;
-  return fPMGeoInfo[i].at(j).dy;
+  // Out-of-range plane/module in one of the inline geometry getters
+  if (CheckIndex(i, j))
+    cout<<"no geometry loaded for plane "<<i<<" module "<<j<<endl;
+  return fErrVal;
 }
 //______________________________________________________________________
 // double TSBSDBManager::GetThetaH(int i, int j) const
@@ -399,30 +506,28 @@ double TSBSDBManager::GetStripAngle(int i, int j, int k)
 
 
 
-int TSBSDBManager::GetModuleIDFromPos(int iplane, double x, double /*y*/)
+int TSBSDBManager::GetModuleIDFromPos(int iplane, double x, double /*y*/) const
 {
-  if (!CheckIndex(iplane)) return fErrVal;
-  
-  int module = -1;
-  for(size_t k = 0; k<fPMGeoInfo[iplane].size(); k++){
-    if(fPMGeoInfo[iplane].at(k).xoffset-fPMGeoInfo[iplane].at(k).dx/2.0<=x && 
-       x<=fPMGeoInfo[iplane].at(k).xoffset+fPMGeoInfo[iplane].at(k).dx/2.0)
-      {
-        module = k;
-	// cout << " TSBSDBManager::GetModuleIDFromPos: iplane= " << iplane << ", x= " << x 
-	//      << ", plane offset " << fPMGeoInfo[iplane].at(k).xoffset 
-	//      << ", half size " << fPMGeoInfo[iplane].at(k).dx/2.0 
-	//      << ", module " << k << endl;
-      }
+  // Module of plane iplane with xoffset-dx/2 <= x <= xoffset+dx/2 
+  // (the highest module index if several), -1 if none.
+  if (iplane < 0 || iplane >= (int)fPlaneGeo.size()) {
+    if (!CheckIndex(iplane)) return fErrVal;
+    return -1;
   }
-
-  return module;
+  const PlaneGeo_t& pg = fPlaneGeo[iplane];
+  
+  // last edge <= x
+  vector<double>::const_iterator it = upper_bound(pg.fEdges.begin(), pg.fEdges.end(), x);
+  if (it == pg.fEdges.begin()) return -1;
+  size_t k = (it - pg.fEdges.begin()) - 1;
+  
+  return (x == pg.fEdges[k]) ? pg.fAtEdge[k] : pg.fInside[k];
 }
 
 //__________________________________________________________________________
 
 double TSBSDBManager::GetPosFromModuleStrip(int iproj, int iplane,
-					    int imodule, int istrip)
+					    int imodule, int istrip) const
 {
   if (!CheckIndex(iplane, imodule)) return fErrVal;
 
@@ -444,6 +549,19 @@ double TSBSDBManager::GetPosFromModuleStrip(int iproj, int iplane,
 
 void TSBSDBManager::LoadOptics()
 {
+  TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
+  const string snapkey = "TSBSDBManager:optics:" + fOpticsFile;
+  TSBSDBSnapshot::Block* block = snap->FindBlock(snapkey);
+  if( block ) {
+    bool ok = block->Get(fNOpticsTerms);
+    for(int i_ = 0; i_<9 && ok; i_++)
+      ok = block->Get(fOpticsCoeff[i_]);
+    if( ok ) {
+      SetupOptics();
+      return;
+    }
+  }
+  
   ifstream in(fOpticsFile.c_str());
   int N, i, j, k, l, m;
   double cxfp, cyfp, cxpfp, cypfp;
@@ -494,6 +612,38 @@ void TSBSDBManager::LoadOptics()
     fOpticsCoeff[8].push_back((double)m);
   }
   
+  SetupOptics();
+  
+  if( (block = snap->NewBlock(snapkey)) ){
+    block->AddSource(fOpticsFile.c_str());
+    block->Put(fNOpticsTerms);
+    for(int i_ = 0; i_<9; i_++)
+      block->Put(fOpticsCoeff[i_]);
+  }
+}
+
+void TSBSDBManager::SetupOptics()
+{
+  // Copy the optics terms of fOpticsCoeff to the evaluator fOptics
+  
+  fOptics.Clear();
+  for(int i_ = 0; i_<fNOpticsTerms && i_<(int)fOpticsCoeff[8].size(); i_++){
+    double coeff[TSBSOptics::kNFocal];
+    int expo[TSBSOptics::kNTarget];
+    coeff[TSBSOptics::kXfp]  = fOpticsCoeff[0][i_];
+    coeff[TSBSOptics::kYfp]  = fOpticsCoeff[1][i_];
+    coeff[TSBSOptics::kXpfp] = fOpticsCoeff[2][i_];
+    coeff[TSBSOptics::kYpfp] = fOpticsCoeff[3][i_];
+    expo[TSBSOptics::kXptar] = (int)fOpticsCoeff[8][i_];
+    expo[TSBSOptics::kYptar] = (int)fOpticsCoeff[7][i_];
+    expo[TSBSOptics::kYtar]  = (int)fOpticsCoeff[6][i_];
+    expo[TSBSOptics::kPinv]  = (int)fOpticsCoeff[5][i_];
+    expo[TSBSOptics::kXtar]  = (int)fOpticsCoeff[4][i_];
+    fOptics.AddTerm(coeff, expo);
+  }
+  if( fOrderOptics > 0 && fOptics.GetOrder() > fOrderOptics )
+    cout << "Warning: optics file " << fOpticsFile << " has terms of order "
+	 << fOptics.GetOrder() << " > order_optics = " << fOrderOptics << endl;
 }
 
 double TSBSDBManager::GetOpticsCoeff(int i, int j){
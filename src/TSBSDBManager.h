@@ -5,12 +5,15 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <sstream>
 #include "Rtypes.h"
 #include "VarDef.h"
 #include "TMath.h"
 #include "types.h"
+#include "TSBSOptics.h"
 
 class TSBSDBManager {
 public:
@@ -30,9 +33,12 @@ public:
     int       GetNSector() const           { return fNSector;             }
     int       GetNGEMPlane() const         { return fNGEMPlane;           }
     int       GetNModule(int plane) const  { if(plane<0) return 0; else return fNModule[plane]; }
-    int       GetPlaneID(int igem)         { return fmIgemtoPlane[igem];  }
-    int       GetModuleID(int igem)        { return fmIgemtoModule[igem]; }
-    int       GetGEMID(int ip,int im)      { return fmPMtoIgem[ip][im];   }
+    // Plane/module <-> GEM index, -1 if out of range
+    int       GetPlaneID(int igem) const   { return (igem>=0 && igem<(int)fIgemtoPlane.size()) ? fIgemtoPlane[igem] : -1; }
+    int       GetModuleID(int igem) const  { return (igem>=0 && igem<(int)fIgemtoModule.size()) ? fIgemtoModule[igem] : -1; }
+    int       GetGEMID(int ip,int im) const {
+      return (ip>=0 && ip<(int)fNModule.size() && im>=0 && im<fNModule[ip]) ? fFirstGEM[ip]+im : -1;
+    }
     /* // see comment l. 93-95. */
     /* int      GetNChamber2() const          { return fNChamber2;            } */
     /* int      GetNSector2() const           { return fNSector2;             } */
@@ -60,36 +66,66 @@ public:
     double    GetCaloZ() const             { return fgCaloZ;              }
     double    GetCaloRes() const           { return fgCaloRes;            }
     int       DoCalo() const               { return fgDoCalo;             }
+    int       GetCaloMaxClusters() const   { return fCaloMaxClusters;     }
 
     //For Optics;
     double    GetOrderOptics() const { return fOrderOptics; }
     double    GetNOpticsTerms() const { return fNOpticsTerms; }
     double    GetOpticsCoeff(int, int);
+    // Optics polynomial, for evaluation
+    const TSBSOptics& GetOptics() const { return fOptics; }
     
     void     SetZ0( Double_t z0 ) { fgZ0 = z0; }
     // Support for calorimeter emulation. Static functions to allow script access
     void     EmulateCalorimeter( Bool_t f = true ) { fgDoCalo = f; }
     void     SetCaloZ( Double_t z )     { fgCaloZ   = z; }
     void     SetCaloRes( Double_t res ) { fgCaloRes = res; }
+    void     SetCaloMaxClusters( Int_t n ) { fCaloMaxClusters = n; }
     
     double    GetDMag(int i, int j);
-    double    GetD0(int i, int j);
-    double    GetXOffset(int i, int j);
-    double    GetDX(int i, int j);
-    double    GetDY(int i, int j);
+    // Per-hit geometry: flat table lookups, see BuildPlaneGeoTable
+    double    GetD0(int i, int j) const      { return ValidPM(i,j) ? fPlaneGeo[i].fD0[j]      : GeoError(i,j); }
+    double    GetXOffset(int i, int j) const { return ValidPM(i,j) ? fPlaneGeo[i].fXOffset[j] : GeoError(i,j); }
+    double    GetDX(int i, int j) const      { return ValidPM(i,j) ? fPlaneGeo[i].fDX[j]      : GeoError(i,j); }
+    double    GetDY(int i, int j) const      { return ValidPM(i,j) ? fPlaneGeo[i].fDY[j]      : GeoError(i,j); }
     //double    GetThetaH(int i, int j);
     double    GetThetaV(int i, int j);
     double    GetStripAngle(int i, int j, int k);
     //double    GetPitch(int i, int j, int k);
     
-    int GetModuleIDFromPos(int iplane, double x, double y = 0);
-    double GetPosFromModuleStrip(int iproj, int iplane, int isector, int istrip);
+    int GetModuleIDFromPos(int iplane, double x, double y = 0) const;
+    double GetPosFromModuleStrip(int iproj, int iplane, int isector, int istrip) const;
 
 protected:
     TSBSDBManager();
-    int    LoadDB(std::ifstream& inp, DBRequest* request, const std::string& prefix);
-    std::string FindKey( std::ifstream& inp, const std::string& key ) const;
+    // Database file, tokenized once into key -> value string.
+    // Keys are matched exactly: a line "key[ \t=]+value" defines key only.
+    // (The former search matched any line starting with the key, so that
+    // e.g. "nplanes 4" also gave "s 4" for the key "nplane".)
+    struct DBValue_t {
+      std::string fVal;
+    };
+    struct DBFile_t {
+      DBFile_t() : fParsed(false), fParseTime(0) {}
+      std::string fName;
+      std::string fPath;   // file found by OpenInput
+      bool        fParsed; // false if everything came from the snapshot
+      std::unordered_map<std::string, DBValue_t> fKeys;
+      std::unordered_set<std::string> fUsed; // keys loaded, from the file or the snapshot
+      double      fParseTime; // ms
+    };
+    void   ParseDB(std::ifstream& inp, const std::string& name, DBFile_t& db) const;
+    // required = false: keys missing from the file keep their current value
+    int    LoadDB(DBFile_t& db, DBRequest* request, const std::string& prefix,
+		  bool required = true);
+    void   ReportDB(const DBFile_t& db) const;
     bool   CheckIndex(int i, int j=0, int k=0) const;
+    void   BuildPlaneGeoTable();
+    double GeoError(int i, int j) const;
+    bool   ValidPM(int i, int j) const {
+      return ( i >= 0 && i < (int)fPlaneGeo.size() && 
+	       j >= 0 && j < (int)fPlaneGeo[i].fD0.size() );
+    }
     
     static TSBSDBManager* fManager;
 
@@ -102,9 +138,9 @@ protected:
     int    fNSector;
     int    fNGEMPlane;
     std::vector<Int_t> fNModule;
-    std::map<Int_t,std::map<Int_t, Int_t> > fmPMtoIgem;
-    std::map<Int_t, Int_t> fmIgemtoPlane;
-    std::map<Int_t, Int_t> fmIgemtoModule;
+    std::vector<Int_t> fFirstGEM;     // GEM index of module 0 of each plane
+    std::vector<Int_t> fIgemtoPlane;  // plane of each GEM index
+    std::vector<Int_t> fIgemtoModule; // module of each GEM index
 
     int    fNReadOut;
     int    fNSigParticle;
@@ -132,6 +168,7 @@ protected:
 
     // Parameters for simple calorimeter analysis
     double fCaloThr;
+    int    fCaloMaxClusters; // max clusters per event (optional, default 1)
     
     // Parameters for TSBSSimDecoder
     // Calorimeter emulation
@@ -151,12 +188,30 @@ protected:
     int fNOpticsTerms;
     std::string fOpticsFile;
     std::map< int, std::vector<double> > fOpticsCoeff;
+    TSBSOptics fOptics;   // fOpticsCoeff in flat arrays
     void LoadOptics();
+    void SetupOptics();
     
     /* vector<double> fChamberZ; */
     std::map< int, std::vector<GeoInfo> > fGeoInfo;
     std::map< int, std::vector<GeoInfo> > fPMGeoInfo; //plane module format geo info
     
+    // Flat per-plane copy of the geometry used for each g4sbs hit.
+    // The module x intervals [xoffset-dx/2, xoffset+dx/2] are cut at all their edges
+    // into elementary segments, each one tagged with the module GetModuleIDFromPos 
+    // returns for it (the highest module index containing it), 
+    // so that the lookup is a binary search on fEdges.
+    struct PlaneGeo_t {
+      std::vector<double> fEdges;   // sorted unique module edges
+      std::vector<int>    fAtEdge;  // module for x == fEdges[i]
+      std::vector<int>    fInside;  // module for fEdges[i] < x < fEdges[i+1]
+      std::vector<double> fD0;      // indexed by module
+      std::vector<double> fXOffset;
+      std::vector<double> fDX;
+      std::vector<double> fDY;
+    };
+    std::vector<PlaneGeo_t> fPlaneGeo;
+    
 };
 
 #endif
@@ -0,0 +1,407 @@
+#include "TSBSDBSnapshot.h"
+
+#include "VarDef.h"
+#include <TSystem.h>
+#include <TString.h>
+#include <TMD5.h>
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+// File layout (version 1):
+//   Header_t
+//   payload: for each block, its key, its sources (name, is-path flag,
+//   size, modification time) and its data, written with Block::Put.
+// fDigest is the MD5 sum of the payload.
+// All numbers are in the native byte order of the machine that wrote the file.
+
+namespace {
+  const char kMagic[8] = { 'S','B','S','D','B','S','N','P' };
+
+  struct Header_t {
+    char     fMagic[8];
+    UInt_t   fVersion;
+    UInt_t   fNBlocks;
+    Long64_t fPayloadSize;
+    UChar_t  fDigest[16];
+  };
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Block::Get( void* p, size_t n )
+{
+  if( fPos+n > fData.size() ) return false;
+  memcpy( p, fData.data()+fPos, n );
+  fPos += n;
+  return true;
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Block::Get( string& s )
+{
+  UInt_t n;
+  if( !Get(n) || fPos+n > fData.size() ) return false;
+  s.assign( fData.data()+fPos, n );
+  fPos += n;
+  return true;
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Block::PutRequest( const DBRequest* req )
+{
+  // Each variable is preceded by its name and type, so that a block
+  // recorded by a different version of the code is not used
+  for( ; req && req->name; req++ ) {
+    Put( string(req->name) );
+    Put( Int_t(req->type) );
+    UInt_t n = req->nelem > 0 ? req->nelem : 1;
+    switch( req->type ) {
+    case kDouble:
+      for( UInt_t i=0; i<n; i++ ) Put( static_cast<Double_t*>(req->var)[i] );
+      break;
+    case kFloat:
+      for( UInt_t i=0; i<n; i++ ) Put( static_cast<Float_t*>(req->var)[i] );
+      break;
+    case kInt:
+      for( UInt_t i=0; i<n; i++ ) Put( static_cast<Int_t*>(req->var)[i] );
+      break;
+    case kUInt:
+      for( UInt_t i=0; i<n; i++ ) Put( static_cast<UInt_t*>(req->var)[i] );
+      break;
+    case kString:
+      Put( *static_cast<string*>(req->var) );
+      break;
+    case kTString:
+      Put( string(static_cast<TString*>(req->var)->Data()) );
+      break;
+    case kIntV:
+      Put( *static_cast< vector<Int_t>* >(req->var) );
+      break;
+    case kFloatV:
+      Put( *static_cast< vector<Float_t>* >(req->var) );
+      break;
+    case kDoubleV:
+      Put( *static_cast< vector<Double_t>* >(req->var) );
+      break;
+    default:
+      fprintf(stderr, "%s: unsupported type %d for \"%s\"\n", __PRETTY_FUNCTION__,
+	      req->type, req->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Block::GetRequest( const DBRequest* req )
+{
+  for( ; req && req->name; req++ ) {
+    string name;
+    Int_t type;
+    if( !Get(name) || !Get(type) || name != req->name || type != req->type )
+      return false;
+    UInt_t n = req->nelem > 0 ? req->nelem : 1;
+    Bool_t ok = true;
+    switch( req->type ) {
+    case kDouble:
+      for( UInt_t i=0; i<n && ok; i++ ) ok = Get( static_cast<Double_t*>(req->var)[i] );
+      break;
+    case kFloat:
+      for( UInt_t i=0; i<n && ok; i++ ) ok = Get( static_cast<Float_t*>(req->var)[i] );
+      break;
+    case kInt:
+      for( UInt_t i=0; i<n && ok; i++ ) ok = Get( static_cast<Int_t*>(req->var)[i] );
+      break;
+    case kUInt:
+      for( UInt_t i=0; i<n && ok; i++ ) ok = Get( static_cast<UInt_t*>(req->var)[i] );
+      break;
+    case kString:
+      ok = Get( *static_cast<string*>(req->var) );
+      break;
+    case kTString:
+      {
+	string s;
+	ok = Get(s);
+	*static_cast<TString*>(req->var) = s.c_str();
+      }
+      break;
+    case kIntV:
+      ok = Get( *static_cast< vector<Int_t>* >(req->var) );
+      break;
+    case kFloatV:
+      ok = Get( *static_cast< vector<Float_t>* >(req->var) );
+      break;
+    case kDoubleV:
+      ok = Get( *static_cast< vector<Double_t>* >(req->var) );
+      break;
+    default:
+      ok = false;
+    }
+    if( !ok ) return false;
+  }
+  return true;
+}
+
+//______________________________________________________________
+void TSBSDBSnapshot::Block::AddSource( const char* path )
+{
+  Source_t src;
+  src.fName = path;
+  src.fIsPath = true;
+  src.fSize = -1;
+  src.fMTime = 0;
+  FileStat_t st;
+  if( gSystem->GetPathInfo(path, st) == 0 ) {
+    src.fSize = st.fSize;
+    src.fMTime = st.fMtime;
+  }
+  fSources.push_back(src);
+}
+
+//______________________________________________________________
+void TSBSDBSnapshot::Block::AddSource( FILE* fi, const char* name )
+{
+  Source_t src;
+  src.fName = name ? name : "";
+  src.fIsPath = false;
+  src.fSize = -1;
+  src.fMTime = 0;
+  struct stat st;
+  if( fi && fstat(fileno(fi), &st) == 0 ) {
+    src.fSize = st.st_size;
+    src.fMTime = st.st_mtime;
+  }
+  fSources.push_back(src);
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Block::IsFresh( FILE* fi ) const
+{
+  // True if all the sources still have the recorded size and
+  // modification time. Sources added by file handle are compared with fi.
+  for( size_t i=0; i<fSources.size(); i++ ) {
+    const Source_t& src = fSources[i];
+    if( src.fSize < 0 ) return false;
+    Long64_t size;
+    Long_t mtime;
+    if( src.fIsPath ) {
+      FileStat_t st;
+      if( gSystem->GetPathInfo(src.fName.c_str(), st) != 0 ) return false;
+      size = st.fSize;
+      mtime = st.fMtime;
+    } else {
+      struct stat st;
+      if( !fi || fstat(fileno(fi), &st) != 0 ) return false;
+      size = st.st_size;
+      mtime = st.st_mtime;
+    }
+    if( size != src.fSize || mtime != src.fMTime ) return false;
+  }
+  return true;
+}
+
+//______________________________________________________________
+TSBSDBSnapshot::TSBSDBSnapshot()
+  : fRecording(false), fNRestored(0), fNStale(0)
+{
+  const char* env = gSystem->Getenv("SBS_DB_SNAPSHOT");
+  if( env && *env && !Open(env) )
+    cout << "Database snapshot " << env << " not used, reading the text databases" << endl;
+}
+
+//______________________________________________________________
+TSBSDBSnapshot::~TSBSDBSnapshot()
+{
+  Close();
+}
+
+//______________________________________________________________
+TSBSDBSnapshot* TSBSDBSnapshot::GetInstance()
+{
+  // Created on first use, destroyed at program exit
+  static TSBSDBSnapshot instance;
+  return &instance;
+}
+
+//______________________________________________________________
+Int_t TSBSDBSnapshot::Open( const char* filename )
+{
+  // Read the snapshot file. Return 0 on fail, 1 on success
+  Close();
+  if( !filename || !*filename ) return 0;
+
+  ifstream in( filename, ios::binary );
+  if( !in.good() ) {
+    fprintf(stderr, "%s: cannot open %s\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  Header_t h;
+  if( !in.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+      memcmp(h.fMagic, kMagic, sizeof(kMagic)) != 0 ) {
+    fprintf(stderr, "%s: %s is not a database snapshot\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  if( h.fVersion != kVersion ) {
+    fprintf(stderr, "%s: %s has version %u, expected %u: please regenerate it\n",
+	    __PRETTY_FUNCTION__, filename, h.fVersion, kVersion);
+    return 0;
+  }
+  // Check the payload size against the file before allocating it
+  streampos pos = in.tellg();
+  in.seekg( 0, ios::end );
+  Long64_t avail = Long64_t(in.tellg()) - Long64_t(pos);
+  in.seekg( pos );
+  if( h.fPayloadSize < 0 || h.fPayloadSize > avail ) {
+    fprintf(stderr, "%s: %s is truncated\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  Block payload;
+  payload.fData.resize( h.fPayloadSize );
+  if( h.fPayloadSize > 0 && !in.read(&payload.fData[0], h.fPayloadSize) ) {
+    fprintf(stderr, "%s: %s is truncated\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  TMD5 md5;
+  md5.Update( reinterpret_cast<const UChar_t*>(payload.fData.data()), payload.fData.size() );
+  UChar_t digest[16];
+  md5.Final(digest);
+  if( memcmp(digest, h.fDigest, sizeof(digest)) != 0 ) {
+    fprintf(stderr, "%s: checksum error in %s\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+
+  map<string, Block> blocks;
+  for( UInt_t ib=0; ib<h.fNBlocks; ib++ ) {
+    string key;
+    UInt_t nsrc;
+    if( !payload.Get(key) || !payload.Get(nsrc) ) break;
+    Block& b = blocks[key];
+    b.fSources.resize(nsrc);
+    Bool_t ok = true;
+    for( UInt_t i=0; i<nsrc && ok; i++ ) {
+      Block::Source_t& src = b.fSources[i];
+      ok = payload.Get(src.fName) && payload.Get(src.fIsPath) &&
+	payload.Get(src.fSize) && payload.Get(src.fMTime);
+    }
+    if( !ok || !payload.Get(b.fData) ) {
+      fprintf(stderr, "%s: %s is corrupted\n", __PRETTY_FUNCTION__, filename);
+      return 0;
+    }
+  }
+  fBlocks.swap(blocks);
+  fFilename = filename;
+  cout << "Database snapshot " << filename << ": " << fBlocks.size() << " blocks" << endl;
+  return 1;
+}
+
+//______________________________________________________________
+Int_t TSBSDBSnapshot::Write( const char* filename ) const
+{
+  // Write all recorded (and still valid loaded) blocks to filename.
+  // Return 0 on fail, 1 on success
+  Block payload;
+  for( map<string, Block>::const_iterator it = fBlocks.begin(); it != fBlocks.end(); ++it ) {
+    const Block& b = it->second;
+    payload.Put( it->first );
+    payload.Put( UInt_t(b.fSources.size()) );
+    for( size_t i=0; i<b.fSources.size(); i++ ) {
+      const Block::Source_t& src = b.fSources[i];
+      payload.Put( src.fName );
+      payload.Put( src.fIsPath );
+      payload.Put( src.fSize );
+      payload.Put( src.fMTime );
+    }
+    payload.Put( b.fData );
+  }
+
+  Header_t h;
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.fMagic, kMagic, sizeof(kMagic) );
+  h.fVersion = kVersion;
+  h.fNBlocks = fBlocks.size();
+  h.fPayloadSize = payload.fData.size();
+  TMD5 md5;
+  md5.Update( reinterpret_cast<const UChar_t*>(payload.fData.data()), payload.fData.size() );
+  md5.Final(h.fDigest);
+
+  ofstream out( filename, ios::binary | ios::trunc );
+  out.write( reinterpret_cast<const char*>(&h), sizeof(h) );
+  out.write( payload.fData.data(), payload.fData.size() );
+  out.close();
+  if( !out ) {
+    fprintf(stderr, "%s: error writing %s\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  cout << "Database snapshot " << filename << " written: " << fBlocks.size() << " blocks" << endl;
+  return 1;
+}
+
+//______________________________________________________________
+void TSBSDBSnapshot::Close()
+{
+  if( IsOpen() && (fNRestored > 0 || fNStale > 0) )
+    cout << "Database snapshot " << fFilename << ": " << fNRestored << " blocks used, "
+	 << fNStale << " out of date" << endl;
+  fFilename.clear();
+  fBlocks.clear();
+  fNRestored = fNStale = 0;
+}
+
+//______________________________________________________________
+TSBSDBSnapshot::Block* TSBSDBSnapshot::NewBlock( const string& key )
+{
+  if( !fRecording ) return 0;
+  Block& b = fBlocks[key];
+  b = Block();
+  return &b;
+}
+
+//______________________________________________________________
+TSBSDBSnapshot::Block* TSBSDBSnapshot::FindBlock( const string& key, FILE* fi )
+{
+  map<string, Block>::iterator it = fBlocks.find(key);
+  if( it == fBlocks.end() ) return 0;
+  if( !it->second.IsFresh(fi) ) {
+    cout << "Database snapshot: " << key << " is out of date, reading the text database" << endl;
+    fBlocks.erase(it);
+    fNStale++;
+    return 0;
+  }
+  fNRestored++;
+  it->second.Rewind();
+  return &it->second;
+}
+
+//______________________________________________________________
+Bool_t TSBSDBSnapshot::Restore( const string& key, const DBRequest* req, FILE* fi )
+{
+  Block* b = FindBlock(key, fi);
+  if( !b ) return false;
+  if( !b->GetRequest(req) ) {
+    cout << "Database snapshot: " << key << " does not match the code, reading the text database" << endl;
+    fBlocks.erase(key);
+    fNRestored--;
+    fNStale++;
+    return false;
+  }
+  return true;
+}
+
+//______________________________________________________________
+void TSBSDBSnapshot::Store( const string& key, const DBRequest* req, FILE* fi, const char* name )
+{
+  // Record the values of req, read from the open file fi (labelled name),
+  // or from the file at path name if fi is 0
+  Block* b = NewBlock(key);
+  if( !b ) return;
+  if( fi )
+    b->AddSource(fi, name);
+  else
+    b->AddSource(name);
+  if( !b->PutRequest(req) )
+    fBlocks.erase(key);
+}
@@ -0,0 +1,125 @@
+#ifndef __TSBSDBSNAPSHOT_H
+#define __TSBSDBSNAPSHOT_H
+
+#include <Rtypes.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+
+struct DBRequest;
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSDBSnapshot
+//
+// Binary snapshot of the databases read at startup: TSBSDBManager
+// (general info, geometry, optics), TSBSGEMChamber/TSBSGEMPlane geometry,
+// TSBSSimGEMDigitization parameters and the TSBSSimDecoder ECal shower
+// profiles.
+//
+// The snapshot is a set of named blocks. Each block holds the values
+// one loader has read, and the size and modification time of the files
+// they came from. A loader uses its block only if all these files
+// are unchanged, otherwise it reads the text database as usual.
+// The whole snapshot is protected by an MD5 checksum.
+//
+// "Compiling" the database:
+//   TSBSDBSnapshot::GetInstance()->StartRecording();
+//   ... create and Init() the detectors and the decoder as in the replay ...
+//   TSBSDBSnapshot::GetInstance()->Write("db_snapshot.bin");
+//
+// Using it: call TSBSDBSnapshot::GetInstance()->Open("db_snapshot.bin")
+// before anything is initialized, or set $SBS_DB_SNAPSHOT to the file name.
+//
+// Only the file contents are checked, not the date of the analysis:
+// a snapshot must not be used with time-dependent databases.
+
+class TSBSDBSnapshot {
+ public:
+  // Serialized values of one loader
+  class Block {
+  public:
+    Block() : fPos(0) {}
+
+    void Put( const void* p, size_t n ) { fData.append(static_cast<const char*>(p),n); }
+    template< typename T > void Put( const T& v ) { Put(&v,sizeof(T)); }
+    void Put( const std::string& s ) { Put(UInt_t(s.size())); Put(s.data(),s.size()); }
+    template< typename T > void Put( const std::vector<T>& v ) {
+      Put(UInt_t(v.size()));
+      for( size_t i=0; i<v.size(); i++ ) Put(v[i]);
+    }
+    // Store all the variables of a DBRequest list, as filled by LoadDB.
+    // Return false if one of them has an unsupported type.
+    Bool_t PutRequest( const DBRequest* req );
+
+    // The Get functions return false if the block is too short
+    Bool_t Get( void* p, size_t n );
+    template< typename T > Bool_t Get( T& v ) { return Get(&v,sizeof(T)); }
+    Bool_t Get( std::string& s );
+    template< typename T > Bool_t Get( std::vector<T>& v ) {
+      UInt_t n;
+      if( !Get(n) ) return false;
+      v.resize(n);
+      for( UInt_t i=0; i<n; i++ )
+	if( !Get(v[i]) ) return false;
+      return true;
+    }
+    Bool_t GetRequest( const DBRequest* req );
+
+    // Source files of the values
+    void   AddSource( const char* path );
+    void   AddSource( FILE* fi, const char* name );
+    Bool_t IsFresh( FILE* fi ) const;
+
+    void   Rewind() { fPos = 0; }
+
+  private:
+    friend class TSBSDBSnapshot;
+    struct Source_t {
+      std::string fName;
+      Bool_t      fIsPath;  // fName is a path to stat, otherwise only a label
+      Long64_t    fSize;
+      Long_t      fMTime;
+    };
+    std::vector<Source_t> fSources;
+    std::string fData;
+    size_t      fPos;
+  };
+
+  static const UInt_t kVersion = 1;
+
+  // Opens $SBS_DB_SNAPSHOT, if set, on the first call
+  static TSBSDBSnapshot* GetInstance();
+  ~TSBSDBSnapshot();
+
+  // Return 0 on fail, 1 on success
+  Int_t  Open( const char* filename );
+  Int_t  Write( const char* filename ) const;
+  void   Close();
+  Bool_t IsOpen() const { return !fFilename.empty(); }
+
+  void   StartRecording( Bool_t f = true ) { fRecording = f; }
+  Bool_t IsRecording() const { return fRecording; }
+
+  // New (empty) block to record into, 0 unless recording
+  Block* NewBlock( const std::string& key );
+  // Block ready to be read, 0 if absent or if its sources changed.
+  // fi is the open file of the sources added with a file handle.
+  Block* FindBlock( const std::string& key, FILE* fi = 0 );
+
+  // Shortcuts for the THaAnalysisObject::LoadDB style loaders:
+  // fill req from the snapshot, or record req once filled.
+  Bool_t Restore( const std::string& key, const DBRequest* req, FILE* fi );
+  void   Store( const std::string& key, const DBRequest* req, FILE* fi, const char* name );
+
+ private:
+  TSBSDBSnapshot();
+
+  std::string fFilename;
+  Bool_t      fRecording;
+  std::map<std::string, Block> fBlocks;
+  Int_t       fNRestored;
+  Int_t       fNStale;
+};
+
+#endif//__TSBSDBSNAPSHOT_H
@@ -2,6 +2,7 @@
 
 #include "TSBSGEMChamber.h"
 #include "TSBSGEMPlane.h"
+#include "TSBSDBSnapshot.h"
 #include "THaEvData.h"
 #include "THaApparatus.h"
 #include "TMath.h"
@@ -90,9 +91,15 @@ TSBSGEMChamber::ReadGeometry (FILE* file, const TDatime& date,
       {"depth",       &depth,        kDouble, 0, 1},
       {0}
     };
-  err = LoadDB (file, date, request, fPrefix);
-  if (err)
-    return err;
+  TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
+  const string snapkey = string("TSBSGEMChamber:") + fPrefix;
+  if (!snap->Restore (snapkey, request, file))
+    {
+      err = LoadDB (file, date, request, fPrefix);
+      if (err)
+	return err;
+      snap->Store (snapkey, request, file, fPrefix);
+    }
   
   // Database specifies angles in degrees, convert to radians
   Double_t torad = atan(1) / 45.0;
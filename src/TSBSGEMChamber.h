@@ -81,6 +81,21 @@ class TSBSGEMChamber : public THaDetector {
   };  // input and output in mm
 
   
+  // Batch frame conversions: n points, given as arrays of coordinates,
+  // transformed in place. The arrays must not overlap (see TSBSBox)
+  void LabToPlane (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+    fBox->LabToBox (x, y, z, n);
+  };  // input and output in mm
+  void PlaneToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+    fBox->BoxToLab (x, y, z, n);
+  };  // input and output in mm
+  void LabToSpec (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+    fBox->LabToSpec (x, y, z, n);
+  };  // input and output in mm
+  void SpecToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+    fBox->SpecToLab (x, y, z, n);
+  };  // input and output in mm
+  
   //Frame conversions with TVector3 objects as inputs
   void HallCenterToPlane (TVector3& X_) const;  // input and output in mm
   void HallCenterToSpec (TVector3& X_) const;  // input and output in mm
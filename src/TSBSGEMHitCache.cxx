@@ -0,0 +1,416 @@
+#include "TSBSGEMHitCache.h"
+#include "TSBSGeant4File.h"
+#include "TSBSGEMSimHitData.h"
+#include "TSBSDBManager.h"
+
+#include <TSystem.h>
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// File layout (version 3):
+//   Header_t
+//   columns, each one starting at an 8-byte boundary, at the offsets
+//   given in the header.
+// All numbers are in the native byte order of the machine that wrote the file.
+
+namespace {
+  const char kMagic[8] = { 'S','B','S','G','E','M','H','C' };
+
+  struct Header_t {
+    char     fMagic[8];
+    UInt_t   fVersion;
+    Int_t    fDetType;    // g4sbs detector type of the production
+    Int_t    fDoCalo;     // calorimeter hits stored
+    Long64_t fNEvents;
+    Long64_t fNHits;
+    Long64_t fNGen;
+    Long64_t fNCalo;
+    Long64_t fFileSize;
+    Long64_t fColOffset[TSBSGEMHitCache::kNColumns];
+  };
+
+  // What each column is counted in
+  enum ECount { kPerEvent, kPerEventPlus1, kPerHit, kPerGen, kPerCalo };
+
+  struct ColInfo_t {
+    UInt_t fElemSize;  // size of one element, all components included
+    ECount fCount;
+  };
+
+  const ColInfo_t kColInfo[TSBSGEMHitCache::kNColumns] = {
+    { sizeof(Long64_t), kPerEvent },       // kEvEntry
+    { sizeof(Long64_t), kPerEventPlus1 },  // kEvHitBegin
+    { sizeof(Long64_t), kPerEventPlus1 },  // kEvGenBegin
+    { sizeof(Long64_t), kPerEventPlus1 },  // kEvCaloBegin
+    { sizeof(Short_t),  kPerHit },         // kDetID
+    { sizeof(Short_t),  kPerHit },         // kDataSize
+    { sizeof(Short_t),  kPerHit },         // kPlane
+    { sizeof(Short_t),  kPerHit },         // kModule
+    { sizeof(Int_t),    kPerHit },         // kType
+    { sizeof(Int_t),    kPerHit },         // kTRID
+    { sizeof(Int_t),    kPerHit },         // kPID
+    { sizeof(Double_t), kPerHit },         // kEdep
+    { sizeof(Double_t), kPerHit },         // kTmin
+    { sizeof(Double_t), kPerHit },         // kTmax
+    { sizeof(Double_t), kPerHit },         // kSector
+    { 3*sizeof(Double_t), kPerHit },       // kXi
+    { 3*sizeof(Double_t), kPerHit },       // kXo
+    { 3*sizeof(Double_t), kPerHit },       // kXr
+    { 3*sizeof(Double_t), kPerHit },       // kMom
+    { 3*sizeof(Double_t), kPerHit },       // kVert
+    { sizeof(Long64_t), kPerGen },         // kGenFill
+    { TSBSGEMHitCache::kGenSize*sizeof(Double_t), kPerGen }, // kGen
+    { sizeof(Short_t),  kPerCalo },        // kCaloDet
+    { sizeof(Short_t),  kPerCalo },        // kCaloPlane
+    { 3*sizeof(Double_t), kPerCalo }       // kCalo
+  };
+
+  Long64_t ColumnLength( const Header_t& h, Int_t c )
+  {
+    switch( kColInfo[c].fCount ) {
+    case kPerEvent:      return h.fNEvents;
+    case kPerEventPlus1: return h.fNEvents+1;
+    case kPerHit:        return h.fNHits;
+    case kPerGen:        return h.fNGen;
+    case kPerCalo:       return h.fNCalo;
+    }
+    return 0;
+  }
+
+  template< typename T > inline
+  void Put( ofstream& out, T val )
+  {
+    out.write( reinterpret_cast<const char*>(&val), sizeof(T) );
+  }
+
+  inline void Put3( ofstream& out, Double_t x, Double_t y, Double_t z )
+  {
+    Double_t v[3] = { x, y, z };
+    out.write( reinterpret_cast<const char*>(v), sizeof(v) );
+  }
+}
+
+//_____________________________________________________________________________
+TSBSGEMHitCache::TSBSGEMHitCache() : fFd(-1), fBase(0), fSize(0)
+{
+  memset( fCol, 0, sizeof(fCol) );
+}
+
+//_____________________________________________________________________________
+TSBSGEMHitCache::~TSBSGEMHitCache()
+{
+  Close();
+}
+
+//_____________________________________________________________________________
+Long64_t TSBSGEMHitCache::Convert( TSBSGeant4File& in, const char* outfile,
+				   Long64_t nmax )
+{
+  // Read the input event by event and write the GEM hit data, the
+  // generated tracks and the calorimeter hits before smearing,
+  // one temporary file per column. The columns are then concatenated
+  // behind the header.
+  if( !outfile || !*outfile ) return -1;
+
+  TString tmpname[kNColumns];
+  ofstream tmp[kNColumns];
+  for( Int_t c = 0; c < kNColumns; c++ ) {
+    tmpname[c] = Form("%s.col%d.tmp", outfile, c);
+    tmp[c].open( tmpname[c].Data(), ios::binary | ios::trunc );
+    if( !tmp[c].is_open() ) {
+      fprintf(stderr, "%s: cannot open temporary file %s\n",
+	      __PRETTY_FUNCTION__, tmpname[c].Data());
+      for( Int_t k = 0; k <= c; k++ ) {
+	tmp[k].close();
+	gSystem->Unlink( tmpname[k].Data() );
+      }
+      return -1;
+    }
+  }
+
+  Header_t h;
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.fMagic, kMagic, sizeof(kMagic) );
+  h.fVersion = kVersion;
+  h.fDetType = TSBSDBManager::GetInstance()->Getg4sbsDetectorType();
+  h.fDoCalo = TSBSDBManager::GetInstance()->DoCalo();
+
+  Put<Long64_t>( tmp[kEvHitBegin], 0 );
+  Put<Long64_t>( tmp[kEvGenBegin], 0 );
+  Put<Long64_t>( tmp[kEvCaloBegin], 0 );
+
+  while( (nmax < 0 || h.fNEvents < nmax) && in.ReadNextEvent() ) {
+    Put<Long64_t>( tmp[kEvEntry], in.GetEvNum() );
+
+    // GEM hits: all the hit data, so that TSBSGeant4File can rebuild it
+    for( UInt_t i = 0; i < in.GetNData(); i++ ) {
+      const g4sbshitdata* hd = in.GetHitData(i);
+      UInt_t size = hd->GetSize();
+      Put<Short_t>( tmp[kDetID], (Short_t)hd->GetDetID() );
+      Put<Short_t>( tmp[kDataSize], (Short_t)size );
+      Put<Short_t>( tmp[kPlane],  (Short_t)hd->GetData(0) );
+      Put<Short_t>( tmp[kModule], (Short_t)hd->GetData(19) );
+      Put<Int_t>( tmp[kType], (Int_t)hd->GetData(13) );
+      Put<Int_t>( tmp[kTRID], (Int_t)hd->GetData(17) );
+      Put<Int_t>( tmp[kPID],  (Int_t)hd->GetData(18) );
+      Put<Double_t>( tmp[kEdep], hd->GetData(1) );
+      Put<Double_t>( tmp[kTmin], hd->GetData(8) );
+      Put<Double_t>( tmp[kTmax], hd->GetData(12) );
+      Put<Double_t>( tmp[kSector], size > 23 ? hd->GetData(23) : 0 );
+      Put3( tmp[kXi], hd->GetData(5), hd->GetData(6), hd->GetData(7) );
+      Put3( tmp[kXo], hd->GetData(9), hd->GetData(10), hd->GetData(11) );
+      Put3( tmp[kXr], hd->GetData(2), hd->GetData(3), hd->GetData(4) );
+      Put3( tmp[kMom], hd->GetData(20), hd->GetData(21), hd->GetData(22) );
+      Put3( tmp[kVert], hd->GetData(14), hd->GetData(15), hd->GetData(16) );
+      h.fNHits++;
+    }
+    // Generated tracks: only the elements that were set, with their mask
+    for( UInt_t i = 0; i < in.GetNGen(); i++ ) {
+      g4sbsgendata* gd = in.GetGenData(i);
+      Long64_t fill = gd->GetFillBits();
+      Double_t v[kGenSize];
+      for( UInt_t j = 0; j < kGenSize; j++ )
+	v[j] = ( j < gd->GetSize() && (fill & (1LL<<j)) ) ? gd->GetData()[j] : 0;
+      Put<Long64_t>( tmp[kGenFill], fill );
+      tmp[kGen].write( reinterpret_cast<const char*>(v), sizeof(v) );
+      h.fNGen++;
+    }
+    for( UInt_t i = 0; i < in.GetNCaloHits(); i++ ) {
+      const TSBSGeant4File::CaloHit_t& ch = in.GetCaloHit(i);
+      Put<Short_t>( tmp[kCaloDet], (Short_t)ch.fDet );
+      Put<Short_t>( tmp[kCaloPlane], (Short_t)ch.fPlane );
+      Put3( tmp[kCalo], ch.fEdep, ch.fX, ch.fY );
+      h.fNCalo++;
+    }
+    Put<Long64_t>( tmp[kEvHitBegin], h.fNHits );
+    Put<Long64_t>( tmp[kEvGenBegin], h.fNGen );
+    Put<Long64_t>( tmp[kEvCaloBegin], h.fNCalo );
+    h.fNEvents++;
+  }
+
+  Bool_t ok = kTRUE;
+  for( Int_t c = 0; c < kNColumns; c++ ) {
+    ok = ok && tmp[c].good();
+    tmp[c].close();
+  }
+
+  ofstream out( outfile, ios::binary | ios::trunc );
+  if( !ok || !out.is_open() ) {
+    fprintf(stderr, "%s: cannot write cache file %s\n", __PRETTY_FUNCTION__, outfile);
+    ok = kFALSE;
+  }
+  if( ok ) {
+    out.write( reinterpret_cast<const char*>(&h), sizeof(h) );// placeholder
+    const char pad[8] = { 0 };
+    Long64_t pos = sizeof(h);
+    for( Int_t c = 0; c < kNColumns; c++ ) {
+      if( pos % 8 ) {
+	out.write( pad, 8 - pos%8 );
+	pos += 8 - pos%8;
+      }
+      h.fColOffset[c] = pos;
+      Long64_t len = ColumnLength(h, c) * kColInfo[c].fElemSize;
+      if( len > 0 ) {
+	ifstream col( tmpname[c].Data(), ios::binary );
+	out << col.rdbuf();
+      }
+      pos += len;
+    }
+    h.fFileSize = pos;
+    out.seekp(0);
+    out.write( reinterpret_cast<const char*>(&h), sizeof(h) );
+    ok = out.good();
+    out.close();
+    if( !ok )
+      fprintf(stderr, "%s: error writing cache file %s\n", __PRETTY_FUNCTION__, outfile);
+  }
+  for( Int_t c = 0; c < kNColumns; c++ )
+    gSystem->Unlink( tmpname[c].Data() );
+
+  if( !ok ) return -1;
+  cout << "TSBSGEMHitCache: wrote " << h.fNEvents << " events, " << h.fNHits
+       << " GEM hits to " << outfile << " (" << h.fFileSize/1048576. << " MB)" << endl;
+  return h.fNEvents;
+}
+
+//_____________________________________________________________________________
+Int_t TSBSGEMHitCache::Open( const char* filename )
+{
+  // Map the cache file in memory. Return 0 on fail, 1 on success
+  Close();
+  if( !filename || !*filename ) return 0;
+
+  fFd = open( filename, O_RDONLY );
+  if( fFd < 0 ) {
+    fprintf(stderr, "%s: cannot open %s\n", __PRETTY_FUNCTION__, filename);
+    return 0;
+  }
+  struct stat st;
+  if( fstat(fFd, &st) != 0 || st.st_size < (off_t)sizeof(Header_t) ) {
+    fprintf(stderr, "%s: %s is not a GEM hit cache file\n", __PRETTY_FUNCTION__, filename);
+    Close();
+    return 0;
+  }
+  fSize = st.st_size;
+  void* addr = mmap( 0, fSize, PROT_READ, MAP_SHARED, fFd, 0 );
+  if( addr == MAP_FAILED ) {
+    fprintf(stderr, "%s: cannot map %s\n", __PRETTY_FUNCTION__, filename);
+    fSize = 0;
+    Close();
+    return 0;
+  }
+  fBase = static_cast<char*>(addr);
+
+  const Header_t* h = reinterpret_cast<const Header_t*>(fBase);
+  if( memcmp(h->fMagic, kMagic, sizeof(kMagic)) != 0 ) {
+    fprintf(stderr, "%s: %s is not a GEM hit cache file\n", __PRETTY_FUNCTION__, filename);
+    Close();
+    return 0;
+  }
+  if( h->fVersion != kVersion ) {
+    fprintf(stderr, "%s: %s has version %u, expected %u: please regenerate it\n",
+	    __PRETTY_FUNCTION__, filename, h->fVersion, kVersion);
+    Close();
+    return 0;
+  }
+  if( h->fFileSize != (Long64_t)fSize ) {
+    fprintf(stderr, "%s: %s is truncated\n", __PRETTY_FUNCTION__, filename);
+    Close();
+    return 0;
+  }
+  for( Int_t c = 0; c < kNColumns; c++ ) {
+    if( h->fColOffset[c] + ColumnLength(*h, c)*kColInfo[c].fElemSize > h->fFileSize ) {
+      fprintf(stderr, "%s: %s is corrupted\n", __PRETTY_FUNCTION__, filename);
+      Close();
+      return 0;
+    }
+    fCol[c] = fBase + h->fColOffset[c];
+  }
+  madvise( fBase, fSize, MADV_SEQUENTIAL );
+
+  Int_t dettype = TSBSDBManager::GetInstance()->Getg4sbsDetectorType();
+  if( h->fDetType != dettype ) {
+    cout << "TSBSGEMHitCache: warning: " << filename << " was made for detector type "
+	 << h->fDetType << ", current is " << dettype << endl;
+  }
+  if( TSBSDBManager::GetInstance()->DoCalo() && !h->fDoCalo ) {
+    cout << "TSBSGEMHitCache: warning: " << filename << " was made without "
+	 << "calorimeter emulation: no calorimeter clusters" << endl;
+  }
+
+  fFilename = filename;
+  return 1;
+}
+
+//_____________________________________________________________________________
+Int_t TSBSGEMHitCache::Close()
+{
+  // Return 0 on fail, 1 on success
+  Int_t ret = 1;
+  if( fBase ) {
+    if( munmap(fBase, fSize) != 0 ) ret = 0;
+  }
+  if( fFd >= 0 ) close( fFd );
+  fFd = -1;
+  fBase = 0;
+  fSize = 0;
+  memset( fCol, 0, sizeof(fCol) );
+  fFilename = "";
+  return ret;
+}
+
+//_____________________________________________________________________________
+Int_t TSBSGEMHitCache::GetDetectorType() const
+{
+  return fBase ? reinterpret_cast<const Header_t*>(fBase)->fDetType : -1;
+}
+
+//_____________________________________________________________________________
+Long64_t TSBSGEMHitCache::GetNEvents() const
+{
+  return fBase ? reinterpret_cast<const Header_t*>(fBase)->fNEvents : 0;
+}
+
+//_____________________________________________________________________________
+void TSBSGEMHitCache::GetGEMData( Long64_t ev, TSBSGEMSimHitData* gd ) const
+{
+  // Pack the GEM hits of event ev into TSBSGEMSimHitData,
+  // as TSBSGeant4File::GetGEMData does.
+  // Source and event number are left to the caller.
+  if( !gd ) return;
+  gd->ClearEvent();
+  if( !fBase || ev < 0 || ev >= GetNEvents() ) return;
+
+  UInt_t nh = GetNHits(ev);
+  if( nh == 0 ) return;
+  gd->InitEvent(nh);
+
+  TSBSDBManager* manager = TSBSDBManager::GetInstance();
+  Long64_t k0 = GetHitBegin(ev);
+  const Short_t*  plane  = Col<Short_t>(kPlane) + k0;
+  const Short_t*  module = Col<Short_t>(kModule) + k0;
+  const Int_t*    type   = Col<Int_t>(kType) + k0;
+  const Int_t*    trid   = Col<Int_t>(kTRID) + k0;
+  const Int_t*    pid    = Col<Int_t>(kPID) + k0;
+  const Double_t* edep   = Col<Double_t>(kEdep) + k0;
+  const Double_t* tmin   = Col<Double_t>(kTmin) + k0;
+  const Double_t* tmax   = Col<Double_t>(kTmax) + k0;
+  const Double_t* xi     = Col<Double_t>(kXi) + 3*k0;
+  const Double_t* xo     = Col<Double_t>(kXo) + 3*k0;
+  const Double_t* xr     = Col<Double_t>(kXr) + 3*k0;
+  const Double_t* mom    = Col<Double_t>(kMom) + 3*k0;
+  const Double_t* vert   = Col<Double_t>(kVert) + 3*k0;
+
+  UInt_t n = 0;
+  for( UInt_t i = 0; i < nh; i++ ) {
+    if( edep[i] <= 0.0 ) continue;
+    gd->SetMomentum(n, TVector3(mom+3*i));
+    gd->SetHitEntrance(n, TVector3(xi+3*i));
+    gd->SetHitExit(n, TVector3(xo+3*i));
+    gd->SetHitTime(n, (tmin[i]+tmax[i])/2.0);
+    gd->SetVertex(n, TVector3(vert+3*i));
+    gd->SetHitReadout(n, TVector3(xr+3*i));
+    gd->SetHitEnergy(n, edep[i]*1e6);// eV
+    gd->SetParticleType(n, type[i]);
+    gd->SetTrackID(n, trid[i]);
+    gd->SetParticleID(n, pid[i]);
+    gd->SetHitChamber(n, manager->GetGEMID(plane[i], module[i]));
+    gd->SetHitPlane(n, plane[i]);
+    gd->SetHitModule(n, module[i]);
+    n++;
+  }
+  gd->SetNHit(n);
+}
+
+//_____________________________________________________________________________
+Double_t TSBSGEMHitCache::GetHitData( Long64_t k, UInt_t i ) const
+{
+  // Data word i of GEM hit k, with the layout of g4sbshitdata
+  // (see TSBSGeant4File.h)
+  switch( i ) {
+  case 0:  return Col<Short_t>(kPlane)[k];
+  case 1:  return Col<Double_t>(kEdep)[k];
+  case 2: case 3: case 4:    return Col<Double_t>(kXr)[3*k+i-2];
+  case 5: case 6: case 7:    return Col<Double_t>(kXi)[3*k+i-5];
+  case 8:  return Col<Double_t>(kTmin)[k];
+  case 9: case 10: case 11:  return Col<Double_t>(kXo)[3*k+i-9];
+  case 12: return Col<Double_t>(kTmax)[k];
+  case 13: return Col<Int_t>(kType)[k];
+  case 14: case 15: case 16: return Col<Double_t>(kVert)[3*k+i-14];
+  case 17: return Col<Int_t>(kTRID)[k];
+  case 18: return Col<Int_t>(kPID)[k];
+  case 19: return Col<Short_t>(kModule)[k];
+  case 20: case 21: case 22: return Col<Double_t>(kMom)[3*k+i-20];
+  case 23: return Col<Double_t>(kSector)[k];
+  }
+  return 0;
+}
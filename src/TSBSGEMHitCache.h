@@ -0,0 +1,130 @@
+#ifndef __TSBSGEMHITCACHE_H
+#define __TSBSGEMHITCACHE_H
+
+#include <Rtypes.h>
+#include <TString.h>
+
+class TSBSGeant4File;
+class TSBSGEMSimHitData;
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSGEMHitCache
+//
+// Compact binary cache of the g4sbs quantities actually used by
+// TSBSGeant4File: GEM hits (all the hit data of TSBSGeant4File), generated
+// tracks and calorimeter/scintillator hits.
+//
+// Convert() reads a g4sbs production once through TSBSGeant4File and writes
+// the cache. The file is columnar: one contiguous array per quantity,
+// with per-event offsets into the hit, track and cluster arrays.
+// The reader maps the file in memory, so that the columns can be used
+// in place (zero copy) and no ROOT I/O is needed on later passes.
+//
+// The calorimeter hits are stored before the energy smearing: the
+// smearing and the cluster emulations of TSBSGeant4File run again on each
+// read, with fresh random numbers, as for the g4sbs input. They are only
+// stored if the calorimeter emulation is enabled (TSBSDBManager::DoCalo)
+// when converting.
+//
+// The file is versioned: the reader refuses files with a different version.
+// The GEM chamber ID is not stored, but evaluated with TSBSDBManager
+// when the hit data is unpacked, so the cache does not depend
+// on the GEM geometry database.
+//
+// TSBSGeant4File reads this format transparently if the file name
+// ends with ".g4c". Files added with TSBSGeant4File::AddFile are not
+// covered by the cache: convert them together instead.
+
+class TSBSGEMHitCache {
+ public:
+  // Columns of the cache file
+  enum EColumn {
+    // per event
+    kEvEntry = 0,    // Long64_t: entry in the g4sbs input
+    kEvHitBegin,     // Long64_t[nevents+1]: first GEM hit of the event
+    kEvGenBegin,     // Long64_t[nevents+1]: first generated track of the event
+    kEvCaloBegin,    // Long64_t[nevents+1]: first calorimeter hit of the event
+    // per GEM hit
+    kDetID,          // Short_t: g4sbshitdata detector ID
+    kDataSize,       // Short_t: g4sbshitdata size
+    kPlane,          // Short_t
+    kModule,         // Short_t
+    kType,           // Int_t: 1 primary, >1 secondary
+    kTRID,           // Int_t: G4 track ID
+    kPID,            // Int_t: PDG ID
+    kEdep,           // Double_t: energy deposit (as in g4sbshitdata)
+    kTmin,           // Double_t: entrance time (ns)
+    kTmax,           // Double_t: exit time (ns)
+    kSector,         // Double_t: sector, if kDataSize > 23
+    kXi,             // Double_t[3]: entrance point in drift (mm)
+    kXo,             // Double_t[3]: exit point in drift (mm)
+    kXr,             // Double_t[3]: entrance point in readout (mm)
+    kMom,            // Double_t[3]: momentum (MeV)
+    kVert,           // Double_t[3]: vertex (mm)
+    // per generated track
+    kGenFill,        // Long64_t: elements of kGen set in g4sbsgendata (bit mask)
+    kGen,            // Double_t[kGenSize]: g4sbsgendata array, 0 where not set
+    // per calorimeter hit (TSBSGeant4File::CaloHit_t)
+    kCaloDet,        // Short_t: TSBSGeant4File::ECaloDet
+    kCaloPlane,      // Short_t: CDet plane
+    kCalo,           // Double_t[3]: energy deposit before smearing, X, Y
+    kNColumns
+  };
+
+  static const UInt_t kVersion = 3;
+  static const UInt_t kGenSize = 15;// size of g4sbsgendata array
+
+  TSBSGEMHitCache();
+  virtual ~TSBSGEMHitCache();
+
+  // Read nmax events (all if <0) from the (open) input and write them to outfile.
+  // Return the number of events written, -1 on error.
+  static Long64_t Convert( TSBSGeant4File& in, const char* outfile, Long64_t nmax = -1 );
+
+  // Return 0 on fail, 1 on success
+  Int_t  Open( const char* filename );
+  Int_t  Close();
+  Bool_t IsOpen() const { return fBase != 0; }
+
+  const char* GetFileName() const { return fFilename.Data(); }
+  Int_t    GetDetectorType() const;
+  Long64_t GetNEvents() const;
+
+  // Per-event access
+  Long64_t GetEntry( Long64_t ev ) const { return Col<Long64_t>(kEvEntry)[ev]; }
+  Long64_t GetHitBegin( Long64_t ev ) const { return Col<Long64_t>(kEvHitBegin)[ev]; }
+  UInt_t   GetNHits( Long64_t ev ) const { return Count(kEvHitBegin, ev); }
+  Long64_t GetGenBegin( Long64_t ev ) const { return Col<Long64_t>(kEvGenBegin)[ev]; }
+  UInt_t   GetNGen( Long64_t ev ) const { return Count(kEvGenBegin, ev); }
+  Long64_t GetCaloBegin( Long64_t ev ) const { return Col<Long64_t>(kEvCaloBegin)[ev]; }
+  UInt_t   GetNCalo( Long64_t ev ) const { return Count(kEvCaloBegin, ev); }
+
+  // Direct (zero-copy) access to a column. Index with GetXXXBegin(ev)+i
+  // (times the number of components for the array columns).
+  template< typename T > const T* Col( EColumn c ) const {
+    return reinterpret_cast<const T*>(fCol[c]);
+  }
+
+  // Unpack the GEM hits of event ev with an energy deposit into gd
+  void GetGEMData( Long64_t ev, TSBSGEMSimHitData* gd ) const;
+  // Data word i of GEM hit k, as in g4sbshitdata
+  Double_t GetHitData( Long64_t k, UInt_t i ) const;
+
+ private:
+  UInt_t Count( EColumn c, Long64_t ev ) const {
+    const Long64_t* b = Col<Long64_t>(c);
+    return b[ev+1]-b[ev];
+  }
+
+  TString fFilename;
+  int    fFd;      // file descriptor of the mapped file
+  char*  fBase;    // start of the mapping
+  size_t fSize;    // size of the mapping
+  const char* fCol[kNColumns];
+
+  // Copy and assignment not allowed (the mapping is owned)
+  TSBSGEMHitCache( const TSBSGEMHitCache& );
+  TSBSGEMHitCache& operator=( const TSBSGEMHitCache& );
+};
+
+#endif//__TSBSGEMHITCACHE_H
@@ -3,6 +3,7 @@
 #include "TClonesArray.h"
 
 #include "TSBSGEMChamber.h"
+#include "TSBSDBSnapshot.h"
 #include "TSBSBox.h"
 #include "THaEvData.h"
 #include "TMath.h"
@@ -67,6 +68,7 @@ TSBSGEMPlane::ReadGeometry (FILE* file, const TDatime& date,
   Double_t torad = atan(1) / 45.0;
 
   TSBSGEMChamber* parent = (TSBSGEMChamber*) GetParent();
+  TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
   //Double_t d0;
   Double_t depth;
   if (parent != NULL)
@@ -106,10 +108,15 @@ TSBSGEMPlane::ReadGeometry (FILE* file, const TDatime& date,
 	  {"thetaV",      &thetaV,       kDouble, 0, 1},
 	  {0}
 	};
-      err = LoadDB( file, date, request, fPrefix );
-     
-      if (err)
-	return err;
+      const string snapkey = string("TSBSGEMPlane:geo:") + fPrefix;
+      if( !snap->Restore( snapkey, request, file ) )
+	{
+	  err = LoadDB( file, date, request, fPrefix );
+	  
+	  if (err)
+	    return err;
+	  snap->Store( snapkey, request, file, fPrefix );
+	}
 
       // Database specifies angles in degrees, convert to radians
       //thetaH *= torad;
@@ -133,9 +140,14 @@ TSBSGEMPlane::ReadGeometry (FILE* file, const TDatime& date,
       {"depth",       &depth,        kDouble, 0, 1},
       {0}
     };
-  err = LoadDB( file, date, request, fPrefix );
-  if (err)
-    return err;
+  const string snapkey = string("TSBSGEMPlane:") + fPrefix;
+  if( !snap->Restore( snapkey, request, file ) )
+    {
+      err = LoadDB( file, date, request, fPrefix );
+      if (err)
+	return err;
+      snap->Store( snapkey, request, file, fPrefix );
+    }
 
   fSAngle *= torad;
 
@@ -88,6 +88,25 @@ class TSBSGEMPlane : public THaSubDetector {
 	};  // input and output in meters
 	void StripToLab (Double_t& x, Double_t& y, Double_t& z) const;//done
 
+	// Batch frame conversions: n points, given as arrays of coordinates, 
+	// transformed in place. The arrays must not overlap (see TSBSBox)
+	void PlaneToStrip (Double_t* __restrict x, Double_t* __restrict y, size_t n) const; // input and output in meters
+	void StripToPlane (Double_t* __restrict x, Double_t* __restrict y, size_t n) const; // input and output in meters
+	void LabToPlane (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+	  fBox->LabToBox (x, y, z, n);
+	};
+	void PlaneToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+	  fBox->BoxToLab (x, y, z, n);
+	};
+	void LabToStrip (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+	  LabToPlane (x, y, z, n);
+	  PlaneToStrip (x, y, n);
+	};
+	void StripToLab (Double_t* __restrict x, Double_t* __restrict y, Double_t* __restrict z, size_t n) const {
+	  StripToPlane (x, y, n);
+	  PlaneToLab (x, y, z, n);
+	};
+
 	Double_t StripNumtoStrip( Int_t num );
 
 	Double_t StriptoProj( Double_t s );
@@ -142,4 +161,26 @@ TSBSGEMPlane::PlaneToStrip (Double_t& x, Double_t& y) const
   return;
 }
 
+inline void
+TSBSGEMPlane::PlaneToStrip (Double_t* __restrict x, Double_t* __restrict y, size_t n) const
+{
+  const Double_t c = fCBS, s = fSBS;
+  for (size_t i = 0; i < n; i++) {
+    const Double_t temp = x[i];
+    x[i] = c * temp - s * y[i];
+    y[i] = s * temp + c * y[i];
+  }
+}
+
+inline void
+TSBSGEMPlane::StripToPlane (Double_t* __restrict x, Double_t* __restrict y, size_t n) const
+{
+  const Double_t c = fCBS, s = fSBS;
+  for (size_t i = 0; i < n; i++) {
+    const Double_t temp = x[i];
+    x[i] = c * temp + s * y[i];
+    y[i] = -s * temp + c * y[i];
+  }
+}
+
 #endif//__TSBSGEMPLANE_H
@@ -1,8 +1,12 @@
 #include "TSBSGeant4File.h"
 #include "TSBSDBManager.h"
+#include "TSBSGEMHitCache.h"
 //#include "g4sbs_types.h"
 #include "gemc_types.h"
 #include "fstream"
+#include "TChainElement.h"
+#include "TMath.h"
+#include "TSystem.h"
 
 using namespace std;
 
@@ -13,11 +17,19 @@ using namespace std;
 #define D_FLAG 0 //0: nothing; 1: warning; 2: debug;
 #endif
 
-TSBSGeant4File::TSBSGeant4File() : fFile(0), fTree(0), fSource(0), fEvNum(0), fManager(0) {
-  fFilename[0] = '\0';
+// Default TTreeCache size for the input chain
+static const Long64_t kDefaultCacheSize = 30000000;
+
+TSBSGeant4File::TSBSGeant4File() : fChain(0), fTree(0), fHitCache(0), fCacheSize(kDefaultCacheSize), 
+				   fRateReport(kFALSE), fCurTreeNum(-1), fFileNev(0), 
+				   fFileBytes(0), fFileBytesRead0(0), 
+				   fSource(0), fR(0), fEvNum(-1), fManager(0), fMaxCaloClusters(-1) {
 }
 
-TSBSGeant4File::TSBSGeant4File(const char *f) : fFile(0), fSource(0) {
+TSBSGeant4File::TSBSGeant4File(const char *f) : fChain(0), fTree(0), fHitCache(0), fCacheSize(kDefaultCacheSize), 
+						fRateReport(kFALSE), fCurTreeNum(-1), fFileNev(0), 
+						fFileBytes(0), fFileBytesRead0(0), 
+						fSource(0), fEvNum(-1), fMaxCaloClusters(-1) {
   //TSBSGeant4File::TSBSGeant4File(const char *f) : fFile(0), fSource(0) {
   SetFilename(f);
   fManager = TSBSDBManager::GetInstance();
@@ -92,28 +104,90 @@ void TSBSGeant4File::ReadGasData(const char* filename){
 
 TSBSGeant4File::~TSBSGeant4File() {
   Clear();
-  delete fFile;
+  delete fTree;
+  delete fChain;
+  delete fHitCache;
   delete fR;
 }
 
 void TSBSGeant4File::SetFilename( const char *f ){
   if( !f ) return;
-  strcpy( fFilename, f );
+  fFilename = f;
+}
+
+void TSBSGeant4File::AddFile( const char *f ){
+  if( !f || !*f ) return;
+  fExtraFiles.push_back(f);
+}
+
+Int_t TSBSGeant4File::AddToChain( const char *name ){
+  // Add a file, a wildcard expression, or the content of a list file 
+  // (".list" or ".txt", one entry per line, '#' for comments) to the chain.
+  // Return the number of files added.
+  TString fname(name);
+  fname = fname.Strip(TString::kBoth);
+  if( fname.IsNull() ) return 0;
+  
+  if( !fname.EndsWith(".list") && !fname.EndsWith(".txt") )
+    return fChain->Add(fname);// TChain::Add expands the wildcards itself
+  
+  ifstream in(fname.Data());
+  if( !in.is_open() ){
+    fprintf(stderr, "%s: cannot open file list %s\n", __PRETTY_FUNCTION__, fname.Data());
+    return 0;
+  }
+  Int_t nfiles = 0;
+  string line;
+  while( getline(in, line) ){
+    TString entry(line.c_str());
+    Ssiz_t pos = entry.First('#');
+    if( pos != kNPOS ) entry.Remove(pos);
+    entry = entry.Strip(TString::kBoth);
+    if( entry.IsNull() ) continue;
+    nfiles += fChain->Add(entry);
+  }
+  return nfiles;
 }
 
 Int_t TSBSGeant4File::Open(){
     // Return 0 on fail, 1 on success
-    if( fFilename[0] == '\0' ){ return 0; }
-
-    delete fFile;
-    fFile = new TFile(fFilename);
+    if( fFilename.IsNull() && fExtraFiles.empty() ){ return 0; }
+    
+    delete fTree; fTree = 0;
+    delete fChain; fChain = 0;
+    fEventIndex.clear();
+    
+    if( fFilename.EndsWith(".g4c") ){
+      // Pre-converted hit cache, see TSBSGEMHitCache
+      if( !fExtraFiles.empty() ){
+	fprintf(stderr, "%s: files added with AddFile are not read with the "
+		"hit cache %s. Convert them into the cache.\n",
+		__PRETTY_FUNCTION__, fFilename.Data());
+	return 0;
+      }
+      if( !fHitCache ) fHitCache = new TSBSGEMHitCache;
+      if( !fHitCache->Open(fFilename) ) return 0;
+      fEvNum = -1;
+      return 1;
+    }
+    delete fHitCache; fHitCache = 0;
+    
+    fChain = new TChain("T");
+    
+    Int_t nfiles = AddToChain(fFilename);
+    for( size_t i = 0; i < fExtraFiles.size(); i++ )
+      nfiles += AddToChain(fExtraFiles[i]);
     
-    if( !fFile->IsOpen() ){ 
+    // Also checks that the first file actually opens and contains the tree
+    if( nfiles == 0 || fChain->LoadTree(0) < 0 ){ 
       fprintf(stderr, "%s: File could not be made\n",__PRETTY_FUNCTION__);
+      delete fChain; fChain = 0;
       return 0; 
     }
     
-    TChain* C1 = (TChain*)fFile->Get("T");//Get the tree from the file
+#if D_FLAG>1 
+    cout << "Chained " << nfiles << " file(s) for " << fFilename << endl;
+#endif
     
 #if D_FLAG>1 
     cout << "Detector option " << fManager->Getg4sbsDetectorType() << endl;
@@ -130,13 +204,31 @@ Int_t TSBSGeant4File::Open(){
       return 0;
     }
     
-    fTree = new g4sbs_tree(C1, fManager->Getg4sbsDetectorType());
+    fTree = new g4sbs_tree(fChain, fManager->Getg4sbsDetectorType());
     
     // g4sbs_tree declare all variables, branches, etc... 
     // to read, event by event, the varaibles stored in the tree. 
     // See comments in g4sbs_tree for more details...
     
+    // Only the branches g4sbs_tree connected to a variable are needed:
+    // disable all others, and restrict the TTreeCache to the connected ones.
+    // The branch status and cache branch list are kept by the chain 
+    // when it moves on to the next file.
+    fUsedBranches.clear();
+    TIter next(fChain->GetStatus());
+    while( TChainElement* el = static_cast<TChainElement*>(next()) ){
+      if( el->GetBaddress() ) fUsedBranches.push_back(el->GetName());
+    }
+    fChain->SetBranchStatus("*", 0);
+    for( size_t i = 0; i < fUsedBranches.size(); i++ ){
+      UInt_t found = 0;
+      fChain->SetBranchStatus(fUsedBranches[i], 1, &found);
+    }
+    SetupCache();
+    
+    fEventIndex.clear();
     fEvNum = -1;
+    fCurTreeNum = -1;
  
     return 1;
 }
@@ -145,23 +237,270 @@ Int_t TSBSGeant4File::Close(){
     // Return 0 on fail, 1 on success
     Int_t ret = 1;
     
-    if( !fFile->IsOpen() ){ return 0; }
+    if( fHitCache ){
+      Clear();
+      return fHitCache->Close();
+    }
+    if( !fChain ){ return 0; }
+    
+    ReportFileRate();
+    fCurTreeNum = -1;
     
     Clear();
-    fFile->Close();
     
-    delete fTree; 
-    delete fFile; fFile = 0;
+    delete fTree; fTree = 0;
+    delete fChain; fChain = 0;
     return ret;
 }
 
+Long64_t TSBSGeant4File::GetEntries(){
+  if( fHitCache ) return fHitCache->GetNEvents();
+  return fChain ? fChain->GetEntries() : 0;
+}
+
+void TSBSGeant4File::SetupCache(){
+  // TTreeCache on the connected branches only, no learning phase
+  if( fCacheSize <= 0 ) return;
+  fChain->SetCacheSize(fCacheSize);
+  for( size_t i = 0; i < fUsedBranches.size(); i++ )
+    fChain->AddBranchToCache(fUsedBranches[i], kTRUE);
+  fChain->StopCacheLearningPhase();
+}
+
+void TSBSGeant4File::ReportFileRate(){
+  // Print the read statistics of the chain file that has just been completed
+  if( !fRateReport || fCurTreeNum < 0 || !fChain ) return;
+  
+  fFileTimer.Stop();
+  Double_t rt = fFileTimer.RealTime();
+  Double_t mb_read = (TFile::GetFileBytesRead()-fFileBytesRead0)/1048576.;
+  Double_t mb_unzip = fFileBytes/1048576.;
+  
+  TObject* el = fChain->GetListOfFiles()->At(fCurTreeNum);
+  cout << "TSBSGeant4File: " << (el ? el->GetTitle() : "?") << ": " 
+       << fFileNev << " events, " << mb_read << " MB read (" 
+       << mb_unzip << " MB unzipped) in " << rt << " s";
+  if( rt > 0 )
+    cout << ": " << fFileNev/rt << " evt/s, " << mb_read/rt << " MB/s";
+  cout << endl;
+}
+
+
+TBranch* TSBSGeant4File::GetGEMHitCountBranch() const {
+  // Branch holding the number of GEM hits per event for the selected detector 
+  // (updated by the chain on file change)
+  if( !fTree ) return 0;
+  switch(fManager->Getg4sbsDetectorType()){
+  case(1): return fTree->b_Earm_BBGEM_hit_nhits;
+  case(2): return fTree->b_Harm_SBSGEM_hit_nhits;
+  case(3): return fTree->b_Harm_FT_hit_nhits;
+  case(4): return fTree->b_Harm_FPP1_hit_nhits;
+  case(5): return fTree->b_Harm_FPP2_hit_nhits;
+  default: return 0;
+  }
+}
+
+const Int_t& TSBSGeant4File::GetGEMHitCount() const {
+  switch(fManager->Getg4sbsDetectorType()){
+  case(2): return fTree->Harm_SBSGEM_hit_nhits;
+  case(3): return fTree->Harm_FT_hit_nhits;
+  case(4): return fTree->Harm_FPP1_hit_nhits;
+  case(5): return fTree->Harm_FPP2_hit_nhits;
+  default: return fTree->Earm_BBGEM_hit_nhits;
+  }
+}
 
+TString TSBSGeant4File::GetInputSignature() const {
+  // Identity of the chained input files: name, size and modification time
+  // of each one, in chain order
+  TString sig;
+  if( !fChain ) return sig;
+  TIter next(fChain->GetListOfFiles());
+  while( TObject* el = next() ){
+    Long_t id = 0, flags = 0, modtime = 0;
+    Long64_t size = -1;
+    if( gSystem->GetPathInfo(el->GetTitle(), &id, &size, &flags, &modtime) != 0 ){
+      size = -1; modtime = 0;// e.g. remote file: name only
+    }
+    sig += Form("%s %lld %ld\n", el->GetTitle(), size, modtime);
+  }
+  return sig;
+}
+
+// Side index file layout: 
+// header: "G4SBSIDX" (8 bytes), version (Int_t), number of entries (Long64_t),
+// length of the input signature (Int_t) and the signature itself
+// (see GetInputSignature), then one EventIndex_t per entry
+static const char  kIndexMagic[9] = "G4SBSIDX";
+static const Int_t kIndexVersion = 2;
+
+Long64_t TSBSGeant4File::BuildEventIndex( const char* indexfile ){
+  // Build the per-event index of GEM hit counts and basket offsets. 
+  // Only the GEM hit count branch is read, bypassing the TTreeCache.
+  // If indexfile is given, the index is read from it if it exists and 
+  // matches the chain, otherwise it is built and written to it.
+  // Return the number of indexed entries, -1 on error.
+  if( fHitCache ){
+    // the cache has the hit counts already
+    Long64_t n = fHitCache->GetNEvents();
+    fEventIndex.resize(n);
+    for( Long64_t i = 0; i < n; i++ ){
+      fEventIndex[i].fNHits = fHitCache->GetNHits(i);
+      fEventIndex[i].fTreeNum = 0;
+      fEventIndex[i].fSeek = -1;
+    }
+    return n;
+  }
+  if( !fChain || !fTree ){
+    fprintf(stderr, "%s %s line %d Channel not open\n",
+	    __FILE__,__PRETTY_FUNCTION__,__LINE__ );
+    return -1;
+  }
+  fEventIndex.clear();
+  Long64_t nentries = fChain->GetEntries();
+  TString signature = GetInputSignature();
+  
+  if( indexfile && *indexfile ){
+    ifstream in(indexfile, ios::binary);
+    if( in.is_open() ){
+      char magic[8];
+      Int_t version = 0, siglen = -1;
+      Long64_t n = -1;
+      in.read(magic, 8);
+      in.read(reinterpret_cast<char*>(&version), sizeof(version));
+      in.read(reinterpret_cast<char*>(&n), sizeof(n));
+      in.read(reinterpret_cast<char*>(&siglen), sizeof(siglen));
+      if( in.good() && !strncmp(magic, kIndexMagic, 8) && 
+	  version == kIndexVersion && n == nentries && 
+	  siglen == signature.Length() ){
+	string sig(siglen, '\0');
+	if( siglen > 0 ) in.read(&sig[0], siglen);
+	if( in.good() && sig == signature.Data() ){
+	  fEventIndex.resize(n);
+	  if( n > 0 )
+	    in.read(reinterpret_cast<char*>(&fEventIndex[0]), n*sizeof(EventIndex_t));
+	  if( in.good() ) return n;
+	}
+      }
+      cout << "TSBSGeant4File: index file " << indexfile 
+	   << " does not match input, rebuilding it" << endl;
+      fEventIndex.clear();
+    }
+  }
+  
+  TBranch* br = 0;
+  const Int_t& nhits = GetGEMHitCount();
+  fChain->SetCacheSize(0);
+  fEventIndex.resize(nentries);
+  for( Long64_t i = 0; i < nentries; i++ ){
+    Long64_t local = fTree->LoadTree(i);
+    br = GetGEMHitCountBranch();
+    if( local < 0 || !br || br->GetEntry(local) <= 0 ){
+      fprintf(stderr, "%s: cannot read GEM hit count of entry %lld\n", 
+	      __PRETTY_FUNCTION__, i);
+      fEventIndex.clear();
+      fTree->LoadTree(0);
+      SetupCache();
+      return -1;
+    }
+    EventIndex_t& idx = fEventIndex[i];
+    idx.fNHits = nhits;
+    idx.fTreeNum = fChain->GetTreeNumber();
+    Int_t ibasket = TMath::BinarySearch(br->GetWriteBasket()+1, br->GetBasketEntry(), local);
+    idx.fSeek = (ibasket >= 0) ? br->GetBasketSeek(ibasket) : -1;
+  }
+  // back to the first file, where sequential reading starts
+  fTree->LoadTree(0);
+  SetupCache();
+  
+  if( indexfile && *indexfile ){
+    ofstream out(indexfile, ios::binary);
+    out.write(kIndexMagic, 8);
+    out.write(reinterpret_cast<const char*>(&kIndexVersion), sizeof(kIndexVersion));
+    out.write(reinterpret_cast<const char*>(&nentries), sizeof(nentries));
+    Int_t siglen = signature.Length();
+    out.write(reinterpret_cast<const char*>(&siglen), sizeof(siglen));
+    out.write(signature.Data(), siglen);
+    if( nentries > 0 )
+      out.write(reinterpret_cast<const char*>(&fEventIndex[0]), nentries*sizeof(EventIndex_t));
+    if( !out.good() )
+      fprintf(stderr, "%s: cannot write index file %s\n", __PRETTY_FUNCTION__, indexfile);
+  }
+  return nentries;
+}
+
+Long64_t TSBSGeant4File::FindEvent( Long64_t start, Int_t nmin, Int_t nmax ) const {
+  // First entry >= start with a number of GEM hits in [nmin, nmax], -1 if none. 
+  // Requires the event index.
+  if( start < 0 ) start = 0;
+  for( Long64_t i = start; i < (Long64_t)fEventIndex.size(); i++ ){
+    if( fEventIndex[i].fNHits >= nmin && fEventIndex[i].fNHits <= nmax )
+      return i;
+  }
+  return -1;
+}
 
 Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
   // Return 1 on success
+  return ReadEvent(fEvNum+1, d_flag);
+}
+
+Int_t TSBSGeant4File::ReadCacheEvent(Long64_t entry){
+  // Read the given event of the hit cache: GEM hit data, generated tracks 
+  // and calorimeter hits. The calorimeter hits are smeared and clustered 
+  // here, as for the g4sbs input. (GetGEMData unpacks the GEM hits 
+  // directly from the cache.)
+  // Return 1 on success
+  Clear();
+  fEvNum = entry;
+  if( entry < 0 || entry >= fHitCache->GetNEvents() ) return 0;
+  
+  Long64_t k0 = fHitCache->GetHitBegin(entry);
+  const Short_t* detid = fHitCache->Col<Short_t>(TSBSGEMHitCache::kDetID) + k0;
+  const Short_t* size = fHitCache->Col<Short_t>(TSBSGEMHitCache::kDataSize) + k0;
+  for( UInt_t i = 0; i < fHitCache->GetNHits(entry); i++ ){
+    g4sbshitdata* hd = new g4sbshitdata(detid[i], size[i]);
+    for( Int_t j = 0; j < size[i]; j++ )
+      hd->SetData(j, fHitCache->GetHitData(k0+i, j));
+    fg4sbsHitData.push_back(hd);
+  }
+  
+  // Generated tracks: set only the elements that were set in the input
+  const Long64_t* genfill = fHitCache->Col<Long64_t>(TSBSGEMHitCache::kGenFill)
+    + fHitCache->GetGenBegin(entry);
+  const Double_t* gen = fHitCache->Col<Double_t>(TSBSGEMHitCache::kGen) 
+    + TSBSGEMHitCache::kGenSize*fHitCache->GetGenBegin(entry);
+  for( UInt_t i = 0; i < fHitCache->GetNGen(entry); i++ ){
+    g4sbsgendata* gd = new g4sbsgendata();
+    for( UInt_t j = 0; j < TSBSGEMHitCache::kGenSize; j++ )
+      if( genfill[i] & (1LL<<j) )
+	gd->SetData(j, gen[TSBSGEMHitCache::kGenSize*i+j]);
+    fg4sbsGenData.push_back(gd);
+  }
+  
+  if( !fManager->DoCalo() ) return 1;
+  k0 = fHitCache->GetCaloBegin(entry);
+  const Short_t* cdet = fHitCache->Col<Short_t>(TSBSGEMHitCache::kCaloDet) + k0;
+  const Short_t* cplane = fHitCache->Col<Short_t>(TSBSGEMHitCache::kCaloPlane) + k0;
+  const Double_t* calo = fHitCache->Col<Double_t>(TSBSGEMHitCache::kCalo) + 3*k0;
+  for( UInt_t i = 0; i < fHitCache->GetNCalo(entry); i++ ){
+    const Double_t* v = calo + 3*i;
+    AddCaloHit(cdet[i], cplane[i], v[0], v[1], v[2]);
+  }
+  switch(fManager->Getg4sbsDetectorType()){
+  case(1): GetBBECalCluster(); break;
+  case(3): GetGEpECalCluster(); break;
+  case(5): GetHCalCluster(); break;
+  }
+  return 1;
+}
+
+Int_t TSBSGeant4File::ReadEvent(Long64_t entry, int d_flag){
+  // Read the given entry of the chain. Return 1 on success
+  if( fHitCache ) return ReadCacheEvent(entry);
   
   // Channel not open
-  if( !fFile->IsOpen() ){ 
+  if( !fChain || !fTree ){ 
     fprintf(stderr, "%s %s line %d Channel not open\n",
 	    __FILE__,__PRETTY_FUNCTION__,__LINE__ );
     return 0; 
@@ -174,11 +513,26 @@ Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
   // bool newtrk, dupli;// These variables help avoid store many times the same MC track info
   bool res = false;
   
-  fEvNum++;
+  fEvNum = entry;
 
   //cout << "Read Next Event: Evt " << fEvNum << endl;
   
-  res = fTree->GetEntry(fEvNum);
+  if( fTree->LoadTree(fEvNum) >= 0 && fChain->GetTreeNumber() != fCurTreeNum ){
+    // moving on to the next file of the chain
+    ReportFileRate();
+    fCurTreeNum = fChain->GetTreeNumber();
+    fFileNev = 0;
+    fFileBytes = 0;
+    fFileBytesRead0 = TFile::GetFileBytesRead();
+    fFileTimer.Start(kTRUE);
+  }
+  
+  Int_t nbytes = fTree->GetEntry(fEvNum);
+  res = ( nbytes > 0 );
+  if( res ){
+    fFileNev++;
+    fFileBytes += nbytes;
+  }
   //Test that the next entry exist
   if( !res ){
     // Don't need to print this out.  Not really an error
@@ -449,8 +803,10 @@ Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
       n_gen++;
     }
     
-    if(fManager->DoCalo())
+    if(fManager->DoCalo()){
+      LoadCaloHits();
       GetBBECalCluster();
+    }
     
       
     /*
@@ -962,6 +1318,7 @@ Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
     */
     
     if(fManager->DoCalo()){
+      LoadCaloHits();
       GetGEpECalCluster();
       //GetHCalCluster();
     }
@@ -1353,6 +1710,7 @@ Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
     }
     
     if(fManager->DoCalo()){
+      LoadCaloHits();
       GetHCalCluster();
       //GetGEpECalCluster();   
     }
@@ -1385,121 +1743,100 @@ Int_t TSBSGeant4File::ReadNextEvent(int d_flag){
   return 1;
 }
 
+void TSBSGeant4File::AddCaloHit( Int_t det, Int_t plane, Double_t edep, Double_t x, Double_t y ){
+  CaloHit_t h;
+  h.fDet = det;
+  h.fPlane = plane;
+  h.fEdep = edep;
+  h.fX = x;
+  h.fY = y;
+  fCaloHits.push_back(h);
+}
+
+void TSBSGeant4File::LoadCaloHits(){
+  // Calorimeter hits of the current tree entry, in the order in which 
+  // the cluster emulations smear them
+  fCaloHits.clear();
+  switch(fManager->Getg4sbsDetectorType()){
+  case(1):
+    // X coordinates (in calorimeter) are not relevant for PS.
+    for(Int_t i = 0; i<fTree->Earm_BBPSTF1_hit_nhits; i++)
+      AddCaloHit(kBBPS, 0, fTree->Earm_BBPSTF1_hit_sumedep->at(i),
+		 0, fTree->Earm_BBPSTF1_hit_ycell->at(i));
+    for(Int_t i = 0; i<fTree->Earm_BBSHTF1_hit_nhits; i++)
+      AddCaloHit(kBBSH, 0, fTree->Earm_BBSHTF1_hit_sumedep->at(i),
+		 fTree->Earm_BBSHTF1_hit_xcell->at(i), fTree->Earm_BBSHTF1_hit_ycell->at(i));
+    break;
+  case(3):
+    for(int i = 0; i<fTree->Earm_ECalTF1_hit_nhits; i++)
+      AddCaloHit(kGEpECal, 0, fTree->Earm_ECalTF1_hit_sumedep->at(i),
+		 fTree->Earm_ECalTF1_hit_xcell->at(i), fTree->Earm_ECalTF1_hit_ycell->at(i));
+    for(int i = 0; i<fTree->Earm_CDET_Scint_hit_nhits; i++){
+      double x_pos = fTree->Earm_CDET_Scint_hit_xcell->at(i)+0.255*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1);
+      //+fR->Gaus(fTree->Earm_CDET_Scint_hit_xhit->at(i)*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1), 0.0);
+      //because the modules with col==1 are rotated by pi along y axis
+      double y_pos = fTree->Earm_CDET_Scint_hit_ycell->at(i);
+      AddCaloHit(kGEpCDet, fTree->Earm_CDET_Scint_hit_plane->at(i), 
+		 fTree->Earm_CDET_Scint_hit_sumedep->at(i), x_pos, y_pos);
+    }
+    break;
+  case(5):
+    for(int i = 0; i<fTree->Harm_HCalScint_hit_nhits; i++)
+      AddCaloHit(kHCal, 0, fTree->Harm_HCalScint_hit_sumedep->at(i),
+		 fTree->Harm_HCalScint_hit_xcell->at(i), fTree->Harm_HCalScint_hit_ycell->at(i));
+    break;
+  }
+}
+
 void TSBSGeant4File::GetBBECalCluster(){
-  const double Npe_Edep_PS = 1.550e3;
-  const double sigma_Npe_Edep_PS = 1.58e2;
-  const double Npe_Edep_SH = 2.335e3;
-  const double sigma_Npe_Edep_SH = 1.47e2;
   const int clustercrown_size = 2;
-  const double BBECalBlock_size = 0.085;
+  const double BBECalBlock_size = TSBSBBSHGeo::BlockSize();
   
-  double edep_cal = 0;
-  double npe = 0;
-
   double E_rec = 0;
   double X_rec = 0;
   double Y_rec = 0;
   double E_rec_SH = 0;
+  double E_PS = 0, EX_PS = 0, EY_PS = 0;
+  double EX_SH = 0, EY_SH = 0;
   
-  //Variables for BBPS/SH
-  double Edep_PS = 0;
-  double Edep_SH = 0;
-  
-  double Edep_PS_max = 0;
-  double Edep_SH_max = 0;
-  double EdepXmax = 0;
-  double EdepYmax = 0;
-  
-  std::vector<double> bbps_edep;
-  //std::vector<double> bbps_xcell;
-  std::vector<double> bbps_ycell;
-  std::vector<double> bbsh_edep;
-  std::vector<double> bbsh_xcell;
-  std::vector<double> bbsh_ycell;
-
   // ---------------------------------
   // Add calorimeter clustering here.
   // ---------------------------------
-  bbps_edep.clear();
-  bbps_ycell.clear();
-  bbsh_edep.clear();
-  bbsh_xcell.clear();
-  bbsh_ycell.clear();
+  // evaluate energy deposits including smearing from the photoelectron yield
+  // (see TSBSBBPSGeo and TSBSBBSHGeo)
   //first, loop on PS hits
-  for(Int_t i = 0; i<fTree->Earm_BBPSTF1_hit_nhits; i++){
-    // evaluate energy deposit including smearing from the photoelectron yield:
-    // convert energy deposit in pe yield with Npe_Edep_PS conversion coefficiency, 
-    // and smearing sigma_Npe_Edep_PS. 
-    // Then reconvert into enegry deposit using Npe_Edep_PS
-    edep_cal = fTree->Earm_BBPSTF1_hit_sumedep->at(i);
-    npe = fR->Gaus(Npe_Edep_PS*edep_cal, sigma_Npe_Edep_PS*edep_cal);
-    //Npe_fEdep_PS(R, fTree->Earm_BBPSTF1_hit_sumedep->at(i));
-    edep_cal = npe/Npe_Edep_PS;
-    //Edep_fNpe_PS(npe);
-    Edep_PS+= edep_cal;
-    
-    // if edep is the maximal energy deposit, store it in the "max" variables
-    if(edep_cal>Edep_PS_max){
-      Edep_PS_max = edep_cal;
-      EdepYmax = fTree->Earm_BBPSTF1_hit_ycell->at(i);
-    }
-    
-    // record all smeared energy deposits no matter what, + photon coordinates 
-    bbps_edep.push_back(edep_cal);
-    // X coordinates (in calorimeter) are not relevant for PS.
-    //bbps_xcell.push_back(fTree->Earm_BBPSTF1_hit_xcell->at(i));
-    bbps_ycell.push_back(fTree->Earm_BBPSTF1_hit_ycell->at(i));
+  // X coordinates (in calorimeter) are not relevant for PS.
+  fBBPSClus.Clear();
+  for(size_t i = 0; i<fCaloHits.size(); i++){
+    const CaloHit_t& h = fCaloHits[i];
+    if(h.fDet==kBBPS)fBBPSClus.AddHit(fR, h.fEdep, h.fX, h.fY);
   }
-  
   //then, loop on SH hits
-  // same story as for PS, except we also store X coordinates
-  for(Int_t i = 0; i<fTree->Earm_BBSHTF1_hit_nhits; i++){
-    edep_cal = fTree->Earm_BBSHTF1_hit_sumedep->at(i);
-    npe = fR->Gaus(Npe_Edep_SH*edep_cal, sigma_Npe_Edep_SH*edep_cal);
-    //Npe_fEdep_SH(R, fTree->Earm_BBSHTF1_hit_sumedep->at(i));
-    edep_cal = npe/Npe_Edep_SH;
-    //Edep_fNpe_SH(npe);
-    Edep_SH+= edep_cal;
-    
-    if(edep_cal>Edep_SH_max){
-      Edep_SH_max = edep_cal;
-      EdepXmax = fTree->Earm_BBSHTF1_hit_xcell->at(i);
-      if(Edep_SH_max>Edep_PS_max){
-	EdepYmax = fTree->Earm_BBSHTF1_hit_ycell->at(i);
-      }
-    }
-    
-    bbsh_edep.push_back(edep_cal);
-    bbsh_xcell.push_back(fTree->Earm_BBSHTF1_hit_xcell->at(i));
-    bbsh_ycell.push_back(fTree->Earm_BBSHTF1_hit_ycell->at(i));
+  fBBSHClus.Clear();
+  for(size_t i = 0; i<fCaloHits.size(); i++){
+    const CaloHit_t& h = fCaloHits[i];
+    if(h.fDet==kBBSH)fBBSHClus.AddHit(fR, h.fEdep, h.fX, h.fY);
   }
   
-  // calculate reconstructed energy: 5x5 blocks around the max.
-  for(size_t l = 0; l<bbps_edep.size(); l++){
-    if(fabs(bbps_ycell[l]-EdepYmax)<=BBECalBlock_size*clustercrown_size+1.0e-2){
-      E_rec+= bbps_edep[l];
-      //X_rec+= bbps_edep[l]*(-1)*bbps_ycell[l];
-    }
-  }
+  // Position of the maximum: X from the SH, Y from the detector with the largest deposit
+  int ips = fBBPSClus.GetMax(), ish = fBBSHClus.GetMax();
+  double Edep_PS_max = ips>=0 ? fBBPSClus.GetE(ips) : 0;
+  double EdepXmax = ish>=0 ? fBBSHClus.GetX(ish) : 0;
+  double EdepYmax = ips>=0 ? fBBPSClus.GetY(ips) : 0;
+  if(ish>=0 && fBBSHClus.GetE(ish)>Edep_PS_max)
+    EdepYmax = fBBSHClus.GetY(ish);
   
   // calculate reconstructed energy: 5x5 blocks around the max.
-  for(size_t l = 0; l<bbsh_edep.size(); l++){
-    if(fabs(bbsh_xcell[l]-EdepXmax)<=BBECalBlock_size*clustercrown_size+1.0e-2 &&
-       fabs(bbsh_ycell[l]-EdepYmax)<=BBECalBlock_size*clustercrown_size+1.0e-2){
-      E_rec+= bbsh_edep[l];
-      E_rec_SH+= bbsh_edep[l];
-      //transforming calo coordinates as stored in g4sbs output to transport coordinates.
-      X_rec+= bbsh_edep[l]*(-1)*bbsh_ycell[l];
-      Y_rec+= bbsh_edep[l]*bbsh_xcell[l];
-    }
-  }
+  const double crown = BBECalBlock_size*clustercrown_size+1.0e-2;
+  fBBPSClus.SumBox(0, EdepYmax, -1, crown, E_PS, EX_PS, EY_PS);
+  fBBSHClus.SumBox(EdepXmax, EdepYmax, crown, crown, E_rec_SH, EX_SH, EY_SH);
+  E_rec = E_PS+E_rec_SH;
   
   // calculate reconstructed position: 
   // mean of position of all cluster blocks weighted with energy deposit.
-  //X_rec = X_rec/E_rec;
-  X_rec = X_rec/E_rec_SH;
-  Y_rec = Y_rec/E_rec_SH;
-  //TSBSECalCluster clus(E_rec, X_rec, Y_rec);
+  //transforming calo coordinates as stored in g4sbs output to transport coordinates.
+  X_rec = -EY_SH/E_rec_SH;
+  Y_rec = EX_SH/E_rec_SH;
   
   //hardcode threshold for the moment, will add in the DB later.
   if(E_rec>fManager->GetCaloThreshold()){
@@ -1511,370 +1848,60 @@ void TSBSGeant4File::GetBBECalCluster(){
 }
 
 void TSBSGeant4File::GetGEpECalCluster(){
-  const double Npe_Edep_ECAL = 5.38e2;//>1.0GeV
-  const double Npe_Edep_CDET = 5.634e3;//>1.0GeV
-  const double npe_thr = 3.0;
-  const double GEpECalBlock_size = 0.042;//m
-  const double GEpCDetSlat_size = 0.005;//m
-  
-  double edep_cal = 0;
-  double npe = 0;
-  
-  double E_rec = 0;
-  double X_rec = 0;
-  double Y_rec = 0;
-  double X_max = 0;
-  double Y_max = 0;
-
-  int i_ch = 0;
-  double Edep_Max = 0;
-  double Edep_tot_ECal = 0;
-  double x_pos, y_pos;
-  //double x_pos_max, y_pos_max;
-  int N_blocks_added = 0;
-  
-  std::vector<double> E_blocks;
-  std::vector<double> x_blocks;
-  std::vector<double> y_blocks;
-  
-  std::vector<double> E_eprim_clus;
-  std::vector<double> x_eprim_clus;
-  std::vector<double> y_eprim_clus;
-  
-  E_blocks.clear();
-  x_blocks.clear();
-  y_blocks.clear();
-  
-  E_eprim_clus.clear();
-  x_eprim_clus.clear();
-  y_eprim_clus.clear();
   // ---------------------------------
   // Add GEp ECal clustering here.
   // ---------------------------------
-  for(int i = 0; i<fTree->Earm_ECalTF1_hit_nhits; i++){	
-    // cout << " i " << i << " ECal: edep = " << fTree->Earm_ECalTF1_hit_sumedep->at(i) 
-    // 	 << " X = " << fTree->Earm_ECalTF1_hit_xcell->at(i) 
-    // 	 << " Y = " << fTree->Earm_ECalTF1_hit_ycell->at(i) 
-    // 	 << endl;
-    
-    edep_cal = fTree->Earm_ECalTF1_hit_sumedep->at(i);
-    npe = fR->Poisson(Npe_Edep_ECAL*edep_cal);
-    if(npe<npe_thr)continue;
-    edep_cal = npe/Npe_Edep_ECAL;
-    //if(fTree->Earm_ECalTF1_hit_sumedep()){
-    i_ch = fTree->Earm_ECalTF1_hit_cell->at(i);
-    //Edep = fTree->Earm_ECAL_hit_NumPhotoelectrons->at(i)/Npe_Edep_ECAL;
-    x_pos = fTree->Earm_ECalTF1_hit_xcell->at(i);
-    y_pos = fTree->Earm_ECalTF1_hit_ycell->at(i);
-    
-    Edep_tot_ECal+= edep_cal;//Edep;
-    
-    //cout << Edep << " " << Edep_Max << endl;
-    
-    if(edep_cal>Edep_Max){
-      Edep_Max = edep_cal;
-      // row_edepmax = fTree->Earm_ECAL_hit_row->at(i);
-      // col_edepmax = fTree->Earm_ECAL_hit_col->at(i);
-      // x_pos_max = x_pos;
-      // y_pos_max = y_pos;
-	  
-      // E_blocks;
-      // x_blocks;
-      // y_blocks;
-      if(E_eprim_clus.size()>0){
-	E_blocks.push_back(E_eprim_clus[0]);
-	x_blocks.push_back(x_eprim_clus[0]);
-	y_blocks.push_back(y_eprim_clus[0]);
-	
-	E_eprim_clus.clear();
-	x_eprim_clus.clear();
-	y_eprim_clus.clear();
-	// 	E_pos_blocks.insert(std::pair< E_pos_eprime[0].first, std::pair< E_pos_eprime[0].second.first, E_pos_eprime[0].second.second > >);
-	// 	E_pos_eprime.clear();
-      }
-      E_eprim_clus.push_back(edep_cal);
-      x_eprim_clus.push_back(x_pos);
-      y_eprim_clus.push_back(y_pos);
-      //   E_pos_eprime.insert(std::pair< Edep, std::pair< x_pos, y_pos > >);
-    }else{
-      E_blocks.push_back(edep_cal);
-      x_blocks.push_back(x_pos);
-      y_blocks.push_back(y_pos);
-      //   E_pos_blocks.insert(std::pair< Edep, make_pair< x_pos, y_pos > >);
-    }
-    //
+  fGEpECalClus.Clear();
+  for(size_t i = 0; i<fCaloHits.size(); i++){
+    const CaloHit_t& h = fCaloHits[i];
+    if(h.fDet==kGEpECal)fGEpECalClus.AddHit(fR, h.fEdep, h.fX, h.fY);
   }//end loop on hits
   
-  if(x_eprim_clus.size()==1 && y_eprim_clus.size()==1){
-    X_max = x_eprim_clus[0];
-    Y_max = y_eprim_clus[0];
-  }
+  if(fGEpECalClus.GetETotal()<fManager->GetCaloThreshold())return;
   
-  if(Edep_tot_ECal<fManager->GetCaloThreshold())return;
-    //cout << "E_eprim_clus[0] : " << E_eprim_clus[0] << " x_eprim_clus[0] : " << x_eprim_clus[0] << " y_eprim_clus[0] : " << y_eprim_clus[0] << endl;
-  N_blocks_added = 1;
-  //sanity check
-  if(E_blocks.size()==x_blocks.size() && x_blocks.size()==y_blocks.size() &&
-     E_eprim_clus.size()==x_eprim_clus.size() && x_eprim_clus.size()==y_eprim_clus.size()){
-    while(N_blocks_added>0){
-      N_blocks_added = 0;
-      //cout << "E_blocks size " << E_blocks.size() << endl;
-      for(int i = E_blocks.size()-1; i>=0; i--){
-	for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-	  //cout << "i = " << i << ", i_ = " << i_ << endl;
-	  if(sqrt(pow(x_blocks[i]-x_eprim_clus[i_], 2)+pow(y_blocks[i]-y_eprim_clus[i_], 2)) < GEpECalBlock_size*1.1){
-	    E_eprim_clus.push_back(E_blocks[i]);
-	    x_eprim_clus.push_back(x_blocks[i]);
-	    y_eprim_clus.push_back(y_blocks[i]);
-	    
-	    E_blocks.erase(E_blocks.begin()+i);
-	    x_blocks.erase(x_blocks.begin()+i);
-	    y_blocks.erase(y_blocks.begin()+i);
-	    N_blocks_added++;
-	    if(i>=E_blocks.size()){
-	      if(i>0){
-		i--;
-	      }else{
-		break;
-	      }
-	    }
-	    //cout << "transfering block: i = " << i << ", i_ = " << i_ << endl;
-	  }
-	}//end loop cluster blocks
-      }//end loop all blocks
-      // cout << "E_blocks new size " << E_blocks.size() 
-      //  	 << ", N blocks 'transfered' to clusters " << N_blocks_added << endl;
-    }//end while 
-  }
-  
-  for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-    E_rec+= E_eprim_clus[i_];
-    //not stored anymore in transport coordinates. Not relevant for GEp ECal since it would mean reconverting to the other coordinate system, etc.
-    X_rec+= x_eprim_clus[i_]*E_eprim_clus[i_];
-    Y_rec+= y_eprim_clus[i_]*E_eprim_clus[i_];
-    
-    //cout << " seed " << i_ << ", Edep = " << E_eprim_clus[i_] << ", x = " << x_eprim_clus[i_] << ", y = " << y_eprim_clus[i_] << endl;
-  }
-  X_rec = X_rec/E_rec;
-  Y_rec = Y_rec/E_rec;
-  
-  //cout << "ECal: E_rec : " << E_rec << " X_rec : " << X_rec << " Y_rec : " << Y_rec << endl; 
-  if(E_rec>fManager->GetCaloThreshold()){
-    fECalClusters.push_back(new TSBSECalCluster(E_rec, X_rec, Y_rec, 0, 12, X_max, Y_max));
+  //not stored anymore in transport coordinates. Not relevant for GEp ECal since it would mean reconverting to the other coordinate system, etc.
+  int nclus = fGEpECalClus.FindClusters(GetMaxCaloClusters());
+  for(int ic = 0; ic<nclus; ic++){
+    const TSBSCaloClusterer<TSBSGEpECalGeo>::Cluster_t& c = fGEpECalClus.GetCluster(ic);
+    //cout << "ECal: E_rec : " << c.fE << " X_rec : " << c.GetX() << " Y_rec : " << c.GetY() << endl; 
+    if(c.fE>fManager->GetCaloThreshold()){
+      fECalClusters.push_back(new TSBSECalCluster(c.fE, c.GetX(), c.GetY(), 0, 12, c.fXmax, c.fYmax));
+    }
   }
   // -------------------------------
   // end: GEp ECal reconstruction
   // -------------------------------
-  E_blocks.clear();
-  x_blocks.clear();
-  y_blocks.clear();
   
-  E_eprim_clus.clear();
-  x_eprim_clus.clear();
-  y_eprim_clus.clear();
-  
-  Edep_Max = 0;
-  double Edep_Max_plane2 = 0;
-  E_rec = 0;
-  X_rec = 0;
-  Y_rec = 0;
-
-  std::vector<double> E_blocks_plane2;
-  std::vector<double> x_blocks_plane2;
-  std::vector<double> y_blocks_plane2;
-  
-  std::vector<double> E_eprim_clus_plane2;
-  std::vector<double> x_eprim_clus_plane2;
-  std::vector<double> y_eprim_clus_plane2;
+  // CDet: one set of blocks per plane
+  fCDetClus[0].Clear();
+  fCDetClus[1].Clear();
   //
-  for(int i = 0; i<fTree->Earm_CDET_Scint_hit_nhits; i++){
-    // cout << " i " << i << " CDet: plane = " << fTree->Earm_CDET_Scint_hit_plane->at(i) 
-    // 	 << " edep = " << fTree->Earm_CDET_Scint_hit_sumedep->at(i) 
-    // 	 << " X = " << fTree->Earm_CDET_Scint_hit_xcell->at(i)+0.255*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1)+fTree->Earm_CDET_Scint_hit_xhit->at(i)*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1)
-    // 	 << " Y = " << fTree->Earm_CDET_Scint_hit_ycell->at(i) 
-    // 	 << endl;
-    
-    edep_cal = fTree->Earm_CDET_Scint_hit_sumedep->at(i);
-    npe = fR->Poisson(Npe_Edep_CDET*edep_cal);
-    if(npe<npe_thr)continue;
-    edep_cal = npe/Npe_Edep_CDET;
+  for(size_t i = 0; i<fCaloHits.size(); i++){
+    const CaloHit_t& h = fCaloHits[i];
+    if(h.fDet!=kGEpCDet)continue;
     
-    x_pos = fTree->Earm_CDET_Scint_hit_xcell->at(i)+0.255*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1);
-    //+fR->Gaus(fTree->Earm_CDET_Scint_hit_xhit->at(i)*pow(-1, fTree->Earm_CDET_Scint_hit_col->at(i)-1), 0.0);
-    //because the modules with col==1 are rotated by pi along y axis
-    y_pos = fTree->Earm_CDET_Scint_hit_ycell->at(i);
-
-    switch(fTree->Earm_CDET_Scint_hit_plane->at(i)){
-    case(1):
-      if(edep_cal>Edep_Max){
-	Edep_Max = edep_cal;
-	// row_edepmax = fTree->Earm_ECAL_hit_row->at(i);
-	
-	if(E_eprim_clus.size()>0){
-	  E_blocks.push_back(E_eprim_clus[0]);
-	  x_blocks.push_back(x_eprim_clus[0]);
-	  y_blocks.push_back(y_eprim_clus[0]);
-	  
-	  E_eprim_clus.clear();
-	  x_eprim_clus.clear();
-	  y_eprim_clus.clear();
-	  // 	E_pos_blocks.insert(std::pair< E_pos_eprime[0].first, std::pair< E_pos_eprime[0].second.first, E_pos_eprime[0].second.second > >);
-	  // 	E_pos_eprime.clear();
-	}
-	E_eprim_clus.push_back(edep_cal);
-	x_eprim_clus.push_back(x_pos);
-	y_eprim_clus.push_back(y_pos);
-      }else{
-	E_blocks.push_back(edep_cal);
-	x_blocks.push_back(x_pos);
-	y_blocks.push_back(y_pos);
-	//   E_pos_blocks.insert(std::pair< Edep, make_pair< x_pos, y_pos > >);
-      }
-      break;
-    case(2):
-      if(edep_cal>Edep_Max_plane2){
-	Edep_Max_plane2 = edep_cal;
-	// row_edepmax = fTree->Earm_ECAL_hit_row->at(i);
-	
-	if(E_eprim_clus_plane2.size()>0){
-	  E_blocks_plane2.push_back(E_eprim_clus_plane2[0]);
-	  x_blocks_plane2.push_back(x_eprim_clus_plane2[0]);
-	  y_blocks_plane2.push_back(y_eprim_clus_plane2[0]);
-	  
-	  E_eprim_clus_plane2.clear();
-	  x_eprim_clus_plane2.clear();
-	  y_eprim_clus_plane2.clear();
-	  // 	E_pos_blocks.insert(std::pair< E_pos_eprime[0].first, std::pair< E_pos_eprime[0].second.first, E_pos_eprime[0].second.second > >);
-	  // 	E_pos_eprime.clear();
-	}
-	E_eprim_clus_plane2.push_back(edep_cal);
-	x_eprim_clus_plane2.push_back(x_pos);
-	y_eprim_clus_plane2.push_back(y_pos);
-      }else{
-	E_blocks_plane2.push_back(edep_cal);
-	x_blocks_plane2.push_back(x_pos);
-	y_blocks_plane2.push_back(y_pos);
-	//   E_pos_blocks.insert(std::pair< Edep, make_pair< x_pos, y_pos > >);
-      }
-      break;
-    }//end switch
-  }
-  //clustering on CDet plane 1
-  N_blocks_added = 1;
-  //sanity check
-  if(E_blocks.size()==x_blocks.size() && x_blocks.size()==y_blocks.size() &&
-     E_eprim_clus.size()==x_eprim_clus.size() && x_eprim_clus.size()==y_eprim_clus.size()){
-    while(N_blocks_added>0){
-      N_blocks_added = 0;
-      //cout << "E_blocks size " << E_blocks.size() << endl;
-      for(int i = E_blocks.size()-1; i>=0; i--){
-	for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-	  //cout << "i = " << i << ", i_ = " << i_ << endl;
-	  if(sqrt(pow(x_blocks[i]-x_eprim_clus[i_], 2)+pow(y_blocks[i]-y_eprim_clus[i_], 2)) < GEpCDetSlat_size*1.1){
-	    E_eprim_clus.push_back(E_blocks[i]);
-	    x_eprim_clus.push_back(x_blocks[i]);
-	    y_eprim_clus.push_back(y_blocks[i]);
-	    
-	    E_blocks.erase(E_blocks.begin()+i);
-	    x_blocks.erase(x_blocks.begin()+i);
-	    y_blocks.erase(y_blocks.begin()+i);
-	    N_blocks_added++;
-	    if(i>=E_blocks.size()){
-	      if(i>0){
-		i--;
-	      }else{
-		break;
-	      }
-	    }
-	    //cout << "transfering block: i = " << i << ", i_ = " << i_ << endl;
-	  }
-	}//end loop cluster blocks
-      }//end loop all blocks
-      // cout << "E_blocks new size " << E_blocks.size() 
-      //  	 << ", N blocks 'transfered' to clusters " << N_blocks_added << endl;
-    }//end while 
-  }
-  
-  for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-    E_rec+= E_eprim_clus[i_];
-    X_rec+= x_eprim_clus[i_]*E_eprim_clus[i_];
-    Y_rec+= y_eprim_clus[i_]*E_eprim_clus[i_];
-    
-    //cout << " seed " << i_ << ", Edep = " << E_eprim_clus[i_] << ", x = " << x_eprim_clus[i_] << ", y = " << y_eprim_clus[i_] << endl;
-  }
-  X_rec = X_rec/E_rec;
-  Y_rec = Y_rec/E_rec;
-  
-  //cout << "CDet plane 1: E_rec : " << E_rec << " X_rec : " << X_rec << " Y_rec : " << Y_rec << endl; 
-  fScintClusters.push_back(new TSBSScintCluster(1, E_rec, X_rec, Y_rec, 0, 31));
-  
-  E_blocks.clear();
-  x_blocks.clear();
-  y_blocks.clear();
-  
-  E_eprim_clus.clear();
-  x_eprim_clus.clear();
-  y_eprim_clus.clear();
-  
-  E_rec = 0;
-  X_rec = 0;
-  Y_rec = 0;
-  
-  //clustering on CDet plane 2
-  N_blocks_added = 1;
-  if(E_blocks_plane2.size()==x_blocks_plane2.size() && x_blocks_plane2.size()==y_blocks_plane2.size() &&
-     E_eprim_clus_plane2.size()==x_eprim_clus_plane2.size() && x_eprim_clus_plane2.size()==y_eprim_clus_plane2.size()){
-    while(N_blocks_added>0){
-      N_blocks_added = 0;
-      //cout << "E_blocks size " << E_blocks.size() << endl;
-      for(int i = E_blocks_plane2.size()-1; i>=0; i--){
-	for(int i_ = 0; i_<E_eprim_clus_plane2.size(); i_++){
-	  //cout << "i = " << i << ", i_ = " << i_ << endl;
-	  if(sqrt(pow(x_blocks_plane2[i]-x_eprim_clus_plane2[i_], 2)+pow(y_blocks_plane2[i]-y_eprim_clus_plane2[i_], 2)) < GEpCDetSlat_size*1.1){
-	    E_eprim_clus_plane2.push_back(E_blocks_plane2[i]);
-	    x_eprim_clus_plane2.push_back(x_blocks_plane2[i]);
-	    y_eprim_clus_plane2.push_back(y_blocks_plane2[i]);
-	    
-	    E_blocks_plane2.erase(E_blocks_plane2.begin()+i);
-	    x_blocks_plane2.erase(x_blocks_plane2.begin()+i);
-	    y_blocks_plane2.erase(y_blocks_plane2.begin()+i);
-	    N_blocks_added++;
-	    if(i>=E_blocks_plane2.size()){
-	      if(i>0){
-		i--;
-	      }else{
-		break;
-	      }
-	    }
-	    //cout << "transfering block: i = " << i << ", i_ = " << i_ << endl;
-	  }
-	}//end loop cluster blocks
-      }//end loop all blocks
-      // cout << "E_blocks new size " << E_blocks.size() 
-      //  	 << ", N blocks 'transfered' to clusters " << N_blocks_added << endl;
-    }//end while 
+    int plane = h.fPlane;
+    double edep_cal = h.fEdep;
+    if(plane==1 || plane==2){
+      fCDetClus[plane-1].AddHit(fR, edep_cal, h.fX, h.fY);
+    }else{
+      // smear anyway, to keep the random sequence of the other hits
+      TSBSGEpCDetGeo::Smear(fR, edep_cal);
+    }
   }
   
-  for(int i_ = 0; i_<E_eprim_clus_plane2.size(); i_++){
-    E_rec+= E_eprim_clus_plane2[i_];
-    X_rec+= x_eprim_clus_plane2[i_]*E_eprim_clus_plane2[i_];
-    Y_rec+= y_eprim_clus_plane2[i_]*E_eprim_clus_plane2[i_];
-    
-    //cout << " seed " << i_ << ", Edep = " << E_eprim_clus[i_] << ", x = " << x_eprim_clus[i_] << ", y = " << y_eprim_clus[i_] << endl;
+  //clustering on CDet planes 1 and 2: one cluster per plane, even if empty
+  for(int plane = 1; plane<=2; plane++){
+    TSBSCaloClusterer<TSBSGEpCDetGeo>& clus = fCDetClus[plane-1];
+    double E_rec = 0, EX = 0, EY = 0;
+    if(clus.FindClusters(1)>0){
+      E_rec = clus.GetCluster(0).fE;
+      EX = clus.GetCluster(0).fEX;
+      EY = clus.GetCluster(0).fEY;
+    }
+    //cout << "CDet plane " << plane << ": E_rec : " << E_rec << " X_rec : " << EX/E_rec << " Y_rec : " << EY/E_rec << endl; 
+    fScintClusters.push_back(new TSBSScintCluster(plane, E_rec, EX/E_rec, EY/E_rec, 0, 31));
   }
-  X_rec = X_rec/E_rec;
-  Y_rec = Y_rec/E_rec;
-
-  //cout << "CDet plane 2: E_rec : " << E_rec << " X_rec : " << X_rec << " Y_rec : " << Y_rec << endl; 
-  fScintClusters.push_back(new TSBSScintCluster(2, E_rec, X_rec, Y_rec, 0, 31));
-  
-  E_blocks_plane2.clear();
-  x_blocks_plane2.clear();
-  y_blocks_plane2.clear();
-  
-  E_eprim_clus_plane2.clear();
-  x_eprim_clus_plane2.clear();
-  y_eprim_clus_plane2.clear();
   // -------------------------------
   // end: GEp CDet reconstruction
   // -------------------------------
@@ -1882,182 +1909,42 @@ void TSBSGeant4File::GetGEpECalCluster(){
 }
 
 void TSBSGeant4File::GetHCalCluster(){
-  const double HCalSamplingFact = 10.69;
-  const double Npe_Edep_HCAL = 5.0e3;//>1.0GeV
-  const double HCalBlock_size = 0.152;
-  const double npe_thr = 3.0;
-  const int clustercrown_size = 2;
+  //const double HCalSamplingFact = 10.69;
   
-  double edep_cal = 0;
-  double npe = 0;
-  
-  double E_rec = 0;
-  double X_rec = 0;
-  double Y_rec = 0;
-
-  int i_ch = 0;
-  double Edep_Max = 0;
-  double Edep_tot_HCal = 0;
-  double x_pos, y_pos;
-  //double x_pos_max, y_pos_max;
-  int N_blocks_added = 0;
-  
-  std::vector<double> E_blocks;
-  std::vector<double> x_blocks;
-  std::vector<double> y_blocks;
-  
-  std::vector<double> E_eprim_clus;
-  std::vector<double> x_eprim_clus;
-  std::vector<double> y_eprim_clus;
-  
-  E_blocks.clear();
-  x_blocks.clear();
-  y_blocks.clear();
-  
-  E_eprim_clus.clear();
-  x_eprim_clus.clear();
-  y_eprim_clus.clear();
   // ---------------------------------
   // Add HCal clustering here.
   // ---------------------------------
-  if(fTree->Harm_HCalScint_hit_nhits){
-    for(int i = 0; i<fTree->Harm_HCalScint_hit_nhits; i++){	
-      edep_cal = fTree->Harm_HCalScint_hit_sumedep->at(i);
-      npe = fR->Poisson(Npe_Edep_HCAL*edep_cal);
-      if(npe<npe_thr)continue;
-      edep_cal = npe/Npe_Edep_HCAL;
-      //if(fTree->Harm_HCalScint_hit_sumedep()){
-      i_ch = fTree->Harm_HCalScint_hit_cell->at(i);
-      //Edep = fTree->Earm_ECAL_hit_NumPhotoelectrons->at(i)/Npe_Edep_ECAL;
-      x_pos = fTree->Harm_HCalScint_hit_xcell->at(i);
-      y_pos = fTree->Harm_HCalScint_hit_ycell->at(i);
-	
-      Edep_tot_HCal+= edep_cal;//Edep;
-	
-      //cout << Edep << " " << Edep_Max << endl;
-	
-      if(edep_cal>Edep_Max){
-	Edep_Max = edep_cal;
-	// row_edepmax = fTree->Earm_ECAL_hit_row->at(i);
-	// col_edepmax = fTree->Earm_ECAL_hit_col->at(i);
-	// x_pos_max = x_pos;
-	// y_pos_max = y_pos;
-	  
-	// E_blocks;
-	// x_blocks;
-	// y_blocks;
-	if(E_eprim_clus.size()>0){
-	  E_blocks.push_back(E_eprim_clus[0]);
-	  x_blocks.push_back(x_eprim_clus[0]);
-	  y_blocks.push_back(y_eprim_clus[0]);
-	    
-	  E_eprim_clus.clear();
-	  x_eprim_clus.clear();
-	  y_eprim_clus.clear();
-	  // 	E_pos_blocks.insert(std::pair< E_pos_eprime[0].first, std::pair< E_pos_eprime[0].second.first, E_pos_eprime[0].second.second > >);
-	  // 	E_pos_eprime.clear();
-	}
-	E_eprim_clus.push_back(edep_cal);
-	x_eprim_clus.push_back(x_pos);
-	y_eprim_clus.push_back(y_pos);
-	//   E_pos_eprime.insert(std::pair< Edep, std::pair< x_pos, y_pos > >);
-      }else{
-	E_blocks.push_back(edep_cal);
-	x_blocks.push_back(x_pos);
-	y_blocks.push_back(y_pos);
-	//   E_pos_blocks.insert(std::pair< Edep, make_pair< x_pos, y_pos > >);
-      }
-      //
-    }//end loop on hits
-    
-    if(Edep_tot_HCal>0.01){
-      /*
-      for(int i = E_blocks.size()-1; i>=0; i--){
-	//for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-	//cout << "i = " << i << ", i_ = " << i_ << endl;
-	//if(sqrt(pow(x_blocks[i]-x_eprim_clus[i_], 2)+pow(y_blocks[i]-y_eprim_clus[i_], 2)) < HCalBlock_size*1.1){
-	if(fabs(x_blocks[i]-x_eprim_clus[0])<=HCalBlock_size*clustercrown_size+1.0e-2 &&
-	   fabs(y_blocks[i]-y_eprim_clus[0])<=HCalBlock_size*clustercrown_size+1.0e-2){
-	  E_eprim_clus.push_back(E_blocks[i]);
-	  x_eprim_clus.push_back(x_blocks[i]);
-	  y_eprim_clus.push_back(y_blocks[i]);
-	  
-	  E_blocks.erase(E_blocks.begin()+i);
-	  x_blocks.erase(x_blocks.begin()+i);
-	  y_blocks.erase(y_blocks.begin()+i);
-	}//end loop cluster blocks
-      }
-      */
-      
-      //cout << "E_eprim_clus[0] : " << E_eprim_clus[0] << " x_eprim_clus[0] : " << x_eprim_clus[0] << " y_eprim_clus[0] : " << y_eprim_clus[0] << endl;
-      for(int i = E_blocks.size()-1; i>=0; i--){
-        for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-	  N_blocks_added = 1;
-	  //sanity check
-	  if(E_blocks.size()==x_blocks.size() && x_blocks.size()==y_blocks.size() &&
-	     E_eprim_clus.size()==x_eprim_clus.size() && x_eprim_clus.size()==y_eprim_clus.size()){
-	    while(N_blocks_added>0){
-	      N_blocks_added = 0;
-	      //cout << "E_blocks size " << E_blocks.size() << endl;
-	      for(int i = E_blocks.size()-1; i>=0; i--){
-		for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-		  //cout << "i = " << i << ", i_ = " << i_ << endl;
-		  if(sqrt(pow(x_blocks[i]-x_eprim_clus[i_], 2)+pow(y_blocks[i]-y_eprim_clus[i_], 2)) < HCalBlock_size*1.5){//1.1
-		    E_eprim_clus.push_back(E_blocks[i]);
-		    x_eprim_clus.push_back(x_blocks[i]);
-		    y_eprim_clus.push_back(y_blocks[i]);
-	
-		    E_blocks.erase(E_blocks.begin()+i);
-		    x_blocks.erase(x_blocks.begin()+i);
-		    y_blocks.erase(y_blocks.begin()+i);
-		    N_blocks_added++;
-		    if(i>=E_blocks.size()){
-		      if(i>0){
-			i--;
-		      }else{
-			break;
-		      }
-		    }
-		    //cout << "transfering block: i = " << i << ", i_ = " << i_ << endl;
-		  }
-		}//end loop cluster blocks
-	      }//end loop all blocks
-	      // cout << "E_blocks new size " << E_blocks.size() 
-	      //  	 << ", N blocks 'transfered' to clusters " << N_blocks_added << endl;
-	    }//end while 
-	  }
-	}
-      }
-      
-      for(int i_ = 0; i_<E_eprim_clus.size(); i_++){
-	E_rec+= E_eprim_clus[i_];
-	X_rec+= (-1)*y_eprim_clus[i_]*E_eprim_clus[i_];
-	Y_rec+= x_eprim_clus[i_]*E_eprim_clus[i_];
-	
-	//cout << " seed " << i_ << ", Edep = " << E_eprim_clus[i_] << ", x = " << x_eprim_clus[i_] << ", y = " << y_eprim_clus[i_] << endl;
-      }
-      X_rec = X_rec/E_rec;
-      Y_rec = Y_rec/E_rec;
+  fHCalClus.Clear();
+  for(size_t i = 0; i<fCaloHits.size(); i++){
+    const CaloHit_t& h = fCaloHits[i];
+    if(h.fDet==kHCal)fHCalClus.AddHit(fR, h.fEdep, h.fX, h.fY);
+  }//end loop on hits
+  
+  if(fHCalClus.GetETotal()>0.01){
+    int nclus = fHCalClus.FindClusters(GetMaxCaloClusters());
+    for(int ic = 0; ic<nclus; ic++){
+      const TSBSCaloClusterer<TSBSHCalGeo>::Cluster_t& c = fHCalClus.GetCluster(ic);
+      // calo coordinates -> transport coordinates
+      double X_rec = -c.fEY/c.fE;
+      double Y_rec = c.fEX/c.fE;
       //E_rec*= HCalSamplingFact;
-      //cout << "E_rec : " << E_rec << " X_rec : " << X_rec << " Y_rec : " << Y_rec << endl; 
-
+      //cout << "E_rec : " << c.fE << " X_rec : " << X_rec << " Y_rec : " << Y_rec << endl; 
+      
       //if(E_rec>fManager->GetCaloThreshold()){
-      fECalClusters.push_back(new TSBSECalCluster(E_rec, X_rec, Y_rec, 0, 0));
+      fECalClusters.push_back(new TSBSECalCluster(c.fE, X_rec, Y_rec, 0, 0));
       //}
-    }//end if...
+    }
   }
   // -------------------------------
   // end: HCal reconstruction
   // -------------------------------
-  E_blocks.clear();
-  x_blocks.clear();
-  y_blocks.clear();
-    
-  E_eprim_clus.clear();
-  x_eprim_clus.clear();
-  y_eprim_clus.clear();
 }
 
+Int_t TSBSGeant4File::GetMaxCaloClusters() const {
+  // Set by SetMaxCaloClusters, otherwise from the database
+  if( fMaxCaloClusters >= 0 ) return fMaxCaloClusters;
+  return fManager ? fManager->GetCaloMaxClusters() : 1;
+}
 
 void TSBSGeant4File::Clear(){
   // Clear out hit and generated data
@@ -2081,6 +1968,7 @@ void TSBSGeant4File::Clear(){
   
   fECalClusters.clear();
   fScintClusters.clear();
+  fCaloHits.clear();
   
 #if D_FLAG>1
   fprintf(stderr, "%s %s line %d: Hits deleted\n",
@@ -2137,6 +2025,11 @@ void TSBSGeant4File::GetGEMData(TSBSGEMSimHitData* gd)
   gd->SetSource(fSource);
   gd->SetEvent(fEvNum);
   
+  if( fHitCache ){
+    fHitCache->GetGEMData(fEvNum, gd);
+    return;
+  }
+  
   if (GetNData() == 0) {
     return;
   }
@@ -13,8 +13,13 @@
 #include "TSBSGEMSimHitData.h"
 #include "TSBSSimEvent.h"
 #include "TRandom3.h"
+#include "TStopwatch.h"
+#include "TSBSCaloClusterer.h"
+
+#include <vector>
 
 class TSBSDBManager;
+class TSBSGEMHitCache;
 
 #define __DEFAULT_DATA_SIZE 32
 
@@ -43,6 +48,8 @@ class g4sbshitdata {
 	
 	//Get detector ID
 	int     GetDetID() const { return fDetID;}
+	//Get data array size
+	unsigned int GetSize() const { return fSize;}
 
 	// Get/set one specific element of the data for this hit
 	void    SetData( unsigned int, double );
@@ -50,6 +57,8 @@ class g4sbshitdata {
 	double *GetData(){ return fData; }//Get all data array 
 	
 	bool    IsFilled() const ;
+	// Bit i set if data element i was set
+	long long int GetFillBits() const { return fFillbits; }
 	
     protected:
 	int     fDetID;//detector ID
@@ -89,6 +98,10 @@ class TSBSGeant4File {
  public:
   //constructor may be inputed a data file to input some of the paramaters used by this class
   //NB: if the second file path does not select a valid file, default parameters will be used.
+  // The file name may be a single file, a wildcard expression (e.g. "dir/elastic_*.root")
+  // or a text file ending in ".list" or ".txt" with one file name (or wildcard) per line.
+  // All matching files are read through one TChain.
+  // A file name ending in ".g4c" is read as a TSBSGEMHitCache file instead.
   TSBSGeant4File();// Default constructor
   TSBSGeant4File( const char *name);// Constructor with input file name: recommanded
   virtual ~TSBSGeant4File();// Default destructor
@@ -97,28 +110,51 @@ class TSBSGeant4File {
   
   // Standard getters and setters
   void  SetFilename( const char *name );
+  void  AddFile( const char *name );// add a file, wildcard or list to the chain (before Open; not with a .g4c cache)
   void  SetSource( Int_t i ) { fSource = i; }
   void  Clear();
   Int_t Open();
   Int_t Close();
   
-  Long64_t GetEntries(){
-    return fTree->GetEntries();
-  };
+  Long64_t GetEntries();
+  
+  // TTreeCache size in bytes (0 disables the cache); to be set before Open
+  void  SetCacheSize( Long64_t size ) { fCacheSize = size; }
+  // Print number of events, MB read and read rates for each file of the chain
+  void  SetRateReport( Bool_t b = kTRUE ) { fRateReport = b; }
+  // Max number of clusters per event in the GEp ECal and HCal emulations;
+  // overrides generalinfo.calo_maxclusters of the database (default 1)
+  void  SetMaxCaloClusters( Int_t n ) { fMaxCaloClusters = n; }
+  Int_t GetMaxCaloClusters() const;
   
-  const char* GetFileName() const { return fFilename; }
+  const char* GetFileName() const { return fFilename.Data(); }
+  Int_t GetNFiles() const { return fChain ? fChain->GetNtrees() : 0; }
   Int_t GetSource() const { return fSource; }
   
   // This is actually where the data is read: 
   Int_t ReadNextEvent(int d_flag = 0);
+  Int_t ReadEvent(Long64_t entry, int d_flag = 0);// random access to any entry of the chain
+  
+  // Optional per-event index of GEM hit counts, to select events without reading them.
+  // If indexfile is given, the index is loaded from it, or built and saved there.
+  Long64_t BuildEventIndex(const char* indexfile = 0);
+  Bool_t   HasEventIndex() const { return !fEventIndex.empty(); }
+  Int_t    GetEventNHits(Long64_t entry) const { 
+    return (entry>=0 && entry<(Long64_t)fEventIndex.size()) ? fEventIndex[entry].fNHits : -1; 
+  }
+  Long64_t GetEventSeek(Long64_t entry) const { 
+    return (entry>=0 && entry<(Long64_t)fEventIndex.size()) ? fEventIndex[entry].fSeek : -1; 
+  }
+  Long64_t FindEvent(Long64_t start, Int_t nmin = 1, Int_t nmax = kMaxInt) const;
   
   //return the size of the hit arrays
   UInt_t GetNData() const { return fg4sbsHitData.size(); }
   UInt_t GetNGen() const { return fg4sbsGenData.size(); }
   UInt_t GetNECal() const { return fECalClusters.size(); }
   
-  UInt_t GetEvNum() const { return fEvNum; }
-  void SetFirstEvNum(UInt_t evnum){ fEvNum = evnum-1; }
+  // Current entry, -1 before the first event
+  Long64_t GetEvNum() const { return fEvNum; }
+  void SetFirstEvNum(Long64_t evnum){ fEvNum = evnum-1; }// prefer ReadEvent(entry)
   
   //get one hit from the hit data arrays
   g4sbshitdata *GetHitData(Int_t i) const { return fg4sbsHitData[i]; }
@@ -144,11 +180,54 @@ class TSBSGeant4File {
   void AddSciCluster(TSBSScintCluster* clus){fScintClusters.push_back(clus);};
   TSBSScintCluster* GetSciCluster(int i) const {return fScintClusters.at(i);};
   
+  // Calorimeter hits of the event before the energy smearing, 
+  // input of the cluster emulations (filled if fManager->DoCalo())
+  enum ECaloDet { kBBPS = 0, kBBSH, kGEpECal, kGEpCDet, kHCal };
+  struct CaloHit_t {
+    Int_t    fDet;   // ECaloDet
+    Int_t    fPlane; // CDet plane, 0 otherwise
+    Double_t fEdep;  // energy deposit (GeV)
+    Double_t fX;     // block position (m)
+    Double_t fY;
+  };
+  UInt_t GetNCaloHits() const { return fCaloHits.size(); }
+  const CaloHit_t& GetCaloHit(int i) const { return fCaloHits[i]; }
+  
  private:
   // Members
-  char  fFilename[255];
-  TFile *fFile;
+  Int_t AddToChain( const char *name );
+  Int_t ReadCacheEvent( Long64_t entry );
+  void  LoadCaloHits();
+  void  AddCaloHit( Int_t det, Int_t plane, Double_t edep, Double_t x, Double_t y );
+  void  SetupCache();
+  void  ReportFileRate();
+  TBranch* GetGEMHitCountBranch() const;
+  TString GetInputSignature() const;
+  const Int_t& GetGEMHitCount() const;
+  
+  // Entry of the event index
+  struct EventIndex_t {
+    Int_t    fNHits;   // number of GEM hits in the event
+    Int_t    fTreeNum; // number of the file in the chain
+    Long64_t fSeek;    // file offset of the basket holding the GEM hit count of the event
+  };
+  std::vector<EventIndex_t> fEventIndex;
+  std::vector<TString> fUsedBranches;// branches connected by g4sbs_tree
+  
+  TString fFilename;
+  std::vector<TString> fExtraFiles;// files added with AddFile
+  TChain *fChain;// chain of all input files
   g4sbs_tree *fTree;// needed to easily unfold root file data
+  TSBSGEMHitCache *fHitCache;// input from a hit cache file instead of the chain
+  Long64_t fCacheSize;// TTreeCache size (bytes)
+  
+  // Per-file read statistics
+  Bool_t fRateReport;
+  Int_t fCurTreeNum;// chain tree number of the file being read
+  Int_t fFileNev;// events read from this file
+  Long64_t fFileBytes;// unzipped bytes read from this file
+  Long64_t fFileBytesRead0;// TFile::GetFileBytesRead() when the file was entered
+  TStopwatch fFileTimer;
   Int_t fSource;   // User-defined source ID (e.g. MC run number)  // Temp: Do we use that ?
   //double fZSpecOffset; // Offset with which the GEM hits are registered in g4sbs for GEP.
   
@@ -172,10 +251,19 @@ class TSBSGeant4File {
   
   std::vector<TSBSECalCluster *> fECalClusters; // ECal clusters
   std::vector<TSBSScintCluster *> fScintClusters; // ECal clusters
+  std::vector<CaloHit_t> fCaloHits; // calorimeter hits
   
-  unsigned int fEvNum;// global event incrementer
+  Long64_t fEvNum;// current entry of the chain or cache, -1: none yet
 
   TSBSDBManager *fManager;
+  
+  // Calorimeter cluster finders, buffers reused for each event
+  Int_t fMaxCaloClusters;// max number of GEp ECal/HCal clusters per event, -1: from the database
+  TSBSCaloClusterer<TSBSBBPSGeo>    fBBPSClus;
+  TSBSCaloClusterer<TSBSBBSHGeo>    fBBSHClus;
+  TSBSCaloClusterer<TSBSGEpECalGeo> fGEpECalClus;
+  TSBSCaloClusterer<TSBSGEpCDetGeo> fCDetClus[2];
+  TSBSCaloClusterer<TSBSHCalGeo>    fHCalClus;
 };
 
 
@@ -0,0 +1,69 @@
+#ifndef __TSBSLINEFIT_H
+#define __TSBSLINEFIT_H
+
+#include <Rtypes.h>
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSLineFit
+//
+// Weighted least-squares fit of a straight line u(z) = U + Up*z to n
+// points (z[i], u[i]) with weights w[i] (1/sigma^2), solved in closed
+// form. The data are passed as plain arrays, nothing is allocated.
+//
+// A 3D track x(z) = X + Xp*z, y(z) = Y + Yp*z with independent x and y
+// errors is two such fits, since the x and y normal equations decouple.
+//
+// The sums are taken about the weighted mean of z, which keeps the 2x2
+// system well conditioned for detectors far from z = 0.
+
+class TSBSLineFit {
+ public:
+  TSBSLineFit() : fU(0), fUp(0), fCovUU(0), fCovUUp(0), fCovUpUp(0),
+		  fChi2(0), fNDF(0) {}
+
+  // Fit the points. Return false (and leave the results unchanged)
+  // if there are fewer than 2 points or all the weighted z are equal.
+  Bool_t Fit( const Double_t* z, const Double_t* u, const Double_t* w, Int_t n )
+  {
+    if( n < 2 ) return false;
+    Double_t S = 0, Sz = 0, Su = 0;
+    for( Int_t i = 0; i < n; i++ ) {
+      S  += w[i];
+      Sz += w[i]*z[i];
+      Su += w[i]*u[i];
+    }
+    if( S <= 0 ) return false;
+    const Double_t zm = Sz/S, um = Su/S;
+    Double_t Szz = 0, Szu = 0;
+    for( Int_t i = 0; i < n; i++ ) {
+      Double_t dz = z[i]-zm;
+      Szz += w[i]*dz*dz;
+      Szu += w[i]*dz*(u[i]-um);
+    }
+    if( Szz <= 0 ) return false;
+
+    fUp = Szu/Szz;
+    fU  = um - fUp*zm;
+    // Inverse of the normal matrix [[S, S*zm], [S*zm, Szz + S*zm^2]]
+    fCovUpUp = 1./Szz;
+    fCovUUp  = -zm/Szz;
+    fCovUU   = 1./S + zm*zm/Szz;
+    fChi2 = 0;
+    for( Int_t i = 0; i < n; i++ ) {
+      Double_t r = u[i] - fU - fUp*z[i];
+      fChi2 += w[i]*r*r;
+    }
+    fNDF = n-2;
+    return true;
+  }
+
+  Double_t fU;        // intercept at z = 0
+  Double_t fUp;       // slope
+  Double_t fCovUU;    // covariance matrix of (fU, fUp)
+  Double_t fCovUUp;
+  Double_t fCovUpUp;
+  Double_t fChi2;     // weighted sum of squared residuals
+  Int_t    fNDF;      // n-2
+};
+
+#endif//__TSBSLINEFIT_H
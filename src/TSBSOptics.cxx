@@ -0,0 +1,91 @@
+#include "TSBSOptics.h"
+
+#include <cmath>
+
+using namespace std;
+
+//_____________________________________________________________________________
+void TSBSOptics::Clear()
+{
+  fOrder = 0;
+  fCoeff.clear();
+  fExpo.clear();
+}
+
+//_____________________________________________________________________________
+void TSBSOptics::AddTerm( const Double_t* coeff, const Int_t* expo )
+{
+  for( Int_t i = 0; i < kNFocal; i++ )
+    fCoeff.push_back( coeff[i] );
+  for( Int_t i = 0; i < kNTarget; i++ ) {
+    fExpo.push_back( expo[i] );
+    if( expo[i] > fOrder )
+      fOrder = expo[i];
+    if( expo[i] < 0 )
+      fOrder = kMaxOrder+1;  // use pow() for all terms
+  }
+}
+
+//_____________________________________________________________________________
+void TSBSOptics::Eval( const Double_t* tg, Double_t* fp ) const
+{
+  // Evaluate the focal plane variables fp for the target variables tg
+
+  for( Int_t i = 0; i < kNFocal; i++ )
+    fp[i] = 0;
+  const Int_t nterms = GetNTerms();
+  const Int_t*    ex = nterms > 0 ? &fExpo[0] : 0;
+  const Double_t* c  = nterms > 0 ? &fCoeff[0] : 0;
+
+  if( fOrder > kMaxOrder ) {
+    // Unusual optics (negative or very high exponents)
+    for( Int_t it = 0; it < nterms; it++, ex += kNTarget, c += kNFocal ) {
+      Double_t term = 1;
+      for( Int_t i = 0; i < kNTarget; i++ )
+	term *= pow( tg[i], ex[i] );
+      for( Int_t i = 0; i < kNFocal; i++ )
+	fp[i] += term*c[i];
+    }
+    return;
+  }
+
+  // Power tables of the target variables, pw[var][n] = tg[var]^n
+  Double_t pw[kNTarget][kMaxOrder+1];
+  for( Int_t i = 0; i < kNTarget; i++ ) {
+    pw[i][0] = 1;
+    for( Int_t n = 1; n <= fOrder; n++ )
+      pw[i][n] = pw[i][n-1]*tg[i];
+  }
+  Double_t xfp = 0, yfp = 0, xpfp = 0, ypfp = 0;
+  for( Int_t it = 0; it < nterms; it++, ex += kNTarget, c += kNFocal ) {
+    Double_t term =
+      pw[kXptar][ex[kXptar]] * pw[kYptar][ex[kYptar]] * pw[kYtar][ex[kYtar]] *
+      pw[kPinv][ex[kPinv]] * pw[kXtar][ex[kXtar]];
+    xfp  += term*c[kXfp];
+    yfp  += term*c[kYfp];
+    xpfp += term*c[kXpfp];
+    ypfp += term*c[kYpfp];
+  }
+  fp[kXfp] = xfp;
+  fp[kYfp] = yfp;
+  fp[kXpfp] = xpfp;
+  fp[kYpfp] = ypfp;
+}
+
+//_____________________________________________________________________________
+void TSBSOptics::Eval( Double_t xptar, Double_t yptar, Double_t ytar,
+		       Double_t pinv, Double_t xtar, Double_t& xfp,
+		       Double_t& yfp, Double_t& xpfp, Double_t& ypfp ) const
+{
+  Double_t tg[kNTarget], fp[kNFocal];
+  tg[kXptar] = xptar;
+  tg[kYptar] = yptar;
+  tg[kYtar]  = ytar;
+  tg[kPinv]  = pinv;
+  tg[kXtar]  = xtar;
+  Eval( tg, fp );
+  xfp  = fp[kXfp];
+  yfp  = fp[kYfp];
+  xpfp = fp[kXpfp];
+  ypfp = fp[kYpfp];
+}
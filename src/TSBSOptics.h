@@ -0,0 +1,54 @@
+#ifndef __TSBSOPTICS_H
+#define __TSBSOPTICS_H
+
+#include <Rtypes.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSOptics
+//
+// Polynomial spectrometer optics: target variables -> focal plane.
+// Each term is a monomial
+//   xptar^i * yptar^j * ytar^k * (1/p)^l * xtar^m
+// with one coefficient per focal plane variable (xfp, yfp, xpfp, ypfp).
+//
+// The exponents and coefficients are kept in flat arrays (one row per
+// term). Eval() tabulates the powers of each target variable up to the
+// highest exponent once, then sums all the terms for the four outputs
+// in a single pass, without pow() calls.
+//
+// Loaded by TSBSDBManager::LoadOptics (see TSBSDBManager::GetOptics).
+
+class TSBSOptics {
+ public:
+  // Target variables
+  enum ETarget { kXptar = 0, kYptar, kYtar, kPinv, kXtar, kNTarget };
+  // Focal plane variables
+  enum EFocal  { kXfp = 0, kYfp, kXpfp, kYpfp, kNFocal };
+  // Highest exponent evaluated with the power tables
+  static const Int_t kMaxOrder = 15;
+
+  TSBSOptics() : fOrder(0) {}
+
+  void   Clear();
+  // Add a term with coefficients coeff[kNFocal] and exponents expo[kNTarget]
+  void   AddTerm( const Double_t* coeff, const Int_t* expo );
+
+  Int_t  GetNTerms() const { return fExpo.size()/kNTarget; }
+  // Highest exponent of any variable
+  Int_t  GetOrder()  const { return fOrder; }
+  Bool_t IsEmpty()   const { return fExpo.empty(); }
+
+  // Focal plane variables fp[kNFocal] for the target variables tg[kNTarget]
+  void   Eval( const Double_t* tg, Double_t* fp ) const;
+  void   Eval( Double_t xptar, Double_t yptar, Double_t ytar, Double_t pinv,
+	       Double_t xtar, Double_t& xfp, Double_t& yfp,
+	       Double_t& xpfp, Double_t& ypfp ) const;
+
+ private:
+  Int_t                 fOrder;
+  std::vector<Double_t> fCoeff;  // [term*kNFocal+focal]
+  std::vector<Int_t>    fExpo;   // [term*kNTarget+target]
+};
+
+#endif//__TSBSOPTICS_H
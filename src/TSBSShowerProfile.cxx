@@ -0,0 +1,212 @@
+#include "TSBSShowerProfile.h"
+#include "TSBSDBSnapshot.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+//_____________________________________________________________________________
+void TSBSShowerProfile::Axis_t::Set( const Profile_t& def, Int_t nbins,
+				     Double_t pmin, Double_t pmax,
+				     const vector<Profile_t>& prof )
+{
+  fNbins = nbins;
+  fPmin = pmin;
+  fPmax = pmax;
+  fPscale = ( nbins > 0 && pmax > pmin ) ? nbins/(pmax-pmin) : 0;
+  fN.clear(); fMin.clear(); fScale.clear();
+  fBegin.clear(); fFrac.clear();
+  for( Int_t row = 0; row <= nbins; row++ ) {
+    const Profile_t& p = ( row == 0 ) ? def : prof[row-1];
+    Int_t n = max( p.fN, 0 );
+    fN.push_back( n );
+    fMin.push_back( p.fMin );
+    fScale.push_back( ( n > 0 && p.fMax > p.fMin ) ? n/(p.fMax-p.fMin) : 0 );
+    fBegin.push_back( fFrac.size() );
+    fFrac.push_back( 0 );
+    for( Int_t i = 0; i <= n; i++ )
+      fFrac.push_back( i < (Int_t)p.fFrac.size() ? p.fFrac[i] : 0 );
+    fFrac.push_back( 1 );
+  }
+}
+
+//_____________________________________________________________________________
+Double_t TSBSShowerProfile::Axis_t::Eval( Double_t mom, Double_t pos ) const
+{
+  // Profile of the position bin of pos (cm in the table), default profile
+  // outside the bins
+  Int_t pb = Int_t( (100.0*pos - fPmin)*fPscale );
+  Int_t row = ( pb >= 0 && pb < fNbins ) ? pb+1 : 0;
+
+  // Moment bin b: interpolate between frac[b] and frac[b+1];
+  // below the first bin 0 (first sentinel), above the last one 1
+  const Int_t n = fN[row];
+  Double_t u = (mom - fMin[row])*fScale[row];
+  Int_t b = Int_t(u);
+  Int_t i = min( max(b+1, 0), n+1 );
+  Double_t t = ( b >= 0 && b < n ) ? u-b : Double_t(b >= n);
+  const Double_t* p = &fFrac[fBegin[row]+i];
+  return p[0] + (p[1]-p[0])*t - 0.5;
+}
+
+//_____________________________________________________________________________
+static void PutShowerProfile( TSBSDBSnapshot::Block& block,
+			      const TSBSShowerProfile::Profile_t& prof )
+{
+  block.Put( prof.fN );
+  block.Put( prof.fMin );
+  block.Put( prof.fMax );
+  block.Put( prof.fFrac );
+}
+
+//_____________________________________________________________________________
+static bool GetShowerProfile( TSBSDBSnapshot::Block& block,
+			      TSBSShowerProfile::Profile_t& prof )
+{
+  return block.Get( prof.fN ) && block.Get( prof.fMin ) &&
+    block.Get( prof.fMax ) && block.Get( prof.fFrac );
+}
+
+//_____________________________________________________________________________
+static istream& SkipComments( istream& in )
+{
+  // Skip white space, blank lines and comment lines ('#' to the end of line)
+  while( (in >> ws) && in.peek() == '#' )
+    in.ignore( numeric_limits<streamsize>::max(), '\n' );
+  return in;
+}
+
+//_____________________________________________________________________________
+static bool ReadShowerProfile( istream& in, TSBSShowerProfile::Profile_t& prof )
+{
+  // Read "n min max" and the n+1 values of a profile
+
+  if( !(in >> prof.fN >> prof.fMin >> prof.fMax) || prof.fN < 0 )
+    return false;
+  prof.fFrac.resize( prof.fN+1 );
+  for( Int_t i = 0; i <= prof.fN; i++ )
+    if( !(SkipComments(in) >> prof.fFrac[i]) )
+      return false;
+  return true;
+}
+
+//_____________________________________________________________________________
+Bool_t TSBSShowerProfile::Load( const char* filename )
+{
+  // Read the profiles from the database snapshot if it has them for this
+  // file, else from the file itself (and record them in the snapshot)
+
+  Profile_t xdef, ydef;
+  Int_t nx = 0, ny = 0;
+  Double_t xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+  vector<Profile_t> xprof, yprof;
+
+  // Same block as the former TSBSSimDecoder::load_shower_profiles
+  TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
+  const string snapkey = string("TSBSSimDecoder:") + filename;
+  TSBSDBSnapshot::Block* block = snap->FindBlock( snapkey );
+  bool ok = false;
+  if( block ) {
+    ok = GetShowerProfile( *block, xdef ) && GetShowerProfile( *block, ydef ) &&
+      block->Get( nx ) && block->Get( xmin ) && block->Get( xmax ) &&
+      block->Get( ny ) && block->Get( ymin ) && block->Get( ymax ) &&
+      nx >= 0 && ny >= 0;
+    if( ok ) {
+      xprof.resize( nx );
+      for( Int_t i = 0; i < nx && ok; i++ )
+	ok = GetShowerProfile( *block, xprof[i] );
+      yprof.resize( ny );
+      for( Int_t i = 0; i < ny && ok; i++ )
+	ok = GetShowerProfile( *block, yprof[i] );
+    }
+  }
+
+  if( !ok ) {
+    // Single pass over the file: each header keyword is followed by
+    // its parameters and, for a profile, by its values.
+    // Blank lines and '#' comment lines are ignored.
+    ifstream in( filename );
+    if( !in ) {
+      cerr << "Error: cannot open shower profile file " << filename << endl;
+      return false;
+    }
+    string key;
+    Int_t ibin;
+    ok = true;
+    while( ok && SkipComments(in) >> key ) {
+      if( key == "ECAL_shower_profile_x_default" )
+	ok = ReadShowerProfile( in, xdef );
+      else if( key == "ECAL_shower_profile_y_default" )
+	ok = ReadShowerProfile( in, ydef );
+      else if( key == "ECAL_shower_profiles_x" ) {
+	ok = (in >> nx >> xmin >> xmax) && nx >= 0;
+	if( ok ) xprof.resize( nx );
+      }
+      else if( key == "ECAL_shower_profiles_y" ) {
+	ok = (in >> ny >> ymin >> ymax) && ny >= 0;
+	if( ok ) yprof.resize( ny );
+      }
+      else if( key == "ECAL_shower_profile_x_bin" )
+	ok = (in >> ibin) && ibin >= 1 && ibin <= nx &&
+	  ReadShowerProfile( in, xprof[ibin-1] );
+      else if( key == "ECAL_shower_profile_y_bin" )
+	ok = (in >> ibin) && ibin >= 1 && ibin <= ny &&
+	  ReadShowerProfile( in, yprof[ibin-1] );
+      else
+	ok = false;
+    }
+    if( !ok ) {
+      cerr << "Error: bad shower profile file " << filename
+	   << " at \"" << key << "\"" << endl;
+      return false;
+    }
+
+    if( (block = snap->NewBlock( snapkey )) ) {
+      block->AddSource( filename );
+      PutShowerProfile( *block, xdef );
+      PutShowerProfile( *block, ydef );
+      block->Put( nx );
+      block->Put( xmin );
+      block->Put( xmax );
+      block->Put( ny );
+      block->Put( ymin );
+      block->Put( ymax );
+      for( Int_t i = 0; i < nx; i++ )
+	PutShowerProfile( *block, xprof[i] );
+      for( Int_t i = 0; i < ny; i++ )
+	PutShowerProfile( *block, yprof[i] );
+    }
+  }
+
+  fX.Set( xdef, nx, xmin, xmax, xprof );
+  fY.Set( ydef, ny, ymin, ymax, yprof );
+  return true;
+}
+
+//_____________________________________________________________________________
+const TSBSShowerProfile* TSBSShowerProfile::Get( const char* filename )
+{
+  // Profiles of filename, read on the first call for this file
+
+  static map<string, TSBSShowerProfile*> loaded;
+  static mutex loaded_mutex;
+
+  lock_guard<mutex> lock(loaded_mutex);
+  map<string, TSBSShowerProfile*>::iterator it = loaded.find(filename);
+  if( it != loaded.end() )
+    return it->second;
+
+  TSBSShowerProfile* prof = new TSBSShowerProfile;
+  if( !prof->Load(filename) ) {
+    delete prof;
+    prof = 0;
+  }
+  loaded[filename] = prof;
+  return prof;
+}
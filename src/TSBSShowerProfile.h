@@ -0,0 +1,72 @@
+#ifndef __TSBSSHOWERPROFILE_H
+#define __TSBSSHOWERPROFILE_H
+
+#include <Rtypes.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSShowerProfile
+//
+// ECal shower profile tables (ECAL_shower_profiles.txt), used by
+// TSBSSimDecoder to correct the cluster position within the cell of its
+// most energetic block.
+//
+// For each axis the file has a default profile and one profile per bin
+// of the position of that block. A profile gives, in bins of the energy
+// moment of the cluster along the axis, the position of the shower
+// within the cell (0 ... 1, cell size units). Here all the profiles of
+// an axis are one flat table: the bins are found arithmetically and the
+// values interpolated linearly in the moment.
+//
+// The tables are read only once per file and shared by all users,
+// see Get(). They come from the database snapshot when it has them.
+
+class TSBSShowerProfile {
+ public:
+  // Profiles of the given file, loaded on first use and shared read-only.
+  // 0 if the file cannot be read.
+  static const TSBSShowerProfile* Get( const char* filename );
+
+  // Shower position relative to the center of the cell of the max block
+  // (-0.5 ... 0.5, cell size units), for the energy moment mom of the
+  // cluster and the position pos (m) of the max block along x or y
+  Double_t GetX( Double_t mom, Double_t pos ) const { return fX.Eval(mom,pos); }
+  Double_t GetY( Double_t mom, Double_t pos ) const { return fY.Eval(mom,pos); }
+
+  // One profile as in the file: fN bins from fMin to fMax, fN+1 values
+  struct Profile_t {
+    Int_t    fN;
+    Double_t fMin;
+    Double_t fMax;
+    std::vector<Double_t> fFrac;
+  };
+
+ private:
+  // All the profiles of one axis. Row 0 is the default profile,
+  // row 1+i the profile of position bin i. Each row holds its values
+  // between two sentinels: 0, frac[0], ..., frac[n], 1.
+  struct Axis_t {
+    Axis_t() : fNbins(0), fPmin(0), fPmax(0), fPscale(0) {}
+    void     Set( const Profile_t& def, Int_t nbins, Double_t pmin, Double_t pmax,
+		  const std::vector<Profile_t>& prof );
+    Double_t Eval( Double_t mom, Double_t pos ) const;
+
+    Int_t    fNbins;     // position bins
+    Double_t fPmin;      // position range (cm)
+    Double_t fPmax;
+    Double_t fPscale;    // fNbins/(fPmax-fPmin)
+    std::vector<Int_t>    fN;      // [row] moment bins
+    std::vector<Double_t> fMin;    // [row] moment at the low edge
+    std::vector<Double_t> fScale;  // [row] moment bins per unit
+    std::vector<Int_t>    fBegin;  // [row] first value (sentinel) in fFrac
+    std::vector<Double_t> fFrac;
+  };
+
+  TSBSShowerProfile() {}
+  Bool_t Load( const char* filename );
+
+  Axis_t fX;
+  Axis_t fY;
+};
+
+#endif//__TSBSSHOWERPROFILE_H
@@ -17,6 +17,8 @@
 #include "THaBenchmark.h"
 #include "VarDef.h"
 #include "TSBSDBManager.h"
+#include "TSBSShowerProfile.h"
+#include "TSBSLineFit.h"
 #include "ha_compiledata.h"
 
 #include "TError.h"
@@ -24,21 +26,16 @@
 #include "TMath.h"
 #include "TDatabasePDG.h"
 //#include "TRandom3.h"
-#include "TVectorD.h"
-#include "TMatrixD.h"
 
 #include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <utility>
 #include <stdexcept>
+#include <mutex>
 
 using namespace std;
 using namespace Podd;
 
-//EFuchey: 2016/12/10: it is necessary to declare the TSBSDBManager as a static instance here 
-// (and not make it a member) because it is used by functions whic are defined as "static inline".
-static TSBSDBManager* fManager = TSBSDBManager::GetInstance();
 //static TRandom3* Rdec = new TRandom3(0);
 static const Int_t kPrimaryType = 1, kPrimarySource = 0;
 // Projection types must match the definitions in TreeSearch
@@ -49,7 +46,7 @@ typedef vector<int>::size_type vsiz_t;
 // TODO: Have dbconvert write out MAXSLOT (and possibly other parameters)
 //  to the database to allow client to understand the generated detector maps.
 // FIXME: The number 30 is hardcoded in dbconvert
-static const Int_t SIM_MAXSLOT = TMath::Min(Decoder::MAXSLOT,30);
+static const Int_t SIM_MAXSLOT = (Decoder::MAXSLOT < 30) ? Decoder::MAXSLOT : 30;
 
 // Hard coded stuff for the time being...
 // what we will need is to switch all that stuff to SBS-offline anyway
@@ -80,6 +77,9 @@ static const double dE_E_MPV = 0.13; //Most probable electron energy loss before
 
 //-----------------------------------------------------------------------------
 TSBSSimDecoder::TSBSSimDecoder()
+  : fMaxModules(0), fMCTruth(true), fManager(TSBSDBManager::GetInstance()),
+    fSimEvent(0), fPrimPID(0), fPrimMass(0), fStripTruthDone(false),
+    fShowerProfile(0)
 {
   // Constructor
 
@@ -256,7 +256,11 @@ void TSBSSimDecoder::Clear( Option_t* opt )
   SimDecoder::Clear(opt);   // clears fMCHits, fMCTracks and fMCPoints
 
   fBackTracks->Clear(opt);
-  fStripMap.clear();
+  // Reset only the entries of the strips of the last event
+  for( vsiz_t i = 0; i < fStripKeys.size(); i++ )
+    fStripIndex[fStripKeys[i]] = -1;
+  fStripKeys.clear();
+  fStripTruthDone = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -278,7 +282,7 @@ int TSBSSimDecoder::LoadEvent(const Int_t* evbuffer )
 
 //-----------------------------------------------------------------------------
 static inline
-void StripToROC( Int_t s_plane, Int_t s_sector, Int_t s_proj,
+void StripToROC( const TSBSDBManager* mgr, Int_t s_plane, Int_t s_sector, Int_t s_proj,
 		 Int_t s_chan,
 		 Int_t& crate, Int_t& slot, Int_t& chan )
 {
@@ -293,44 +297,44 @@ void StripToROC( Int_t s_plane, Int_t s_sector, Int_t s_proj,
   // cout << "Chambers per crate ? " << fManager->GetChambersPerCrate() << endl;
   // cout << "Module per readout ? " << fManager->GetModulesPerChamber() << endl;
   
-  div_t d = div( s_chan, fManager->GetChanPerSlot() );
+  div_t d = div( s_chan, mgr->GetChanPerSlot() );
   Int_t module = d.quot;
   chan = d.rem;
   Int_t ix = module +
-    fManager->GetModulesPerReadOut()*( s_proj + fManager->GetNReadOut()*( s_plane + fManager->GetNChamber()*s_sector ));
+    mgr->GetModulesPerReadOut()*( s_proj + mgr->GetNReadOut()*( s_plane + mgr->GetNChamber()*s_sector ));
   
   //cout << "StripToROC: module " << module << ", ix " << ix << endl;
   
-  d = div( ix, fManager->GetChambersPerCrate()*fManager->GetModulesPerChamber() );
+  d = div( ix, mgr->GetChambersPerCrate()*mgr->GetModulesPerChamber() );
   crate = d.quot;
   slot  = d.rem;
 }
 
 //-----------------------------------------------------------------------------
 static inline
-void StripToROCD( Int_t s_plane, Int_t s_module, Int_t s_proj,
+void StripToROCD( const TSBSDBManager* mgr, Int_t s_plane, Int_t s_module, Int_t s_proj,
 		 Int_t s_chan,
 		 Int_t& crate, Int_t& slot, Int_t& chan )
 {
-  div_t d = div( s_chan, fManager->GetChanPerSlot() );
+  div_t d = div( s_chan, mgr->GetChanPerSlot() );
   //  Int_t module = d.quot;
   chan = d.rem;
   //total slot id
-  Int_t ix = s_proj + 2*( s_module + fManager->GetNModule(s_plane-1)*s_plane );
+  Int_t ix = s_proj + 2*( s_module + mgr->GetNModule(s_plane-1)*s_plane );
   
   //  cout << "StripToROC: module " << module << ", ix " << ix << Decoder::MAXSLOT<<endl;
   
-  d = div( ix, SIM_MAXSLOT);//fManager->GetChambersPerCrate()*fManager->GetModulesPerChamber() );
+  d = div( ix, SIM_MAXSLOT);//mgr->GetChambersPerCrate()*mgr->GetModulesPerChamber() );
   crate = d.quot;
   slot  = d.rem;
 }
 
 //-----------------------------------------------------------------------------
 static inline
-Int_t MakeROCKey( Int_t crate, Int_t slot, Int_t chan )
+Int_t MakeROCKey( const TSBSDBManager* mgr, Int_t crate, Int_t slot, Int_t chan )
 {
   return chan +
-    fManager->GetChanPerSlot()*( slot + SIM_MAXSLOT*crate );
+    mgr->GetChanPerSlot()*( slot + SIM_MAXSLOT*crate );
 }
 
 //-----------------------------------------------------------------------------
@@ -339,14 +343,62 @@ Int_t TSBSSimDecoder::StripFromROC( Int_t crate, Int_t slot, Int_t chan ) const
   // Return index of digitized strip correspomding to hardware channel
   // (crate,slot,chan)
 
-  if( fStripMap.empty() )
+  Int_t key = MakeROCKey(fManager,crate,slot,chan);
+  if( key < 0 || static_cast<vsiz_t>(key) >= fStripIndex.size() )
     return -1;
 
-  StripMap_t::const_iterator found = fStripMap.find( MakeROCKey(crate,slot,chan) );
-  if( found == fStripMap.end() )
-    return -1;
+  return fStripIndex[key];
+}
 
-  return found->second;
+//-----------------------------------------------------------------------------
+void TSBSSimDecoder::InitReadoutROC()
+{
+  // Tabulate StripToROCD for all (plane, module, readout) of the database,
+  // so that the strips are mapped with a table lookup in DoLoadEvent
+
+  Int_t nplanes = fManager->GetNGEMPlane();
+  fMaxModules = 0;
+  for( Int_t ip = 0; ip < nplanes; ip++ )
+    fMaxModules = TMath::Max( fMaxModules, fManager->GetNModule(ip) );
+
+  fReadoutROC.assign( nplanes*fMaxModules*2, ReadoutROC_t() );
+  for( Int_t ip = 0; ip < nplanes; ip++ ) {
+    for( Int_t im = 0; im < fMaxModules; im++ ) {
+      for( Int_t proj = 0; proj < 2; proj++ ) {
+	ReadoutROC_t& r = fReadoutROC[(ip*fMaxModules+im)*2+proj];
+	Int_t chan;
+	StripToROCD( fManager, ip, im, proj, 0, r.crate, r.slot, chan );
+	r.slotidx = idx(r.crate,r.slot);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+void TSBSSimDecoder::SetStripIndex( Int_t crate, Int_t slot, Int_t chan,
+				    Int_t istrip )
+{
+  // Record istrip as the digitized strip of hardware channel (crate,slot,chan).
+  // fStripIndex is a dense array over all ROC keys, grown as needed and
+  // kept from event to event; Clear() resets the entries set here.
+  // If the channel is already set in this event, keep the first strip.
+
+  Int_t key = MakeROCKey(fManager,crate,slot,chan);
+  assert( key >= 0 );
+  if( static_cast<vsiz_t>(key) >= fStripIndex.size() )
+    fStripIndex.resize( key+1, -1 );
+  if( fStripIndex[key] >= 0 ) {
+    static bool warned = false;
+    if( !warned ) {
+      Warning( "SetStripIndex", "Channel crate/slot/chan = %d/%d/%d digitized "
+	       "twice in the same event, keeping the first strip. "
+	       "Further occurrences are not reported.", crate, slot, chan );
+      warned = true;
+    }
+    return;
+  }
+  fStripIndex[key] = istrip;
+  fStripKeys.push_back(key);
 }
 
 //-----------------------------------------------------------------------------
@@ -354,10 +406,10 @@ std::vector<std::vector<Double_t>> TSBSSimDecoder::GetAllMCHits() const
 {
   std::vector<std::vector<Double_t>> hits;
   std::vector<Double_t> vtemp = {0,0,0,0,0,0};//v[0]--posx, v[1]--posy, v[2]--charge, v[3]--planeID v[4]--moduleID v[5]time_zero
-  assert( buffer );       // Must still have the event buffer
-  const TSBSSimEvent* simEvent = reinterpret_cast<const TSBSSimEvent*>(buffer);
-  for(size_t i=0;i<simEvent->fGEMClust.size();i++){
-    const TSBSSimEvent::GEMCluster& clust = simEvent->fGEMClust[i];
+  assert( fSimEvent );    // Must still have the event buffer
+  const TSBSSimEvent* truth = fSimEvent->GetTruth();
+  for(size_t i=0;i<truth->fGEMClust.size();i++){
+    const TSBSSimEvent::GEMCluster& clust = truth->fGEMClust[i];
     if(clust.fSource!=0){continue;}
     vtemp[0] = clust.fMCpos.X();
     vtemp[1] = clust.fMCpos.Y();
@@ -373,123 +425,143 @@ std::vector<std::vector<Double_t>> TSBSSimDecoder::GetAllMCHits() const
 }
 
 //-----------------------------------------------------------------------------
-TSBSMCHitInfo TSBSSimDecoder::GetSBSMCHitInfo( Int_t crate, Int_t slot, Int_t chan ) const
+void TSBSSimDecoder::BuildStripTruth() const
 {
-  // Get MC truth info for the given hardware channel
-//  const char* const here = "TSBSSimDecoder::GetSBSMCHitInfo";
-
-  Int_t istrip = StripFromROC( crate, slot, chan );
-  assert( istrip >= 0 );  // else logic error in caller or bad fStripMap
-  
-  
-  assert( buffer );       // Must still have the event buffer
-  const TSBSSimEvent* simEvent = reinterpret_cast<const TSBSSimEvent*>(buffer);
-  
-  assert( static_cast<vsiz_t>(istrip) < simEvent->fGEMStrips.size() );
-  const TSBSSimEvent::DigiGEMStrip& strip = simEvent->fGEMStrips[istrip];
-  assert( strip.fProj >= 0 && strip.fProj < fManager->GetNReadOut() );
-  
-  TSBSMCHitInfo mc;
-  mc.fSigType = strip.fSigType;
-  //if(strip.fSigType==1)cout << "TSBSSimDecoder::GetSBSMCHitInfo mc.fSigType " << mc.fSigType << " strip ? " << istrip << " crate " << crate << " slot " << slot << " chan " << chan << endl;
-  // cout<<kPrimaryStrip<<" "<<kSecondaryStrip<<" "<<kInducedStrip<<endl;getchar();0 1 2
-    // if(strip.fProj==0 && strip.fPlane==4 && strip.fTime1>50.0)
-  //   printf("%f \n", strip.fTime1);
-  
-  //for cross talk
-  if (TESTBIT(strip.fSigType, kInducedStrip) && !TESTBIT(strip.fSigType, kPrimaryStrip) &&
-      !TESTBIT(strip.fSigType, kSecondaryStrip) ){
-    mc.fMCTrack = 0;
-    mc.fMCPos = fManager->GetPosFromModuleStrip(strip.fProj, strip.fPlane, strip.fModule, strip.fChan);
-    mc.fMCTime = strip.fTime1;
-    
-    //cout << "strip = " << strip.fChan << ", time = " << mc.fMCTime << ", pos = " <<  mc.fMCPos << endl;
-    return mc;
+  // Compute the MC truth of all the strips of the current event
+
+  assert( fSimEvent );    // Must still have the event buffer
+  const TSBSSimEvent* simEvent = fSimEvent;
+  const TSBSSimEvent* truth = simEvent->GetTruth();  // read now if stored apart
+
+  // Signal particle of each cluster, if any
+  fClustSignal.assign( truth->fGEMClust.size(), -1 );
+  for( vsiz_t ic = 0; ic < truth->fGEMClust.size(); ic++ ) {
+    const TSBSSimEvent::GEMCluster& c = truth->fGEMClust[ic];
+    // cluster type has _nothing_ to do with signal track ID !!!!!!!!
+    if( c.fType != 1 ) continue;
+    for( vsiz_t ii = 0; ii < fSignalInfo.size(); ii++ )
+      if( c.fPID == fSignalInfo[ii].pid )
+	fClustSignal[ic] = ii;
   }
 
-  mc.fMCCharge = strip.fCharge;
-  // cout<<"strip: "<<istrip<<" cc: "<<mc.fMCCharge<<endl;
-  Double_t nOverlapSignal = 0.;
-  // cout<<strip.fClusters.GetSize()<<" # "<<strip.fClusterRatio[0].GetSize()<<" # "<<strip.fClusterRatio[1].GetSize()<<" # "<<strip.fClusterRatio[2].GetSize()<<" # "<<strip.fClusterRatio[3].GetSize()<<endl;getchar();
-  for( Int_t i = 0; i<strip.fClusters.GetSize(); ++i ) {
-    Int_t iclust = strip.fClusters[i] - 1;  // yeah, array index = clusterID - 1
+  fStripTruth.resize( simEvent->fDigiStrips.size() );
+  for( vsiz_t istrip = 0; istrip < simEvent->fDigiStrips.size(); istrip++ ) {
+    const TSBSSimEvent::GEMStrip& strip = simEvent->fDigiStrips[istrip];
+    assert( strip.fProj >= 0 && strip.fProj < fManager->GetNReadOut() );
+    TSBSStripTruth& mc = fStripTruth[istrip];
+    mc.fMCTrack = mc.fContam = 0;
+    mc.fMCPos = mc.fMCTime = mc.fMCCharge = 0;
+    mc.fSigType = strip.fSigType;
+    mc.fStrip = istrip;
+    mc.fNClust = 0;
+
+    //for cross talk
+    if (TESTBIT(strip.fSigType, kInducedStrip) && !TESTBIT(strip.fSigType, kPrimaryStrip) &&
+	!TESTBIT(strip.fSigType, kSecondaryStrip) ){
+      mc.fMCPos = fManager->GetPosFromModuleStrip(strip.fProj, strip.fPlane, strip.fModule, strip.fChan);
+      mc.fMCTime = strip.fTime1;
+      continue;
+    }
 
-   
-    //   cout<<mc.vClusterID.size()<<" : "<<mc.vClusterADC[1].size()<<endl;getchar(); 
+    mc.fMCCharge = strip.fCharge;
+    // No cluster data if the MC truth could not be read (see GetTruth)
+    if( static_cast<vsiz_t>(strip.fClustBegin+strip.fNClust) > truth->fStripClust.size() )
+      continue;
+    mc.fNClust = strip.fNClust;
+    Double_t nOverlapSignal = 0.;
+    for( Int_t i = 0; i<strip.fNClust; ++i ) {
+      Int_t iclust = truth->GetStripCluster(strip,i) - 1;  // yeah, array index = clusterID - 1
+      assert( iclust >= 0 && static_cast<vsiz_t>(iclust) < truth->fGEMClust.size() );
+      const TSBSSimEvent::GEMCluster& c = truth->fGEMClust[iclust];
+      assert( c.fID == iclust+1 );
+      assert( strip.fPlane == c.fPlane && strip.fSector == c.fSector );
+      Int_t signalID = fClustSignal[iclust];
+      Double_t pos = c.fXProj[strip.fProj]+(1-strip.fProj)*fManager->GetXOffset(c.fPlane,c.fModule);
+      if( signalID >= 0 && c.fSource == kPrimarySource ) {
+	if( mc.fMCTrack > 0 ) {
+	  //this means that there two signal hits overlapping
+	  //for now I keep the fMCTrack to the first one, by average the fMCPos nad fMCTime
+	  //Weizhi Xiong
+	  mc.fMCPos += pos;
+	  mc.fMCTime += c.fTime;
+	}else{
+	  // Strip contains a contribution from a primary particle hit :)
+	  mc.fMCTrack = fSignalInfo[signalID].tid;
+	  mc.fMCPos   = pos;
+	  mc.fMCTime  = c.fTime;
+	}
+	nOverlapSignal++;
+      } else {
+	++mc.fContam;
+	if( mc.fMCTrack == 0 ) {
+	  mc.fMCPos += pos;
+	}
+      }
+    }
+    assert( strip.fNClust == 0 || mc.fMCTrack > 0 || mc.fContam > 0 );
 
-    assert( iclust >= 0 && static_cast<vsiz_t>(iclust) < simEvent->fGEMClust.size() );
-    const TSBSSimEvent::GEMCluster& c = simEvent->fGEMClust[iclust];
-    mc.vClusterID.push_back(iclust);
+    if( mc.fMCTrack == 0 ) {
+      if( mc.fContam > 1 ) {
+	// If only background hits, report the mean position of all those hits
+	mc.fMCPos /= static_cast<Double_t>(mc.fContam);
+      }
+      mc.fMCTime = strip.fTime1;
+    }else{
+      mc.fMCPos /= nOverlapSignal;
+      mc.fMCTime /= nOverlapSignal;
+    }
+  }
+  fStripTruthDone = true;
+}
 
-    //work here! remove after finish!
-    // add cluster type info here to tell whether a cluster is a primary or background using "fSource" in simevent.h !!
-    // then go to get b_overtotal in gemplane.cxx and so u can tell whether a cluster has background in it. and how much! great!
-    mc.vClusterType.push_back(c.fSource);
+//-----------------------------------------------------------------------------
+const TSBSStripTruth* TSBSSimDecoder::GetStripTruth( Int_t crate, Int_t slot,
+						     Int_t chan ) const
+{
+  // Get MC truth info for the given hardware channel, 0 if no strip
 
+  Int_t istrip = StripFromROC( crate, slot, chan );
+  if( istrip < 0 )
+    return 0;
+  if( !fStripTruthDone )
+    BuildStripTruth();
+  assert( static_cast<vsiz_t>(istrip) < fStripTruth.size() );
+  return &fStripTruth[istrip];
+}
+
+//-----------------------------------------------------------------------------
+TSBSMCHitInfo TSBSSimDecoder::GetSBSMCHitInfo( Int_t crate, Int_t slot, Int_t chan ) const
+{
+  // Get MC truth info for the given hardware channel, including the data
+  // of the clusters contributing to the strip
 
+  const TSBSStripTruth* st = GetStripTruth( crate, slot, chan );
+  assert( st );  // else logic error in caller or bad fStripIndex
 
+  TSBSMCHitInfo mc( st->fMCTrack, st->fMCPos, st->fMCTime, st->fMCCharge,
+		    st->fContam );
+  mc.fSigType = st->fSigType;
+  if( st->fNClust == 0 )
+    return mc;
 
-    //
+  const TSBSSimEvent::GEMStrip& strip = fSimEvent->fDigiStrips[st->fStrip];
+  const TSBSSimEvent* truth = fSimEvent->GetTruth();
+  for( Int_t i = 0; i<st->fNClust; ++i ) {
+    Int_t iclust = truth->GetStripCluster(strip,i) - 1;
+    const TSBSSimEvent::GEMCluster& c = truth->fGEMClust[iclust];
+    mc.vClusterID.push_back(iclust);
+    // cluster type: primary or background (fSource)
+    mc.vClusterType.push_back(c.fSource);
     mc.vClusterPeakTime.push_back(c.fTime);
     mc.vClusterPos.push_back(c.fHitpos);
     mc.vClusterCharge.push_back(c.fCharge);
-
-    mc.vClusterStripWeight.push_back(strip.fStripWeightInCluster[i]);
-    // cout<<strip.fStripWeightInCluster[i]<<endl;getchar();
+    mc.vClusterStripWeight.push_back(truth->GetStripClusterWeight(strip,i));
     for(Int_t its=0;its<6;its++)
       {
-	mc.vClusterADC[its].push_back(strip.fClusterRatio[its][i]);
+	mc.vClusterADC[its].push_back(truth->GetStripClusterADC(strip,its,i));
       }
-
-    assert( c.fID == iclust+1 );
-    assert( strip.fPlane == c.fPlane && strip.fSector == c.fSector );
-    Int_t signalID = -1;
-    for (unsigned int ii = 0; ii<fSignalInfo.size(); ii++){
-      //cout << "c.fType " << c.fType << " fSignalInfo.at(ii).tid " << fSignalInfo.at(ii).tid << ", c.fPID " << c.fPID << " fSignalInfo.at(ii).pid " << fSignalInfo.at(ii).pid << endl;
-      //if (c.fType == fSignalInfo.at(ii).tid && c.fPID == fSignalInfo.at(ii).pid) // cluster_type(primary or secondary) == type_requested(primary) && particle == partical_requested 
-      // cluster type has _nothing_ to do with signal track ID !!!!!!!! 
-      if (c.fType == 1 && c.fPID == fSignalInfo.at(ii).pid) // cluster_type(primary or secondary) == type_requested(primary) && particle == partical_requested
-	signalID = ii;
-    }
-    // cout << "Plane " << strip.fPlane << ", proj (x: 0, y: 1) " << strip.fProj 
-    //  	 << ": pos[proj] = "  << c.fXProj[strip.fProj] << endl;
-    //cout << "signalID " << signalID << "; " << c.fSource << " ==? " << kPrimarySource << endl;
-    if( signalID >= 0 && c.fSource == kPrimarySource ) {
-      if( mc.fMCTrack > 0 ) {
-        //this means that there two signal hits overlapping
-        //for now I keep the fMCTrack to the first one, by average the fMCPos nad fMCTime
-        //Weizhi Xiong
-        //assert(manager->GetNSigParticle() > 1); //otherwise should not happen
-        
-        mc.fMCPos += c.fXProj[strip.fProj]+(1-strip.fProj)*fManager->GetXOffset(c.fPlane,c.fModule);
-        mc.fMCTime += c.fTime; 
-      }else{
-        // Strip contains a contribution from a primary particle hit :)
-        mc.fMCTrack = fSignalInfo.at(signalID).tid; 
-        mc.fMCPos   = c.fXProj[strip.fProj]+(1-strip.fProj)*fManager->GetXOffset(c.fPlane,c.fModule);
-        mc.fMCTime  = c.fTime;
-      }
-      nOverlapSignal++;
-    } else {
-      ++mc.fContam;
-      if( mc.fMCTrack == 0 ) {
-	mc.fMCPos += c.fXProj[strip.fProj]+(1-strip.fProj)*fManager->GetXOffset(c.fPlane,c.fModule);
-      }
-    }
-  }
-  assert( strip.fClusters.GetSize() == 0 || mc.fMCTrack > 0 || mc.fContam > 0 );
-  
-  if( mc.fMCTrack == 0 ) {
-    if( mc.fContam > 1 ) {
-      // If only background hits, report the mean position of all those hits
-      mc.fMCPos /= static_cast<Double_t>(mc.fContam);
-    }
-    mc.fMCTime = strip.fTime1;
-  }else{
-    mc.fMCPos /= nOverlapSignal;
-    mc.fMCTime /= nOverlapSignal;
   }
-  
+
   return mc;
 }
 
@@ -504,6 +576,27 @@ static inline Int_t NumberOfSetBits( UInt_t v )
   return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
 }
 
+//-----------------------------------------------------------------------------
+Double_t TSBSSimDecoder::GetParticleMass( Int_t pid )
+{
+  // Mass of the particle with the given PDG code. TDatabasePDG builds its
+  // tables on first use and is shared by all decoders, so it is only
+  // consulted when the primary changes, and under a lock.
+
+  static std::mutex pdg_mutex;
+
+  if( pid != fPrimPID ) {
+    fPrimPID = pid;
+    fPrimMass = 0;
+    std::lock_guard<std::mutex> lock(pdg_mutex);
+    if( TParticlePDG* particle = TDatabasePDG::Instance()->GetParticle(pid) )
+      fPrimMass = particle->Mass();
+    else
+      Warning( "LoadEvent", "No enrty in PDG database for PID = %d", pid );
+  }
+  return fPrimMass;
+}
+
 //-----------------------------------------------------------------------------
 #if ANALYZER_VERSION_CODE >= ANALYZER_VERSION(1,6,0)
 Int_t TSBSSimDecoder::DoLoadEvent(const UInt_t* evbuffer )
@@ -520,13 +613,25 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 #endif
   assert( fMap || fNeedInit );
 
-  // Local copy of evbuffer pointer, used in GetMCHitInfo
+  // Local copy of evbuffer pointer
   buffer = evbuffer;
 
   // Cast the evbuffer pointer back to exactly the event type that is present
   // in the input file (in TSBSSimFile). The pointer-to-unsigned integer is
-  // needed compatibility with the standard decoder.
-  const TSBSSimEvent* simEvent = reinterpret_cast<const TSBSSimEvent*>(buffer);
+  // needed compatibility with the standard decoder. Kept for the MC truth
+  // lookups (GetSBSMCHitInfo etc.) until the next event.
+  fSimEvent = reinterpret_cast<const TSBSSimEvent*>(buffer);
+  const TSBSSimEvent* simEvent = fSimEvent;
+  if( !simEvent ) {
+    // e.g. TSBSSimFile after the end of its input
+    Error( here, "No event buffer" );
+    return HED_ERR;
+  }
+
+  // Events read with TSBSSimFile are already in the current strip layout.
+  // Upgrade old ones coming from elsewhere (the buffer is the input event).
+  if( simEvent->HasOldStrips() )
+    const_cast<TSBSSimEvent*>(simEvent)->UpgradeStrips();
  
   /* 
   cout<<simEvent->fGEMClust.size()<<endl;getchar();
@@ -546,6 +651,7 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
     if( (ret = init_slotdata(fMap)) != HED_OK)
 #endif
       return ret;
+    InitReadoutROC();
     first_decode = false;
   }
 
@@ -570,40 +676,39 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
   if( fDoBench ) fBench->Begin("physics_decode");
 
   // Decode the digitized strip data.  Populate crateslot array.
-  for( vector<TSBSSimEvent::DigiGEMStrip>::size_type i = 0;
-       i < simEvent->fGEMStrips.size(); i++) {
-    //cout << "i " << i << endl;
-    const TSBSSimEvent::DigiGEMStrip& s = simEvent->fGEMStrips[i];
-    Int_t crate, slot, chan;
-    //cout << "striptoroc: " << endl;
-    //StripToROC( s.fPlane, s.fSector, s.fProj, s.fChan, crate, slot, chan );
-    StripToROCD( s.fPlane, s.fModule, s.fProj, s.fChan, crate, slot, chan );
-    //cout<<"Plane: "<<s.fPlane<<" Module:  "<<s.fModule<<" projection:  "<<s.fProj<<" channel:  "<<s.fChan<<" sigType: "<<s.fSigType<<endl;
-    //cout << "crate = " << crate << ", slot = " << slot << ", chan " << chan << endl;getchar();
-    //cout << "samples: " << endl;
-    for( Int_t k = 0; k < s.fNsamp; k++ ) { 
-      Int_t raw = s.fADC[k];
-      //cout << raw << " ### ";
-      
-      if( crateslot[idx(crate,slot)]->loadData("adc",chan,raw,raw) == SD_ERR )
+  // The hardware address comes from the table of InitReadoutROC, and all
+  // the samples of a strip go to the same slot.
+  if( fDoBench ) fBench->Begin("load_strips");
+  const Int_t nchan = fManager->GetChanPerSlot();
+  const Int_t nplanes = fManager->GetNGEMPlane();
+  for( vector<TSBSSimEvent::GEMStrip>::size_type i = 0;
+       i < simEvent->fDigiStrips.size(); i++) {
+    const TSBSSimEvent::GEMStrip& s = simEvent->fDigiStrips[i];
+    Int_t crate, slot, chan, slotidx;
+    if( s.fPlane >= 0 && s.fPlane < nplanes &&
+	s.fModule >= 0 && s.fModule < fMaxModules &&
+	(s.fProj == 0 || s.fProj == 1) ) {
+      const ReadoutROC_t& r = fReadoutROC[(s.fPlane*fMaxModules+s.fModule)*2+s.fProj];
+      crate = r.crate;
+      slot = r.slot;
+      slotidx = r.slotidx;
+      chan = ( s.fChan >= 0 && s.fChan < nchan ) ? s.fChan : s.fChan % nchan;
+    } else {
+      StripToROCD( fManager, s.fPlane, s.fModule, s.fProj, s.fChan, crate, slot, chan );
+      slotidx = idx(crate,slot);
+    }
+    const Int_t* adc = s.fNsamp > 0 ? &simEvent->fStripADC[s.fADCBegin] : 0;
+    for( Int_t k = 0; k < s.fNsamp; k++ ) {
+      if( crateslot[slotidx]->loadData("adc",chan,adc[k],adc[k]) == SD_ERR ) {
+	if( fDoBench ) fBench->Stop("load_strips");
 	return HED_ERR;
+      }
     }
-    //    cout << endl<<endl;
-    //cout << "stripmap : " << endl;
     // Build map from ROC address to strip index. This is needed to extract
     // the MC truth info later in the tracking detector decoder via GetMCChanInfo.
-#ifndef NDEBUG
-    pair<StripMap_t::const_iterator,bool> ins =
-#endif
-      fStripMap.insert( make_pair( MakeROCKey(crate,slot,chan), i ) );
-    //cout<<crate<<" "<<slot<<" "<<chan<<endl;
-    // cout<<MakeROCKey(crate,slot,chan)<<endl;
-    // getchar();
-    
-    // cout << "ROC key inserted in strip map " << endl;
-    //  cout << "ins.second ? " << ins.second << endl;
-    assert( ins.second );
+    SetStripIndex( crate, slot, chan, i );
   }
+  if( fDoBench ) fBench->Stop("load_strips");
   
   // Create lists of two types of tracks:
   // 1) Physics tracks, as generated at the target
@@ -611,7 +716,19 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 
   // Physics tracks. We need to copy them here so we can export them as global
   // variables.
-  TClonesArray* tracks = simEvent->fMCTracks;
+  // The MC truth is needed only for these variables (unless turned off with
+  // SetMCTruth(false)) and for the calorimeter emulation. If it is stored
+  // apart from the digitized data, it is read only then.
+  if( !fMCTruth && !fManager->DoCalo() )
+    return HED_OK;
+  const TSBSSimEvent* truth = simEvent->GetTruth();
+  if( fMCTruth ) {
+    // MC truth of the strips, for the tracking detectors
+    if( fDoBench ) fBench->Begin("strip_truth");
+    BuildStripTruth();
+    if( fDoBench ) fBench->Stop("strip_truth");
+  }
+  TClonesArray* tracks = truth->fMCTracks;
   assert( tracks );
 
   double trkProjCaloX, trkProjCaloY;
@@ -656,13 +773,13 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
   Int_t best_primary = -1, best_primary_plane = fManager->GetNChamber(), primary_sector = -1;
   UInt_t primary_hitbits = 0, ufail = 0, vfail = 0;
   for( vector<TSBSSimEvent::GEMCluster>::size_type i = 0;
-       i < simEvent->fGEMClust.size(); ++i ) {
-    const TSBSSimEvent::GEMCluster& c = simEvent->fGEMClust[i];
+       i < truth->fGEMClust.size(); ++i ) {
+    const TSBSSimEvent::GEMCluster& c = truth->fGEMClust[i];
 
     if( c.fPlane < 0 || c.fPlane >= fManager->GetNChamber() ) {
       Error( here, "Illegal plane number = %d in cluster. "
 	     "Should never happen. Call expert.", c.fPlane );
-      simEvent->Print("clust");
+      truth->Print("clust");
       return HED_FATAL;
     }
 
@@ -727,13 +844,9 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
   // (ensured above). If that is no longer so one day, fMCPoints will need to
   // be sorted by track number as well, and the algo below needs to be changed.
   fMCPoints->Sort();
-  Double_t mass = 0;
   TSBSSimTrack* trk = static_cast<TSBSSimTrack*>(fMCTracks->UncheckedAt(0));
   assert(trk);
-  if( TParticlePDG* particle = TDatabasePDG::Instance()->GetParticle(trk->fPID) )
-    mass = particle->Mass();
-  else
-    Warning( "LoadEvent", "No enrty in PDG database for PID = %d", trk->fPID );
+  Double_t mass = GetParticleMass( trk->fPID );
 
   MCTrackPoint* prev_pt = 0;
   for( Int_t i = 0; i < GetNMCPoints(); ++i ) {
@@ -764,7 +877,7 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
     assert( nback == 0 );
 
     TSBSSimBackTrack* btr = new( (*fBackTracks)[nback] )
-      TSBSSimBackTrack(simEvent->fGEMClust[best_primary]);
+      TSBSSimBackTrack(truth->fGEMClust[best_primary]);
 
     //cout << "Backtrack primary hitbits " << primary_hitbits << endl;
     
@@ -803,12 +916,10 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 	double pp, thetap, phip;
 		
 	double xtar, ytar, xptar, yptar;
-	double fterm;
 	double xfp, yfp, xpfp, ypfp;
 	double x_S_2, y_S_2;
 
-	vector<double> xfinal,yfinal,zfinal,wxfinal,wyfinal;
-	double eX, eY, eXp, eYp;
+	TSBSLineFit efitx, efity; // electron track x(z), y(z), with covariances
 	
 	double vz;
 	
@@ -926,6 +1037,9 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 	    vz = find_vertex_bin(trk->vertex_target.Z());//
 	    vertex = TVector3(0.0, 0.0, vz);
 	    
+	    fFitX.clear(); fFitY.clear(); fFitZ.clear();
+	    fFitWX.clear(); fFitWY.clear();
+	    
 	    kpx_xc = z_earm[0]*sin(th_earm)+xECal*cos(th_earm);
 	    kpy_xc = yECal - yoff_ECAL;
 	    kpz_xc = vz+z_earm[0]*cos(th_earm)-xECal*sin(th_earm);
@@ -942,14 +1056,14 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 				    vertex.Dot(ECAL_yaxis),
 				    vertex.Dot(ECAL_zaxis) );
 	    
-	    xfinal.push_back( vertex_ECAL.X() );
-	    yfinal.push_back( vertex_ECAL.Y() );
-	    zfinal.push_back( vertex_ECAL.Z() );
+	    fFitX.push_back( vertex_ECAL.X() );
+	    fFitY.push_back( vertex_ECAL.Y() );
+	    fFitZ.push_back( vertex_ECAL.Z() );
 	    
 	    // wxfinal.push_back( pow( sigvtx_ECAL.X(), -2 ) );
 	    // wyfinal.push_back( pow( sigvtx_ECAL.Y(), -2 ) );
-	    wxfinal.push_back( pow( 0.001, -2 ) );
-	    wyfinal.push_back( pow( 0.001, -2 ) );
+	    fFitWX.push_back( pow( 0.001, -2 ) );
+	    fFitWY.push_back( pow( 0.001, -2 ) );
 	    
 	    for(UInt_t j=0; j< simEvent->fScintClusters.size(); j++){
 	      const TSBSScintCluster& SciHit = simEvent -> fScintClusters[j];
@@ -960,25 +1074,27 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 	      //tempPlane = SciHit.GetPlane();
 	      //cout << "CDet plane " << SciHit.GetPlane() << ": X = " << SciHit.GetXPos() << ", Y = " << SciHit.GetYPos() << endl;
 	      
-	      xfinal.push_back( SciHit.GetXPos() );
-	      yfinal.push_back( SciHit.GetYPos() - yoff_ECAL );
-	      zfinal.push_back( z_earm[SciHit.GetPlane()] );
+	      fFitX.push_back( SciHit.GetXPos() );
+	      fFitY.push_back( SciHit.GetYPos() - yoff_ECAL );
+	      fFitZ.push_back( z_earm[SciHit.GetPlane()] );
 	      
-	      wxfinal.push_back( pow( Lx_scint_CDET, -2 ) );
-	      wyfinal.push_back( pow( sigy_CDET, -2 ) );
+	      fFitWX.push_back( pow( Lx_scint_CDET, -2 ) );
+	      fFitWY.push_back( pow( sigy_CDET, -2 ) );
 	    }
-	    xfinal.push_back( xECal );
-	    yfinal.push_back( yECal - yoff_ECAL );
-	    zfinal.push_back( z_earm[0] );
+	    fFitX.push_back( xECal );
+	    fFitY.push_back( yECal - yoff_ECAL );
+	    fFitZ.push_back( z_earm[0] );
 	    
-	    wxfinal.push_back( pow( sigx_ECAL, -2 ) );
-	    wyfinal.push_back( pow( sigy_ECAL, -2 ) );
+	    fFitWX.push_back( pow( sigx_ECAL, -2 ) );
+	    fFitWY.push_back( pow( sigy_ECAL, -2 ) );
 	    
-	    Fit_3D_Track( xfinal, yfinal, zfinal, wxfinal, wyfinal,
-			  eX, eY, eXp, eYp );
+	    // No search region for this cluster if the electron track cannot be fit
+	    if( !Fit_3D_Track( &fFitX[0], &fFitY[0], &fFitZ[0], &fFitWX[0], &fFitWY[0],
+			       fFitX.size(), efitx, efity ) )
+	      continue;
 	    
 	    
-	    ehat_final_ECAL = TVector3( eXp, eYp, 1.0 );
+	    ehat_final_ECAL = TVector3( efitx.fUp, efity.fUp, 1.0 );
 	    ehat_final_ECAL = ehat_final_ECAL.Unit();
 	    
 	    ehat_final_global =
@@ -1033,29 +1149,8 @@ Int_t TSBSSimDecoder::DoLoadEvent(const Int_t* evbuffer )
 	    
 	    //xtar assumed to be 0... 
 	    //Calculate the optics
-	    for( int i_par=0; i_par<fManager->GetNOpticsTerms(); i_par++ ){
-	      // cout << i_par << " " << fManager->GetOpticsCoeff(0, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(1, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(2, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(3, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(8, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(7, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(6, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(5, i_par) << " "
-	      // 	   << fManager->GetOpticsCoeff(4, i_par) << " ";
-	      fterm = 
-		pow(xptar,fManager->GetOpticsCoeff(8, i_par))*
-		pow(yptar,fManager->GetOpticsCoeff(7, i_par))*
-		pow(ytar,fManager->GetOpticsCoeff(6, i_par))*
-		pow(1.0/pp,fManager->GetOpticsCoeff(5, i_par))*
-		pow(xtar,fManager->GetOpticsCoeff(4, i_par));
-	      //cout << fterm << endl;
-	      
-	      xfp += fterm * fManager->GetOpticsCoeff(0, i_par);//b_xfp
-	      yfp += fterm * fManager->GetOpticsCoeff(1, i_par);//b_yfp;
-	      xpfp += fterm * fManager->GetOpticsCoeff(2, i_par);//b_xpfp;
-	      ypfp += fterm * fManager->GetOpticsCoeff(3, i_par);//b_ypfp;
-	    }
+	    fManager->GetOptics().Eval( xptar, yptar, ytar, 1.0/pp, xtar,
+					xfp, yfp, xpfp, ypfp );
 	    
 	    /*
 	    cout << "xfp_true " << trk->fOrigin.X()*1.e-3+1.819555*trk->fMomentum.X()/trk->fMomentum.Z()  
@@ -1263,7 +1358,7 @@ Int_t TSBSSimBackTrack::Update( const TSBSSimEvent::GEMCluster& c )
   // }
 
   if( c.fPlane > 0 ) {
-    Double_t dz = c.fMCpos.Z() - fManager->GetZ0();
+    Double_t dz = c.fMCpos.Z() - TSBSDBManager::GetInstance()->GetZ0();
     if( dz <= 0 ) {
       Error( here, "Illegal fMCpos z-coordinate in plane = %d. "
 	     "Should never happen. Call expert.", c.fPlane );
@@ -1305,76 +1400,15 @@ void TSBSSimDecoder::Calc_Shower_Coordinates( double xmom, double ymom, double x
   //calculate longitudinal depth of max. shower energy deposition
   double tmax = TMath::Max(0.0, X0_ECAL * (log( Eclust/Ec_ECAL ) - 0.5) );
 
-  int binx = int( (100.0*xmax-profx_xmin)/(profx_xmax-profx_xmin)*profx_nbins );
-
-  shower_profile_t proftemp;
-  if( binx >= 0 && binx < profx_nbins ){
-    proftemp = profx[binx];
-  } else {
-    proftemp = profxdefault;
-  }
-  
-  int binxmom = int( (xmom - proftemp.xmin)/(proftemp.xmax-proftemp.xmin) * proftemp.nbins_mom );
-
-  //set some sensible default value:
-  xclust = xmax + xmom*ECAL_max_cell_size; 
-  
-  //do linear interpolation within the bin:
-  if( binxmom < 0 ){
-    xclust = xmax - 0.5 * ECAL_max_cell_size;
-    //xf = -0.5*ECAL_max_cell_size;
-  } else if( binxmom < proftemp.nbins_mom ){
-    double binwidth = (proftemp.xmax-proftemp.xmin)/double(proftemp.nbins_mom);
-    double flo = proftemp.frac[binxmom];
-    double fhi = proftemp.frac[binxmom+1];
-    
-    double xlo = proftemp.xmin + binxmom * binwidth;
-    //double xhi = xlo + binwidth;
-    //linear interpolation within the bin:
-    double f = flo + (fhi-flo) * (xmom-xlo)/binwidth;
-    xclust = xmax + (f - 0.5)*ECAL_max_cell_size;
-
-    // xf = xclust-xmax;
-    //cout << "xmom, binxmom, f = " << xmom << ", " << binxmom << ", " << f << endl;
-  } else {
-    xclust = xmax + 0.5 * ECAL_max_cell_size;
-    
-  }
-
-  //before incident-angle correction, record x position within cell:
-  //xf = xclust-xmax;
-  
-  int biny = int( (100.0*ymax-profy_ymin)/(profy_ymax-profy_ymin)*profy_nbins );
-
-  if( biny >= 0 && biny < profy_nbins ){
-    proftemp = profy[biny];
-  } else {
-    proftemp = profydefault;
-  }
-
-  int binymom = int( (ymom - proftemp.xmin)/(proftemp.xmax-proftemp.xmin) * proftemp.nbins_mom );
-
-  yclust = ymax + ymom*ECAL_max_cell_size;
-
-  if( binymom < 0 ){
-    yclust = ymax - 0.5 * ECAL_max_cell_size;
-  } else if( binymom < proftemp.nbins_mom ){
-    double binwidth = (proftemp.xmax-proftemp.xmin)/double(proftemp.nbins_mom);
-    double flo = proftemp.frac[binymom];
-    double fhi = proftemp.frac[binymom+1];
-    
-    double ylo = proftemp.xmin + binymom * binwidth;
-    //double xhi = xlo + binwidth;
-    //linear interpolation within the bin:
-    double f = flo + (fhi-flo) * (ymom-ylo)/binwidth;
-    yclust = ymax + (f - 0.5)*ECAL_max_cell_size;
-
-    //cout << "ymom, biny, binymom, f = " << ymom << ", " << biny << "," <<  binymom << ", " << f << endl;
+  //position within the cell of the max block from the shower profiles
+  //(sensible default value without them):
+  if( fShowerProfile ){
+    xclust = xmax + fShowerProfile->GetX( xmom, xmax )*ECAL_max_cell_size;
+    yclust = ymax + fShowerProfile->GetY( ymom, ymax )*ECAL_max_cell_size;
   } else {
-    yclust = ymax + 0.5 * ECAL_max_cell_size;
+    xclust = xmax + xmom*ECAL_max_cell_size;
+    yclust = ymax + ymom*ECAL_max_cell_size;
   }
-
-  //yf = yclust-ymax;
   
   //Apply incident-angle correction under the assumption that track starts at (x,y,z) = (0,0,0)
   double xptemp = xclust/Rcal;
@@ -1388,205 +1422,11 @@ void TSBSSimDecoder::Calc_Shower_Coordinates( double xmom, double ymom, double x
   return;
 }
 
-
+//-----------------------------------------------------------------------------
 bool TSBSSimDecoder::load_shower_profiles( const char *filename ){
-  ifstream fshower(filename);
-
-  TString currentfile;
-  
-  currentfile.ReadFile( fshower );
-  
-  //Now the whole file is loaded into the TString:
-
-  int istart, istop, length;
-
-  std::istringstream sstream_temp;
-  
-  TString stemp,substrtemp;
-  stemp = "ECAL_shower_profile_x_default";
-
-  //Read to the next newline character:
-  istart = currentfile.Index(stemp);
-  istop = currentfile.Index( '\n', istart ); 
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  substrtemp = TString(currentfile(istart,istop-istart));
-
-  //cout << "'" << substrtemp << "'" << endl;
-
-  substrtemp.ReplaceAll(stemp,"");
-
-  //cout << "'" << substrtemp << "'" << endl;
-
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  //extract number of bins and min and max moment value for default x profile:
-  sstream_temp >> profxdefault.nbins_mom >> profxdefault.xmin >> profxdefault.xmax;
-
-  istart = istop;
-  istop = currentfile.Index( "ECAL_shower_profile", istart ); //returns position of next header
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  //Grab profile data:
-  substrtemp = TString(currentfile(istart+1,istop-istart-1));
-
-  //cout << "'" << substrtemp << "'" << endl;
-  //for( int bin=0; bin<=profxdefault.nbins_mom; bin++ ){
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  profxdefault.frac.resize(profxdefault.nbins_mom+1);
-
-  //extract bin contents from profile data:
-  for( int bin=0; bin<=profxdefault.nbins_mom; bin++ ){
-    sstream_temp >> profxdefault.frac[bin];
-    //cout << "bin, frac = " << bin << ", " << profxdefault.frac[bin] << endl;
-  }
-
-  //Do the same for the default y profile:
-  stemp = "ECAL_shower_profile_y_default";
-
-  
-  
-  istart = currentfile.Index(stemp);
-  istop = currentfile.Index( '\n', istart ); 
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  substrtemp = TString(currentfile(istart,istop-istart));
-
-  //cout << "'" << substrtemp << "'" << endl;
-
-  substrtemp.ReplaceAll(stemp,"");
-
-  //cout << "'" << substrtemp << "'" << endl;
-
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  sstream_temp >> profydefault.nbins_mom >> profydefault.xmin >> profydefault.xmax;
-
-  istart = istop;
-  istop = currentfile.Index( "ECAL_shower_profile", istart ); //returns position of next header
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  substrtemp = TString(currentfile(istart+1,istop-istart-1));
-
-  //cout << "'" << substrtemp << "'" << endl;
-  //for( int bin=0; bin<=profxdefault.nbins_mom; bin++ ){
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  profydefault.frac.resize(profydefault.nbins_mom+1);
-    
-  for( int bin=0; bin<=profydefault.nbins_mom; bin++ ){
-    sstream_temp >> profydefault.frac[bin];
-    //cout << "bin, frac = " << bin << ", " << profxdefault.frac[bin] << endl;
-  }
-
-  //Now read x-dependent x profiles and y-dependent y profiles:
-  stemp = "ECAL_shower_profiles_x";
-
-  istart = currentfile.Index( stemp );
-  istop = currentfile.Index('\n',istart);
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  substrtemp = TString(currentfile(istart,istop-istart));
-
-  substrtemp.ReplaceAll(stemp,"");
-
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  sstream_temp >> profx_nbins >> profx_xmin >> profx_xmax;
-
-  profx.resize( profx_nbins );
-  
-  for( int xbin=0; xbin<profx_nbins; xbin++ ){
-    stemp.Form("ECAL_shower_profile_x_bin %d",xbin+1);
-    istart = currentfile.Index(stemp);
-    istop = currentfile.Index('\n',istart);
-
-    if( istop < 0 ) istop = currentfile.Length()-1;
-    
-    substrtemp = TString(currentfile(istart,istop-istart));
-    substrtemp.ReplaceAll(stemp,"");
-
-    sstream_temp = std::istringstream(substrtemp.Data());
-
-    sstream_temp >> profx[xbin].nbins_mom >> profx[xbin].xmin >> profx[xbin].xmax;
-
-    istart = istop;
-    istop = currentfile.Index("ECAL",istart);
-
-    if( istop < 0 ) istop = currentfile.Length()-1;
-    
-    substrtemp = TString(currentfile(istart+1,istop-istart-1));
-
-    sstream_temp = std::istringstream(substrtemp.Data());
-
-    profx[xbin].frac.resize(profx[xbin].nbins_mom+1);
-
-    for( int bin=0; bin<=profx[xbin].nbins_mom; bin++ ){
-      sstream_temp >> profx[xbin].frac[bin];
-
-      //cout << "xbin, bin, frac = " << xbin << ", " << bin << ", " << profx[xbin].frac[bin] << endl;
-    }
-  }
-
-  ///y-dependent y profiles:
-  stemp = "ECAL_shower_profiles_y";
-
-  istart = currentfile.Index( stemp );
-  istop = currentfile.Index('\n',istart);
-
-  if( istop < 0 ) istop = currentfile.Length()-1;
-  
-  substrtemp = TString(currentfile(istart,istop-istart));
-
-  substrtemp.ReplaceAll(stemp,"");
-
-  sstream_temp = std::istringstream(substrtemp.Data());
-
-  sstream_temp >> profy_nbins >> profy_ymin >> profy_ymax;
-
-  profy.resize( profy_nbins );
-  
-  for( int ybin=0; ybin<profy_nbins; ybin++ ){
-    stemp.Form("ECAL_shower_profile_y_bin %d",ybin+1);
-    istart = currentfile.Index(stemp);
-    istop = currentfile.Index('\n',istart);
-
-    if( istop < 0 ) istop = currentfile.Length()-1;
-    
-    substrtemp = TString(currentfile(istart,istop-istart));
-    substrtemp.ReplaceAll(stemp,"");
-
-    sstream_temp = std::istringstream(substrtemp.Data());
-
-    sstream_temp >> profy[ybin].nbins_mom >> profy[ybin].xmin >> profy[ybin].xmax;
-
-    istart = istop;
-    istop = currentfile.Index("ECAL",istart);
-
-    //cout << "ybin, istop = " << ybin << ", " << istop << endl;
-
-    if( istop < 0 ) istop = currentfile.Length()-1;
-    
-    substrtemp = TString(currentfile(istart+1,istop-istart-1));
-
-    sstream_temp = std::istringstream(substrtemp.Data());
-
-    profy[ybin].frac.resize(profy[ybin].nbins_mom+1);
-
-    for( int bin=0; bin<=profy[ybin].nbins_mom; bin++ ){
-      sstream_temp >> profy[ybin].frac[bin];
-
-      //cout << "ybin, bin, frac = " << ybin << ", " << bin << ", " << profy[ybin].frac[bin] << endl;
-    }
-  }
-  
-  return true;
+  // The profiles are read once per file and shared by all decoders
+  fShowerProfile = TSBSShowerProfile::Get( filename );
+  return ( fShowerProfile != 0 );
 }
 
 /*
@@ -1790,67 +1630,20 @@ void find_ECAL_clusters( gep_tree_with_spin *T, int &nclust, vector<double> &xcl
 */
 
 //-----------------------------------------------------------------------------
-void TSBSSimDecoder::Fit_3D_Track( vector<double> xpoints, vector<double> ypoints, vector<double> zpoints, vector<double> wx, vector<double> wy,
-		   double &X, double &Y, double &Xp, double &Yp ){
-
-  //Setting up the matrices for the fit:
-  
-  TMatrixD A(4,4);
-  TVectorD b(4);
-
-  for( int i=0; i<4; i++ ){
-    for( int j=0; j<4; j++ ){
-      A(i,j) = 0.0;
-    }
-    b(i) = 0.0;
-  }
-
-  int npoints = xpoints.size();
-
-  if( npoints<2 ) return;
-
-  int ndf=0;
+bool TSBSSimDecoder::Fit_3D_Track( const double* xpoints, const double* ypoints,
+				   const double* zpoints, const double* wx,
+				   const double* wy, int npoints,
+				   TSBSLineFit& fitx, TSBSLineFit& fity ){
 
   //For a 3D fit to a straight-line:
   // chi^2 = sum_i wxi * (xi- (X + Xp*zi))^2 + wyi*(y - (Y+Yp*zi))^2
-  // dchi^2/dX = -2 * (xi - (X+Xp*zi))* wxi = 0
-  // dchi^2/dY = -2 * (yi - (Y+Yp*zi))* wyi = 0
-  // dchi^2/dXp = -2 * (xi - (X+Xp*zi))*zi * wxi = 0
-  // dchi^2/dYp = -2 * (yi - (Y+Yp*zi))*zi * wyi = 0
-  for( int i=0; i<npoints; i++ ){
-    b(0) += wx[i]*xpoints[i];
-    b(1) += wy[i]*ypoints[i];
-    b(2) += wx[i]*xpoints[i]*zpoints[i];
-    b(3) += wy[i]*ypoints[i]*zpoints[i];
-
-    A(0,0) += wx[i];
-    A(0,1) += 0.0;
-    A(0,2) += wx[i]*zpoints[i];
-    A(0,3) += 0.0;
-
-    A(1,0) += 0.0;
-    A(1,1) += wy[i];
-    A(1,2) += 0.0;
-    A(1,3) += wy[i]*zpoints[i];
-
-    A(2,0) += wx[i]*zpoints[i];
-    A(2,1) += 0.0;
-    A(2,2) += wx[i]*pow(zpoints[i],2);
-    A(2,3) += 0.0;
-
-    A(3,0) += 0.0;
-    A(3,1) += wy[i]*zpoints[i];
-    A(3,2) += 0.0;
-    A(3,3) += wy[i]*pow(zpoints[i],2);
-    
-  }
-
-  TVectorD solution = A.Invert() * b;
+  // The x and y parts are independent: two 2x2 weighted least-squares
+  // problems, solved in closed form (TSBSLineFit).
+  // X = fitx.fU, Xp = fitx.fUp, Y = fity.fU, Yp = fity.fUp, with their
+  // covariance matrices and chi2. Returns false if the fit fails (< 2 points).
 
-  X = solution(0);
-  Y = solution(1);
-  Xp = solution(2);
-  Yp = solution(3);
+  return ( fitx.Fit( zpoints, xpoints, wx, npoints ) &&
+	   fity.Fit( zpoints, ypoints, wy, npoints ) );
 }
 
 double TSBSSimDecoder::find_vertex_bin(double vz_true)
@@ -12,10 +12,11 @@
 #include "ha_compiledata.h"
 #include <cassert>
 #include <vector>
-#include <map>
 #include "TSBSDBManager.h"
 
 class THaCrateMap;
+class TSBSShowerProfile;
+class TSBSLineFit;
 
 // GEM MC truth information for digitized detector hits
 class TSBSMCHitInfo : public Podd::MCHitInfo 
@@ -44,6 +45,22 @@ class TSBSMCHitInfo : public Podd::MCHitInfo
   ClassDef(TSBSMCHitInfo,1)  // Generic Monte Carlo hit info
 };
 
+//-----------------------------------------------------------------------------
+// MC truth of one digitized GEM strip, tabulated for all the strips of the
+// event by TSBSSimDecoder (see GetStripTruth). The data of the clusters of
+// the strip are in the event truth: TSBSSimEvent::GetStripCluster etc.
+// for strip fDigiStrips[fStrip], cluster 0 ... fNClust-1.
+struct TSBSStripTruth {
+  Int_t    fMCTrack;    // Signal track number, 0 if none
+  Double_t fMCPos;      // Position of the signal (or mean background) hit
+  Double_t fMCTime;     // Time of the signal hit, else time of first sample
+  Double_t fMCCharge;   // Strip charge (0 for cross-talk only strips)
+  Int_t    fContam;     // Number of background clusters
+  Int_t    fSigType;    // Accumulated signal types of the strip
+  Int_t    fStrip;      // Index of the strip in the event
+  Int_t    fNClust;     // Number of clusters (0 for cross-talk only strips)
+};
+
 //-----------------------------------------------------------------------------
 // Helper classes for making decoded event data available via global variables
 
@@ -163,10 +180,19 @@ class TSBSSimDecoder : public Podd::SimDecoder {
   virtual Int_t DefineVariables( THaAnalysisObject::EMode mode =
 				 THaAnalysisObject::kDefine );
   TSBSMCHitInfo GetSBSMCHitInfo( Int_t crate, Int_t slot, Int_t chan ) const;
+  // MC truth of the strip of the given hardware channel, 0 if none.
+  // Cheaper than GetSBSMCHitInfo, which also copies the cluster data.
+  const TSBSStripTruth* GetStripTruth( Int_t crate, Int_t slot, Int_t chan ) const;
   std::vector<std::vector<Double_t> > GetAllMCHits() const;
   
   Int_t  GetNBackTracks() const { return fBackTracks->GetLast()+1; }
 
+  // Fill the MC truth global variables (tracks, hits, back tracks).
+  // If false, the MC truth is read only when needed otherwise
+  // (GetSBSMCHitInfo, calorimeter emulation).
+  void   SetMCTruth( Bool_t b = true ) { fMCTruth = b; }
+  Bool_t IsMCTruth() const { return fMCTruth; }
+
   TSBSSimBackTrack* GetBackTrack( Int_t i ) const {
     TObject* obj = fBackTracks->UncheckedAt(i);
     assert( dynamic_cast<TSBSSimBackTrack*>(obj) );
@@ -187,11 +213,31 @@ class TSBSSimDecoder : public Podd::SimDecoder {
 
 
 protected:
-  typedef std::map<Int_t,Int_t> StripMap_t;
-
   // Event-by-event data
   TClonesArray*   fBackTracks; //-> Primary particle tracks at first chamber
-  StripMap_t      fStripMap;   //! Map ROCKey -> index of corresponding strip
+  std::vector<Int_t> fStripIndex; //! ROCKey -> index of corresponding strip, -1 if none
+  std::vector<Int_t> fStripKeys;  //! ROCKeys set in fStripIndex in this event
+  // Hardware address of the strips of each (plane, module, readout),
+  // precomputed with the mapping of the database (see StripToROCD)
+  struct ReadoutROC_t {
+    Int_t crate;
+    Int_t slot;
+    Int_t slotidx;    // idx(crate,slot)
+  };
+  std::vector<ReadoutROC_t> fReadoutROC; //! [(plane*fMaxModules+module)*2+proj]
+  Int_t           fMaxModules; //! Modules per plane in fReadoutROC
+  Bool_t          fMCTruth;    // Fill the MC truth global variables
+
+  // The database is shared by all decoders and only read while decoding.
+  // Everything else DoLoadEvent uses is per instance, so several decoders
+  // can decode different events concurrently.
+  const TSBSDBManager* fManager; //! geometry and configuration
+  const TSBSSimEvent*  fSimEvent; //! event being decoded, for the MC truth lookups
+  Int_t           fPrimPID;    //! PID of the primary, for fPrimMass
+  Double_t        fPrimMass;   //! mass of the primary (GeV), from TDatabasePDG
+  // Points of the electron track fit (calorimeter emulation), reused
+  std::vector<Double_t> fFitX, fFitY, fFitZ, fFitWX, fFitWY; //!
+  Double_t GetParticleMass( Int_t pid );
 
 #if ANALYZER_VERSION_CODE >= 67072  // ANALYZER_VERSION(1,6,0)
   Int_t DoLoadEvent( const UInt_t* evbuffer );
@@ -202,36 +248,29 @@ protected:
   // void  StripToROC( Int_t s_plane, Int_t s_sector, Int_t s_proj, Int_t s_chan,
   //		    Int_t& crate, Int_t& slot, Int_t& chan ) const;
   Int_t StripFromROC( Int_t crate, Int_t slot, Int_t chan ) const;
+  void  SetStripIndex( Int_t crate, Int_t slot, Int_t chan, Int_t istrip );
+  void  InitReadoutROC();
   // Int_t MakeROCKey( Int_t crate, Int_t slot, Int_t chan ) const;
   
   std::vector<SignalInfo> fSignalInfo;
 
+  // MC truth of the strips of the event, built once per event: in
+  // DoLoadEvent if the MC truth is loaded anyway (fMCTruth), else on
+  // the first GetStripTruth/GetSBSMCHitInfo
+  mutable std::vector<TSBSStripTruth> fStripTruth; //! [strip]
+  mutable std::vector<Int_t> fClustSignal; //! [cluster] index in fSignalInfo, -1 if none
+  mutable Bool_t  fStripTruthDone; //! fStripTruth is up to date
+  void  BuildStripTruth() const;
+
 // all the following stuff is for the ECal cluster correction
 
 
-public:
-  struct shower_profile_t {
-    int nbins_mom;
-    double xmin;
-    double xmax;
-    std::vector<double> frac;
-  };
-
-  
 private: 
   
-  shower_profile_t profxdefault;
-  shower_profile_t profydefault;
-
-  int profx_nbins;
-  int profy_nbins;
-  double profx_xmin,profx_xmax;
-  double profy_ymin,profy_ymax;
-  std::vector<shower_profile_t> profx;
-  std::vector<shower_profile_t> profy;
+  const TSBSShowerProfile* fShowerProfile; //! shared, see load_shower_profiles
   
   void Calc_Shower_Coordinates(double xmom, double ymom, double xmax, double ymax, double Eclust, double Rcal, double &xclust, double &yclust);//, double &xf, double &yf
-  void Fit_3D_Track( std::vector<double> xpoints, std::vector<double> ypoints, std::vector<double> zpoints, std::vector<double> wx, std::vector<double> wy, double &X, double &Y, double &Xp, double &Yp );
+  bool Fit_3D_Track( const double* xpoints, const double* ypoints, const double* zpoints, const double* wx, const double* wy, int npoints, TSBSLineFit& fitx, TSBSLineFit& fity );
   bool load_shower_profiles( const char *filename );
   double find_vertex_bin(double vz_true);
   
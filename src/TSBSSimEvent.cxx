@@ -12,6 +12,7 @@
 #include "TClonesArray.h"
 #include "TString.h"
 #include "TMath.h"
+#include "TTree.h"
 
 #include <iostream>
 
@@ -110,14 +111,15 @@ TSBSScintCluster::TSBSScintCluster(int plane, double E, double Xpos, double Ypos
 //-----------------------------------------------------------------------------
 TSBSSimEvent::TSBSSimEvent()
   : fRunID(0), fEvtID(0), fWeight(1.), fMCTracks(0), fNSignal(0),
-    fSectorsMapped(false), fSignalSector(0)
+    fSectorsMapped(false), fSignalSector(0),
+    fTruthTree(0), fTruthEvent(0), fTruthEntry(-1)
 {
 }
 
 //-----------------------------------------------------------------------------
 TSBSSimEvent::TSBSSimEvent( UInt_t ntracks )
   : fRunID(0), fEvtID(0), fWeight(1.), fNSignal(0), fSectorsMapped(false),
-    fSignalSector(0)
+    fSignalSector(0), fTruthTree(0), fTruthEvent(0), fTruthEntry(-1)
 {
   if( ntracks == 0 ) ntracks = 1;
   fMCTracks = new TClonesArray( "TSBSSimTrack", ntracks );
@@ -153,6 +155,11 @@ void TSBSSimEvent::Clear( Option_t* opt )
   fNSignal = 0;
   fGEMClust.clear();
   fGEMStrips.clear();
+  fDigiStrips.clear();
+  fStripADC.clear();
+  fStripClust.clear();
+  fStripClustWeight.clear();
+  fStripClustADC.clear();
  
   if( sopt.Contains("all",TString::kIgnoreCase) ) {
     fECalClusters.clear();   
@@ -163,6 +170,149 @@ void TSBSSimEvent::Clear( Option_t* opt )
   }
 }
 
+//-----------------------------------------------------------------------------
+void TSBSSimEvent::Copy( TObject& obj ) const
+{
+  // Copy this event into obj, a TSBSSimEvent, including the MC tracks.
+  // The buffers of obj are reused. The MC truth source is not copied.
+
+  TObject::Copy(obj);
+  TSBSSimEvent& ev = static_cast<TSBSSimEvent&>(obj);
+
+  ev.fRunID         = fRunID;
+  ev.fEvtID         = fEvtID;
+  ev.fWeight        = fWeight;
+  ev.fNSignal       = fNSignal;
+  ev.fSectorsMapped = fSectorsMapped;
+  ev.fSignalSector  = fSignalSector;
+  ev.fGEMClust         = fGEMClust;
+  ev.fGEMStrips        = fGEMStrips;
+  ev.fDigiStrips       = fDigiStrips;
+  ev.fStripADC         = fStripADC;
+  ev.fStripClust       = fStripClust;
+  ev.fStripClustWeight = fStripClustWeight;
+  ev.fStripClustADC    = fStripClustADC;
+  ev.fECalClusters     = fECalClusters;
+  ev.fScintClusters    = fScintClusters;
+
+  if( ev.fMCTracks ) {
+    ev.fMCTracks->Clear();
+  }
+  if( ev.fMCTracks && fMCTracks ) {
+    for( Int_t i = 0; i < GetNtracks(); i++ ) {
+      const TSBSSimTrack* trk =
+	static_cast<const TSBSSimTrack*>( fMCTracks->UncheckedAt(i) );
+      new( (*ev.fMCTracks)[i] ) TSBSSimTrack(*trk);
+    }
+  }
+  ev.fTruthTree  = 0;
+  ev.fTruthEvent = 0;
+  ev.fTruthEntry = -1;
+}
+
+//-----------------------------------------------------------------------------
+void TSBSSimEvent::UpgradeStrips()
+{
+  // Move the strips of the old layout (fGEMStrips, class version <= 5)
+  // to the flat arrays. Missing cluster weights and ratios are set to zero.
+
+  if( fGEMStrips.empty() )
+    return;
+
+  fDigiStrips.reserve( fDigiStrips.size()+fGEMStrips.size() );
+  for( vector<DigiGEMStrip>::const_iterator is = fGEMStrips.begin();
+       is != fGEMStrips.end(); ++is ) {
+    const DigiGEMStrip& o = *is;
+    GEMStrip s;
+    s.fSector  = o.fSector;
+    s.fPlane   = o.fPlane;
+    s.fModule  = o.fModule;
+    s.fProj    = o.fProj;
+    s.fChan    = o.fChan;
+    s.fSigType = o.fSigType;
+    s.fCharge  = o.fCharge;
+    s.fTime1   = o.fTime1;
+    s.fNsamp   = TMath::Min( o.fNsamp, (UShort_t)MC_MAXSAMP );
+    s.fNClust  = o.fClusters.GetSize();
+    s.fADCBegin   = fStripADC.size();
+    s.fClustBegin = fStripClust.size();
+    s.fRatioBegin = fStripClustADC.size();
+
+    fStripADC.insert( fStripADC.end(), o.fADC, o.fADC+s.fNsamp );
+    for( Int_t i = 0; i < s.fNClust; i++ ) {
+      fStripClust.push_back( o.fClusters[i] );
+      fStripClustWeight.push_back( i < o.fStripWeightInCluster.GetSize() ?
+				   o.fStripWeightInCluster[i] : 0. );
+    }
+    for( Int_t k = 0; k < s.fNsamp; k++ ) {
+      const TArrayI& r = o.fClusterRatio[k];
+      for( Int_t i = 0; i < s.fNClust; i++ )
+	fStripClustADC.push_back( i < r.GetSize() ? r[i] : 0 );
+    }
+    fDigiStrips.push_back(s);
+  }
+  fGEMStrips.clear();
+}
+
+//-----------------------------------------------------------------------------
+const TSBSSimEvent* TSBSSimEvent::GetTruth() const
+{
+  // Return the event holding the MC truth of this event. If the truth
+  // is in a separate tree, read it now unless already done.
+  // If it cannot be read, return this event, whose truth was split off
+  // and is empty, and do not try again for this event.
+
+  if( !fTruthTree || !fTruthEvent )
+    return this;
+
+  if( fTruthTree->GetReadEntry() != fTruthEntry ) {
+    if( fTruthTree->GetEntry(fTruthEntry) <= 0 ) {
+      Error( "GetTruth", "Cannot read MC truth entry %lld", fTruthEntry );
+      fTruthEvent->Clear("all");
+      fTruthTree = 0;
+      fTruthEvent = 0;
+      return this;
+    }
+    else if( fTruthEvent->fEvtID != fEvtID ) {
+      Warning( "GetTruth", "MC truth for event %d found with event %d. "
+	       "Truth tree out of sync?", fEvtID, fTruthEvent->fEvtID );
+    }
+  }
+  return fTruthEvent;
+}
+
+//-----------------------------------------------------------------------------
+void TSBSSimEvent::MoveTruthTo( TSBSSimEvent& ev )
+{
+  // Move the MC truth (MC tracks, clusters and cluster data of the strips)
+  // of this event to ev. The truth previously in ev is dropped.
+
+  ev.fGEMClust.clear();
+  ev.fGEMClust.swap(fGEMClust);
+  ev.fStripClust.clear();
+  ev.fStripClust.swap(fStripClust);
+  ev.fStripClustWeight.clear();
+  ev.fStripClustWeight.swap(fStripClustWeight);
+  ev.fStripClustADC.clear();
+  ev.fStripClustADC.swap(fStripClustADC);
+  if( fMCTracks && ev.fMCTracks ) {
+    ev.fMCTracks->Clear();
+    ev.fMCTracks->AbsorbObjects(fMCTracks);
+  }
+}
+
+//-----------------------------------------------------------------------------
+TString TSBSSimEvent::GetTruthFileName( const char* filename )
+{
+  // Name of the separate MC truth file of a digitized file:
+  // "digitized.root" -> "digitized_mctruth.root"
+
+  TString s(filename);
+  if( s.EndsWith(".root") )
+    s.Remove(s.Length()-5);
+  return s + "_mctruth.root";
+}
+
 //-----------------------------------------------------------------------------
 Int_t TSBSSimEvent::GetNtracks() const
 {
@@ -179,7 +329,7 @@ void TSBSSimEvent::Print( Option_t* opt ) const
   cout << ">>>>> =====================================" << endl;
   cout << "Event number:               " << fEvtID << endl;
   cout << "Number of hits:             " << fGEMClust.size()   << endl;
-  cout << "Number of fired GEM strips: " << fGEMStrips.size()  << endl;
+  cout << "Number of fired GEM strips: " << GetNstrips()  << endl;
 
   TString sopt(opt);
   bool do_all    = sopt.Contains("all",   TString::kIgnoreCase);
@@ -224,9 +374,9 @@ void TSBSSimEvent::Print( Option_t* opt ) const
 
   if( do_hit ) {
     UInt_t i = 0;
-    for( vector<DigiGEMStrip>::const_iterator is = fGEMStrips.begin();
-	 is != fGEMStrips.end(); ++is ) {
-      const DigiGEMStrip& s = *is;
+    for( vector<GEMStrip>::const_iterator is = fDigiStrips.begin();
+	 is != fDigiStrips.end(); ++is ) {
+      const GEMStrip& s = *is;
       cout << "strip = " << i++
 	   << ", sect = "   << s.fSector
 	   << ", plane = "  << s.fPlane
@@ -236,13 +386,13 @@ void TSBSSimEvent::Print( Option_t* opt ) const
 	   << ", chrg = "   << s.fCharge
 	   << ", adc = ";
       for( int k=0; k<s.fNsamp; k++ ) {
-	cout << s.fADC[k];
+	cout << GetStripADC(s,k);
 	if( k+1 != s.fNsamp ) cout << ", ";
       }
       cout << ", hits = ";
-      for( Int_t isc = 0; isc < s.fClusters.GetSize(); isc++ ) {
-	cout << s.fClusters[isc];
-	if( isc+1 != s.fClusters.GetSize() ) cout << ", ";
+      for( Int_t isc = 0; isc < s.fNClust; isc++ ) {
+	cout << GetStripCluster(s,isc);
+	if( isc+1 != s.fNClust ) cout << ", ";
       }
       cout << endl;
     }
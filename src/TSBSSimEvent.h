@@ -17,9 +17,11 @@
 #include "TArrayS.h"
 #include "TArrayI.h"
 #include "TArrayD.h"
+#include "TString.h"
 #include <vector>
 
 class TClonesArray;
+class TTree;
 
 //-----------------------------------------------------------------------------
 class TSBSSimTrack : public Podd::MCTrack {
@@ -128,6 +130,7 @@ class TSBSScintCluster : public TSBSECalCluster {
 #define MC_MAXSAMP 10
 
 #define treeName "digtree"
+#define truthTreeName "mctruth"
 #define eventBranchName "event"
 
 class TSBSSimEvent : public TObject {
@@ -137,13 +140,14 @@ public:
   virtual ~TSBSSimEvent();
 
   virtual void Clear( Option_t* opt="" );
+  virtual void Copy( TObject& obj ) const; // Deep copy into obj
   virtual void Print( Option_t* opt="" ) const;
   TSBSSimTrack* AddTrack( Int_t number, Int_t pid,
 			  const TVector3& vertex, const TVector3& momentum, 
 			  const TVector3& vertexAtTarget, const TVector3& momentumAtTarget);
 
   Int_t GetNclust()  const { return fGEMClust.size(); }
-  Int_t GetNstrips() const { return fGEMStrips.size(); }
+  Int_t GetNstrips() const { return fDigiStrips.size(); }
   Int_t GetNtracks() const;
 
   // Event identification
@@ -191,7 +195,8 @@ public:
 
   std::vector<GEMCluster> fGEMClust;  // All MC-generated clusters in the GEMs
 
-  // Digitized strip amplitude data
+  // Digitized strip amplitude data, layout of class versions <= 5.
+  // Only read from old files; converted by UpgradeStrips().
   struct DigiGEMStrip {
     Short_t   fSector;    // Sector number
     Short_t   fPlane;     // Plane number
@@ -210,12 +215,76 @@ public:
     TArrayD   fStripWeightInCluster;
   };
   
-  std::vector<DigiGEMStrip> fGEMStrips; // Digitized strip amplitudes of the GEMs
+  std::vector<DigiGEMStrip> fGEMStrips; // Digitized strips, old layout (empty in version >= 6)
+
+  // Digitized strip amplitude data. The samples and the cluster data of all
+  // the strips of the event are stored in the flat arrays below, each strip
+  // refers to its part of them.
+  struct GEMStrip {
+    Short_t   fSector;    // Sector number
+    Short_t   fPlane;     // Plane number
+    Short_t   fModule;    // Module number
+    Short_t   fProj;      // Readout coordinate ("x" = 0, "y" = 1)
+    Short_t   fChan;      // Channel number
+    Short_t   fSigType;   // Accumulated signal types (BIT(0) = signal)
+    Float_t   fCharge;    // Total charge in strip
+    Float_t   fTime1;     // Time of first sample
+                          //   relative to event start in target (TBC)
+    UShort_t  fNsamp;     // Number of ADC samples
+    UShort_t  fNClust;    // Number of clusters contributing to this strip
+    Int_t     fADCBegin;  // First sample in fStripADC
+    Int_t     fClustBegin;// First cluster in fStripClust/fStripClustWeight
+    Int_t     fRatioBegin;// First value in fStripClustADC (fNsamp*fNClust values)
+  };
+
+  std::vector<GEMStrip> fDigiStrips;      // Digitized strips of the GEMs
+  std::vector<Int_t>    fStripADC;        // ADC samples of all strips
+  std::vector<Short_t>  fStripClust;      // Cluster IDs contributing to the strips
+  std::vector<Double_t> fStripClustWeight;// Weight of the strip in these clusters
+  std::vector<Int_t>    fStripClustADC;   // ADC of each cluster per sample,
+                                          //   [sample][cluster] for each strip
+
+  // Strip data access
+  Int_t    GetStripADC( const GEMStrip& s, Int_t k ) const
+  { return fStripADC[s.fADCBegin+k]; }
+  Short_t  GetStripCluster( const GEMStrip& s, Int_t i ) const
+  { return fStripClust[s.fClustBegin+i]; }
+  Double_t GetStripClusterWeight( const GEMStrip& s, Int_t i ) const
+  { return fStripClustWeight[s.fClustBegin+i]; }
+  Int_t    GetStripClusterADC( const GEMStrip& s, Int_t k, Int_t i ) const
+  { return k < s.fNsamp ? fStripClustADC[s.fRatioBegin+k*s.fNClust+i] : 0; }
+
+  // Convert the strips read from a file with class version <= 5
+  // to the current layout. Does nothing for newer files.
+  Bool_t HasOldStrips() const { return !fGEMStrips.empty(); }
+  void   UpgradeStrips();
+
+  // The MC truth (fMCTracks, fGEMClust and the strip cluster arrays) may be
+  // written to a separate tree, entry by entry with the digitized events
+  // (see TSBSSimGEMDigitization::InitTree). GetTruth() returns the event
+  // holding the truth of this event, read from that tree on first use,
+  // or this event itself if the truth was not split off.
+  // The truth is part of the logical state of the event, so GetTruth() is
+  // const although it reads the truth tree. If that read fails, it detaches
+  // the event from the tree (mutable members) and the truth is empty.
+  const TSBSSimEvent* GetTruth() const;
+  Bool_t HasTruthSource() const { return fTruthTree != 0; }
+  void   SetTruthSource( TTree* tree, TSBSSimEvent* ev, Long64_t entry )
+  { fTruthTree = tree; fTruthEvent = ev; fTruthEntry = entry; }
+  // Move the MC truth of this event to ev, replacing the truth of ev
+  void   MoveTruthTo( TSBSSimEvent& ev );
+  // Name of the separate MC truth file for the given digitized file
+  static TString GetTruthFileName( const char* filename );
   
   std::vector<TSBSECalCluster> fECalClusters; // ECal clusters
   std::vector<TSBSScintCluster> fScintClusters; // Scint clusters
+
+ private:
+  mutable TTree*        fTruthTree;   //! Tree with the MC truth, 0 if in this event
+  mutable TSBSSimEvent* fTruthEvent;  //! Event read from fTruthTree
+  Long64_t              fTruthEntry;  //! Entry of this event in fTruthTree
   
-  ClassDef(TSBSSimEvent, 5) // Simulated data for one event
+  ClassDef(TSBSSimEvent, 6) // Simulated data for one event
 };
 
 #endif
@@ -14,9 +14,12 @@
 
 #include "TSBSSimFile.h"
 #include "TSBSSimEvent.h"
+#include "TSBSTreeReader.h"
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TTreeCache.h"
+#include "TSystem.h"
 #include "TError.h"
 #include "TClonesArray.h"
 #include "TString.h"
@@ -29,10 +32,15 @@
 
 using namespace std;
 
+// Default TTreeCache size for the input tree
+static const Long64_t kDefaultCacheSize = 30000000;
+
 //-----------------------------------------------------------------------------
 TSBSSimFile::TSBSSimFile(const char* filename, const char* description) :
   THaRunBase(description), fROOTFileName(filename), fROOTFile(0), fTree(0), 
-  fEvent(0), fNEntries(0), fEntry(0)
+  fEvent(0), fTruthFile(0), fTruthTree(0), fTruthEvent(0),
+  fNEntries(0), fEntry(0), fCacheSize(kDefaultCacheSize),
+  fCacheLearnEntries(0), fSavedLearnEntries(-1), fReadAhead(kFALSE), fReader(0)
 {
   // Constructor
 
@@ -46,7 +54,10 @@ TSBSSimFile::TSBSSimFile(const char* filename, const char* description) :
 //-----------------------------------------------------------------------------
 TSBSSimFile::TSBSSimFile(const TSBSSimFile &run)
   : THaRunBase(run), fROOTFileName(run.fROOTFileName), 
-    fROOTFile(0), fTree(0), fEvent(0), fNEntries(0), fEntry(0)
+    fROOTFile(0), fTree(0), fEvent(0), fTruthFile(0), fTruthTree(0),
+    fTruthEvent(0), fNEntries(0), fEntry(0), fCacheSize(run.fCacheSize),
+    fCacheLearnEntries(run.fCacheLearnEntries), fSavedLearnEntries(-1),
+    fReadAhead(run.fReadAhead), fReader(0)
 {
 }
 
@@ -55,12 +66,22 @@ TSBSSimFile& TSBSSimFile::operator=(const THaRunBase& rhs)
 {
   if (this != &rhs) {
     THaRunBase::operator=(rhs);
-    if( rhs.InheritsFrom("TSBSSimFile") )
-      fROOTFileName = static_cast<const TSBSSimFile&>(rhs).fROOTFileName;
+    if( rhs.InheritsFrom("TSBSSimFile") ) {
+      const TSBSSimFile& rrhs = static_cast<const TSBSSimFile&>(rhs);
+      fROOTFileName = rrhs.fROOTFileName;
+      fCacheSize = rrhs.fCacheSize;
+      fCacheLearnEntries = rrhs.fCacheLearnEntries;
+      fReadAhead = rrhs.fReadAhead;
+    }
     fROOTFile = 0;
     fTree = 0;
     fEvent = 0;
+    fTruthFile = 0;
+    fTruthTree = 0;
+    fTruthEvent = 0;
     fNEntries = fEntry = 0;
+    fSavedLearnEntries = -1;
+    fReader = 0;
   }
   return *this;
 }
@@ -109,6 +130,7 @@ Int_t TSBSSimFile::Open()
 {
   // Open ROOT input file
 
+  StopReadAhead();
   fROOTFile = new TFile(fROOTFileName, "READ", "SoLID MC data");
   if( !fROOTFile || fROOTFile->IsZombie() ) {
     Error( __FUNCTION__, "Cannot open input file %s", fROOTFileName.Data() );
@@ -148,19 +170,102 @@ Int_t TSBSSimFile::Open()
   fNEntries = fTree->GetEntries();
   fEntry = 0;
 
+  // TTreeCache: either learn the branches actually read over the first
+  // entries, or take the event branch (all its sub-branches) right away
+  if( fCacheSize > 0 ) {
+    fTree->SetCacheSize(fCacheSize);
+    if( fCacheLearnEntries > 0 ) {
+      // Global setting: keep the previous value for Close
+      if( fSavedLearnEntries < 0 )
+	fSavedLearnEntries = TTreeCache::GetLearnEntries();
+      TTreeCache::SetLearnEntries(fCacheLearnEntries);
+    }
+    else {
+      fTree->AddBranchToCache(eventBranchName, kTRUE);
+      fTree->StopCacheLearningPhase();
+    }
+  }
+
+  // MC truth written apart: tree in the same file, or in its own file.
+  // Only set up here, the truth is read when needed.
+  fTruthTree = static_cast<TTree*>( fROOTFile->Get(truthTreeName) );
+  if( !fTruthTree ) {
+    TString tname = TSBSSimEvent::GetTruthFileName(fROOTFileName);
+    if( !gSystem->AccessPathName(tname) ) {
+      fTruthFile = new TFile(tname, "READ");
+      if( fTruthFile->IsZombie() ) {
+	Warning( __FUNCTION__, "Cannot open MC truth file %s", tname.Data() );
+	delete fTruthFile; fTruthFile = 0;
+      } else
+	fTruthTree = static_cast<TTree*>( fTruthFile->Get(truthTreeName) );
+    }
+  }
+  if( fTruthTree ) {
+    delete fTruthEvent;
+    fTruthEvent = new TSBSSimEvent(1);
+    TBranch* tbr = fTruthTree->GetBranch(eventBranchName);
+    if( tbr ) {
+      tbr->SetAddress(&fTruthEvent);
+      if( static_cast<ULong64_t>(fTruthTree->GetEntries()) != fNEntries )
+	Warning( __FUNCTION__, "MC truth tree has %lld entries, event tree %llu",
+		 fTruthTree->GetEntries(), fNEntries );
+    } else {
+      Warning( __FUNCTION__, "No event branch \"%s\" in the MC truth tree. "
+	       "MC truth not available.", eventBranchName );
+      fTruthTree = 0;
+    }
+  }
+
+  // Read-ahead thread. Not with the MC truth tree in the same file: the
+  // truth is read on demand by the analyzer thread from the same TFile.
+  if( fReadAhead ) {
+    if( fTruthTree && !fTruthFile )
+      Warning( __FUNCTION__, "MC truth tree in the input file. "
+	       "Read-ahead disabled." );
+    else {
+      fReader = new TSBSTreeReader;
+      if( fReader->Start(fTree) != 0 ) {
+	Warning( __FUNCTION__, "Cannot start read-ahead thread. "
+		 "Reading synchronously." );
+	delete fReader; fReader = 0;
+      }
+    }
+  }
+
   fOpened = kTRUE;
   return READ_OK;
 }
 
+//-----------------------------------------------------------------------------
+void TSBSSimFile::StopReadAhead()
+{
+  // End the read-ahead thread. fEvent pointed to one of its buffers.
+
+  if( !fReader ) return;
+  delete fReader; fReader = 0;
+  fEvent = 0;
+}
+
 //-----------------------------------------------------------------------------
 Int_t TSBSSimFile::Close()
 {
+  StopReadAhead();
+  delete fTruthTree; fTruthTree = 0;
+  if (fTruthFile) {
+    fTruthFile->Close();
+    delete fTruthFile; fTruthFile = 0;
+  }
+  delete fTruthEvent; fTruthEvent = 0;
   delete fTree; fTree = 0;
   if (fROOTFile) {
     fROOTFile->Close();
     delete fROOTFile; fROOTFile = 0;
   }
   delete fEvent; fEvent = 0;
+  if( fSavedLearnEntries >= 0 ) {
+    TTreeCache::SetLearnEntries(fSavedLearnEntries);
+    fSavedLearnEntries = -1;
+  }
   fOpened = kFALSE;
   return READ_OK;
 }
@@ -179,6 +284,23 @@ Int_t TSBSSimFile::ReadEvent()
     if( ret ) return ret;
   }
 
+  if( fReader ) {
+    // Already read (and upgraded) by the read-ahead thread.
+    // No current event at the end of the tree or on error: the buffer
+    // returned then holds no event (or none at all)
+    fEvent = fReader->Next(ret);
+    fEntry++;
+    if( ret <= 0 )
+      fEvent = 0;
+    if( ret == 0 )
+      return READ_EOF;
+    if( ret < 0 )
+      return READ_ERROR;
+    if( fTruthTree )
+      fEvent->SetTruthSource( fTruthTree, fTruthEvent, fEntry-1 );
+    return READ_OK;
+  }
+
   // Clear the event to get rid of anything still hanging around
   if( fEvent ) fEvent->Clear();
 
@@ -189,6 +311,14 @@ Int_t TSBSSimFile::ReadEvent()
   if( ret < 0 )
     return READ_ERROR;  // CODA_ERR
 
+  // Files written with TSBSSimEvent version <= 5 hold the strips
+  // in the old layout
+  if( fEvent->HasOldStrips() )
+    fEvent->UpgradeStrips();
+
+  if( fTruthTree )
+    fEvent->SetTruthSource( fTruthTree, fTruthEvent, fEntry-1 );
+
   return READ_OK;
 }
 
@@ -19,6 +19,7 @@ class TFile;
 class TTree;
 class TBranch;
 class TSBSSimEvent;
+class TSBSTreeReader;
 
 class TSBSSimFile : public THaRunBase {
  public:
@@ -27,12 +28,16 @@ class TSBSSimFile : public THaRunBase {
   virtual ~TSBSSimFile();
   virtual TSBSSimFile &operator=(const THaRunBase &rhs);
   // for ROOT RTTI
-  TSBSSimFile() : fROOTFile(0), fTree(0), fEvent(0), fNEntries(0), fEntry(0) {}
+  TSBSSimFile() : fROOTFile(0), fTree(0), fEvent(0), fTruthFile(0),
+		  fTruthTree(0), fTruthEvent(0), fNEntries(0), fEntry(0),
+		  fCacheSize(0), fCacheLearnEntries(0), fSavedLearnEntries(-1),
+		  fReadAhead(kFALSE), fReader(0) {}
 
   virtual void  Print( Option_t* opt="" ) const;
 
   Int_t         Close();
   virtual Int_t Compare( const TObject* obj ) const;
+  // Current event, 0 if none (not open, or after the end of the input)
 #if ANALYZER_VERSION_CODE >= 67072  // ANALYZER_VERSION(1,6,0)
   const UInt_t* GetEvBuffer() const;
 #else
@@ -44,17 +49,41 @@ class TSBSSimFile : public THaRunBase {
   Int_t         ReadEvent();
   void          SetFileName( const char* name ) { fROOTFileName = name; }
 
+  // Input tuning, to be set before Open:
+  // TTreeCache size in bytes (0 disables the cache)
+  void          SetCacheSize( Long64_t size ) { fCacheSize = size; }
+  // Number of entries over which the TTreeCache learns the branches
+  // used; 0 caches the event branch right away. This is a global ROOT
+  // setting, restored by Close
+  void          SetCacheLearnEntries( Int_t n ) { fCacheLearnEntries = n; }
+  // Read and deserialize the next event in a separate thread while the
+  // current one is analyzed (see TSBSTreeReader)
+  void          SetReadAhead( Bool_t b = kTRUE ) { fReadAhead = b; }
+
  protected:
   virtual Int_t ReadDatabase() {return 0;}
+  void          StopReadAhead();
 
   TString fROOTFileName;  //  Name of input file
   TFile* fROOTFile;       //! Input ROOT file
   TTree* fTree;           //! Input Tree with simulation data
   TSBSSimEvent* fEvent;   //! Current event
 
+  // MC truth written apart from the digitized events, read on demand
+  // (see TSBSSimEvent::GetTruth)
+  TFile* fTruthFile;      //! Separate MC truth file, if any
+  TTree* fTruthTree;      //! MC truth tree, 0 if the truth is in fTree
+  TSBSSimEvent* fTruthEvent; //! MC truth of the current event
+
   ULong64_t fNEntries;    //! Number of entries in tree
   ULong64_t fEntry;       //! Current entry number
 
+  Long64_t fCacheSize;    //! TTreeCache size (bytes)
+  Int_t    fCacheLearnEntries; //! TTreeCache learning entries, 0: none
+  Int_t    fSavedLearnEntries; //! Global TTreeCache learning entries to restore, -1: none
+  Bool_t   fReadAhead;    //! Read ahead in a separate thread
+  TSBSTreeReader* fReader; //! Read-ahead thread, if running
+
   ClassDef(TSBSSimFile,1) // Interface to input file with simulated SoLID data
 };
 
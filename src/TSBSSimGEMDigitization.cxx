@@ -5,6 +5,10 @@
 #include "TMath.h"
 #include "TTree.h"
 #include "TClonesArray.h"
+#include "TSystem.h"
+#include "TStopwatch.h"
+#include "TObjArray.h"
+#include "TObjString.h"
 
 #include "TSBSGeant4File.h"  // needed for g4sbsgendata class def
 #include "TSBSGEMSimHitData.h"
@@ -14,9 +18,12 @@
 #include "TSBSGEMPlane.h"
 #include "TSBSSimAuxi.h"
 #include "TSBSSimEvent.h"
+#include "TSBSTreeWriter.h"
 #include "TSBSDBManager.h"
+#include "TSBSDBSnapshot.h"
 
 #include <cmath>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
@@ -198,14 +205,20 @@ TSBSSimGEMDigitization::TSBSSimGEMDigitization( const TSBSSpec& spect,
 						const char* name)
   : THaAnalysisObject(name, "GEM simulation digitizer"),
     fDoMapSector(false), fSignalSector(0), fDP(0), fdh(0), fNChambers(0), fNPlanes(0),
-    fRNIon(0), fOFile(0), fOTree(0), fEvent(0)
+    fRNIon(0), fOFile(0), fOTree(0), fEvent(0),
+    fOTruthFile(0), fOTruthTree(0), fTruthEvent(0), fWriter(0),
+    fTruthOutput(kTruthInEvent), fSegment(0), fSegEvents(0),
+    fSegFirstEvt(-1), fSegLastEvt(-1)
 {
   Init();
   Initialize (spect);
   fRIon.resize(fMaxNIon);
+  fRIonXs.resize(fMaxNIon);
+  fRIonYs.resize(fMaxNIon);
   fTriggerOffset.resize(manager->GetNChamber());
 
   fEvent = new TSBSSimEvent(5);
+  fTruthEvent = new TSBSSimEvent(5);
 }
 
 TSBSSimGEMDigitization::~TSBSSimGEMDigitization()
@@ -228,10 +241,14 @@ void TSBSSimGEMDigitization::DeleteObjects()
   delete[] fdh;       fdh = 0;
   delete[] fNPlanes;  fNPlanes = 0;
 
+  delete fWriter;     fWriter = 0;  // ends the I/O thread
   delete fOFile;      fOFile = 0;
   delete fOTree;      fOTree = 0;
+  delete fOTruthFile; fOTruthFile = 0;
+  fOTruthTree = 0;    // owned by its file
   // fEvent->Clear("all");
   delete fEvent;      fEvent = 0;
+  delete fTruthEvent; fTruthEvent = 0;
 }
 
 void
@@ -278,6 +295,15 @@ TSBSSimGEMDigitization::ReadDatabase (const TDatime& date)
   
   vector<Double_t>* offset = 0;
 
+  // Output tree defaults
+  fOutCompress = -1;
+  fOutBasketSize = 32000;
+  fOutAutoFlush = 0;
+  fOutSplitLevel = 99;
+  fOutAsyncQueue = 0;
+  fOutSegEvents = 0;
+  fOutSegMB = 0;
+
   try{
     offset = new vector<Double_t>;
     const DBRequest request[] =
@@ -319,10 +345,24 @@ TSBSSimGEMDigitization::ReadDatabase (const TDatime& date)
 	{ "crosstalk_mean",            &fCrossFactor,               kDouble },
 	{ "crosstalk_sigma",           &fCrossSigma,                kDouble },
 	{ "crosstalk_strip_apart",     &fNCStripApart,              kInt    },
+	{ "out_compress",              &fOutCompress,               kInt, 0, 1 },
+	{ "out_basketsize",            &fOutBasketSize,             kInt, 0, 1 },
+	{ "out_autoflush",             &fOutAutoFlush,              kInt, 0, 1 },
+	{ "out_splitlevel",            &fOutSplitLevel,             kInt, 0, 1 },
+	{ "out_asyncqueue",            &fOutAsyncQueue,             kInt, 0, 1 },
+	{ "out_segment_events",        &fOutSegEvents,              kInt, 0, 1 },
+	{ "out_segment_mb",            &fOutSegMB,                  kDouble, 0, 1 },
 	{ 0 }
       };
     
-    Int_t err = LoadDB (file, date, request, fPrefix);
+    TSBSDBSnapshot* snap = TSBSDBSnapshot::GetInstance();
+    const string snapkey = string("TSBSSimGEMDigitization:") + fPrefix;
+    Int_t err = 0;
+    if (!snap->Restore (snapkey, request, file)) {
+      err = LoadDB (file, date, request, fPrefix);
+      if (!err)
+	snap->Store (snapkey, request, file, fPrefix);
+    }
     fclose(file);
     if (err)
       return kInitError;
@@ -811,14 +851,16 @@ TSBSSimGEMDigitization::AvaModel(const Int_t ic,
     //    fSumA.resize(nx*ny);
     //memset (&fSumA[0], 0, fSumA.size() * sizeof (Double_t));
   
+    // Ion positions in strip frame, all ions in one pass
+    for (UInt_t i = 0; i < fRNIon; i++){
+      fRIonXs[i] = fRIon[i].X * 1e-3;
+      fRIonYs[i] = fRIon[i].Y * 1e-3;
+    }
+    pl.PlaneToStrip (&fRIonXs[0], &fRIonYs[0], fRNIon);
  
     for (UInt_t i = 0; i < fRNIon; i++){
-      Double_t frxs = fRIon[i].X * 1e-3;
-      Double_t frys = fRIon[i].Y * 1e-3;
-
-
-      pl.PlaneToStrip (frxs, frys);
-      frxs *= 1e3; frys *= 1e3;
+      Double_t frxs = fRIonXs[i] * 1e3;
+      Double_t frys = fRIonYs[i] * 1e3;
      
       //  cout<<"IonStrip: "<<pl.GetStrip(frxs*1e-3,frys*1e-3)<<endl;
       // bin containing center and # bins each side to process
@@ -1081,8 +1123,38 @@ TSBSSimGEMDigitization::PrintSamples() const
 
 // Tree methods
 void
-TSBSSimGEMDigitization::InitTree (const TSBSSpec& spect, const TString& ofile)
+TSBSSimGEMDigitization::InitTree (const TSBSSpec& spect, const TString& ofile,
+				  ETruthOutput truth)
 {
+  // With out_segment_events or out_segment_mb set, the output is written
+  // to segments ofile_p1.root, ofile_p2.root, ... (ofile without ".root"),
+  // listed in the manifest ofile.manifest written by CloseTree
+
+  fTruthOutput = truth;
+  fSegments.clear();
+  fSegEvents = 0;
+  if (fOutSegEvents > 0 || fOutSegMB > 0)
+    {
+      fOutBaseName = ofile;
+      if (fOutBaseName.EndsWith(".root"))
+	fOutBaseName.Remove(fOutBaseName.Length()-5);
+      fSegment = 1;
+      OpenOutput (GetSegmentFileName(fSegment));
+    }
+  else
+    {
+      fOutBaseName = "";
+      fSegment = 0;
+      OpenOutput (ofile);
+    }
+}
+
+void
+TSBSSimGEMDigitization::OpenOutput (const TString& ofile)
+{
+  // Open the output file(s) and create the output tree(s)
+
+  ETruthOutput truth = fTruthOutput;
   fOFile = new TFile( ofile, "RECREATE");
 
   if (fOFile == 0 || fOFile->IsZombie() )
@@ -1091,6 +1163,8 @@ TSBSSimGEMDigitization::InitTree (const TSBSSpec& spect, const TString& ofile)
       delete fOFile; fOFile = 0;
       return;
     }
+  if (fOutCompress >= 0)
+    fOFile->SetCompressionSettings(fOutCompress);
 
   fOTree = new TTree( treeName, "Tree of digitized values");
   fOTree -> SetMaxTreeSize(100000000000);
@@ -1099,8 +1173,65 @@ TSBSSimGEMDigitization::InitTree (const TSBSSpec& spect, const TString& ofile)
 
   // create the tree variables
 
-  fOTree->Branch( eventBranchName, "TSBSSimEvent", &fEvent );
+  MakeEventBranch( fOTree, &fEvent );
+
+  // MC truth tree, filled along with fOTree
+  if (truth != kTruthInEvent)
+    InitTruthTree (ofile, truth);
+
+  if (fOutAsyncQueue > 0)
+    {
+      fWriter = new TSBSTreeWriter( fOutAsyncQueue );
+      fWriter->AddTree( fOTree );
+      if (fOTruthTree)
+	fWriter->AddTree( fOTruthTree );
+      if (fWriter->Start() != 0)
+	{
+	  cerr << "Warning: cannot start the output thread, "
+	       << "filling the tree(s) synchronously" << endl;
+	  delete fWriter; fWriter = 0;
+	  fOTree->SetBranchAddress( eventBranchName, &fEvent );
+	  if (fOTruthTree)
+	    fOTruthTree->SetBranchAddress( eventBranchName, &fTruthEvent );
+	}
+    }
+}
+
+void
+TSBSSimGEMDigitization::InitTruthTree (const TString& ofile, ETruthOutput truth)
+{
+  if (truth == kTruthFile)
+    {
+      TString tfile = TSBSSimEvent::GetTruthFileName(ofile);
+      fOTruthFile = new TFile( tfile, "RECREATE");
+      if (fOTruthFile == 0 || fOTruthFile->IsZombie() )
+	{
+	  cerr << "Error: cannot open MC truth output file " << tfile << endl;
+	  delete fOTruthFile; fOTruthFile = 0;
+	  return;
+	}
+      if (fOutCompress >= 0)
+	fOTruthFile->SetCompressionSettings(fOutCompress);
+    }
+  else
+    fOFile->cd();
+
+  fOTruthTree = new TTree( truthTreeName, "MC truth of the digitized events");
+  fOTruthTree -> SetMaxTreeSize(100000000000);
+  MakeEventBranch( fOTruthTree, &fTruthEvent );
+}
 
+TBranch*
+TSBSSimGEMDigitization::MakeEventBranch (TTree* tree, TSBSSimEvent** ev) const
+{
+  // Create the event branch of an output tree with the configured
+  // basket size, split level and auto-flush
+
+  TBranch* br = tree->Branch( eventBranchName, "TSBSSimEvent", ev,
+			      fOutBasketSize, fOutSplitLevel );
+  if (fOutAutoFlush != 0)
+    tree->SetAutoFlush(fOutAutoFlush);
+  return br;
 }
 
 void
@@ -1284,15 +1415,40 @@ TSBSSimGEMDigitization::SetTreeHit (const UInt_t ih,
   return clust.fID;
 }
 
+// Append the cluster data of strip idx of dp to the flat arrays of ev
+static void AddStripClusters( TSBSSimEvent* ev, TSBSSimEvent::GEMStrip& strip,
+			      const TSBSDigitizedPlane& dp, Short_t idx )
+{
+  const vector<Short_t>& sc = dp.GetStripClusters(idx);
+  const vector<Double_t>& swc = dp.GetStripWeightInCluster(idx);
+  assert( swc.size() == sc.size() );
+  strip.fNClust = sc.size();
+  strip.fClustBegin = ev->fStripClust.size();
+  ev->fStripClust.insert( ev->fStripClust.end(), sc.begin(), sc.end() );
+  ev->fStripClustWeight.insert( ev->fStripClustWeight.end(), swc.begin(), swc.end() );
+
+  strip.fRatioBegin = ev->fStripClustADC.size();
+  for (UInt_t ss = 0; ss < strip.fNsamp; ++ss) {
+    const vector<Int_t>& sclust = dp.GetStripClusterADC(ss, idx);
+    assert( sclust.size() == sc.size() );
+    ev->fStripClustADC.insert( ev->fStripClustADC.end(), sclust.begin(), sclust.end() );
+  }
+}
+
 void
 TSBSSimGEMDigitization::SetTreeStrips()
 {
-  // Sets the variables in fEvent->fGEMStrips describing strip signals
+  // Sets the variables in fEvent->fDigiStrips describing strip signals
   // This is later used to fill the tree.
   
   fEvent->fGEMStrips.clear();
+  fEvent->fDigiStrips.clear();
+  fEvent->fStripADC.clear();
+  fEvent->fStripClust.clear();
+  fEvent->fStripClustWeight.clear();
+  fEvent->fStripClustADC.clear();
 
-  TSBSSimEvent::DigiGEMStrip strip;
+  TSBSSimEvent::GEMStrip strip;
   Double_t saturation = static_cast<Double_t>( (1<<fADCbits)-1 )-1300;
   for (UInt_t ich = 0; ich < GetNChambers(); ++ich) {
     
@@ -1322,19 +1478,15 @@ TSBSSimGEMDigitization::SetTreeStrips()
 	    strip.fChan = idx;
 
 	    //setting strip sample adc and adding pedestal noise
+	    strip.fADCBegin = fEvent->fStripADC.size();
 	    for (UInt_t ss = 0; ss < strip.fNsamp; ++ss){
-	      strip.fADC[ss] = GetADC(ich, ip, idx, ss);
-	      // cout << strip.fADC[ss] << " ";
-	       strip.fADC[ss] += fTrnd.Gaus(0, fPulseNoiseSigma);//allowing negative value, before implementing common mode;
-	      // cout << strip.fADC[ss] << " ";
+	      Int_t adc = GetADC(ich, ip, idx, ss);
+	      // cout << adc << " ";
+	       adc += fTrnd.Gaus(0, fPulseNoiseSigma);//allowing negative value, before implementing common mode;
+	      // cout << adc << " ";
 	      saturation = 4000;
-	      if(strip.fADC[ss]>saturation)strip.fADC[ss]=saturation;
-	      const vector<Int_t>& sclust = GetStripClusterADC(ich, ip, idx, ss);
-	      
-	      strip.fClusterRatio[ss].Set( sclust.size(), &sclust[0] );
-	      //     if(sclust.size()!=0){
-	      //	 cout<<idx<<" "<<ss<<" "<<sclust.size()<<" == "<<strip.fClusterRatio[ss].GetSize()<<" == "<<GetStripClusters(ich, ip, idx).size()<<endl; getchar();
-	      //    }
+	      if(adc>saturation)adc=saturation;
+	      fEvent->fStripADC.push_back(adc);
 	    }//cout << endl;
 	    /*	    if(GetTotADC(ich, ip, idx)==0)
 	      {
@@ -1348,12 +1500,9 @@ TSBSSimGEMDigitization::SetTreeStrips()
 	    strip.fCharge  = GetCharge(ich, ip, idx);
 	    strip.fTime1   = GetTime(ich, ip, idx);
 	
-	    const vector<Short_t>& sc = GetStripClusters(ich, ip, idx);
-	    strip.fClusters.Set( sc.size(), &sc[0] );
-	    const vector<Double_t>& swc = GetStripWeightInCluster(ich, ip, idx);
-	    strip.fStripWeightInCluster.Set( swc.size(), &swc[0] );
+	    AddStripClusters( fEvent, strip, GetDigitizedPlane(ich, ip), idx );
 
-	    fEvent->fGEMStrips.push_back( strip );
+	    fEvent->fDigiStrips.push_back( strip );
 	  }
 	}
       else{
@@ -1364,27 +1513,23 @@ TSBSSimGEMDigitization::SetTreeStrips()
 	  strip.fChan = idx;
 
 	  //setting strip sample adc and adding pedestal noise
+	  strip.fADCBegin = fEvent->fStripADC.size();
 	  for (UInt_t ss = 0; ss < strip.fNsamp; ++ss){
-	    strip.fADC[ss] = GetADC(ich, ip, idx, ss);
-	    // cout << strip.fADC[ss] << " ";
-	    strip.fADC[ss] += fTrnd.Gaus(0, fPulseNoiseSigma);//allowing negative value, before implementing common mode;
-	    // cout << strip.fADC[ss] << " ";
-	    if(strip.fADC[ss]>saturation)strip.fADC[ss]=saturation;
-
-	    const vector<Int_t>& sclust = GetStripClusterADC(ich, ip, idx, ss);
-	    strip.fClusterRatio[ss].Set( sclust.size(), &sclust[0] );
-	    
-
+	    Int_t adc = GetADC(ich, ip, idx, ss);
+	    // cout << adc << " ";
+	    adc += fTrnd.Gaus(0, fPulseNoiseSigma);//allowing negative value, before implementing common mode;
+	    // cout << adc << " ";
+	    if(adc>saturation)adc=saturation;
+	    fEvent->fStripADC.push_back(adc);
 	  }//cout << endl;
 
 	  strip.fSigType = GetType(ich, ip, idx);
 	  strip.fCharge  = GetCharge(ich, ip, idx);
 	  strip.fTime1   = GetTime(ich, ip, idx);
 	
-	  const vector<Short_t>& sc = GetStripClusters(ich, ip, idx);
-	  strip.fClusters.Set( sc.size(), &sc[0] );
+	  AddStripClusters( fEvent, strip, GetDigitizedPlane(ich, ip), idx );
 	  
-	  fEvent->fGEMStrips.push_back( strip );
+	  fEvent->fDigiStrips.push_back( strip );
 	}
       }
     }
@@ -1404,13 +1549,56 @@ TSBSSimGEMDigitization::FillTree ()
       // added this line to not write events where there are no entries
 
       // Remove for background study
-      //      && fEvent->fGEMStrips.size() > 0 && fEvent->fGEMClust.size() > 0
+      //      && fEvent->fDigiStrips.size() > 0 && fEvent->fGEMClust.size() > 0
 
       )
     {
+      if (fSegment > 0 && SegmentFull())
+	{
+	  NextSegment();
+	  if (!fOFile || !fOTree)
+	    return;
+	}
+      fSegEvents++;
+      if (fSegEvents == 1)
+	fSegFirstEvt = fEvent->fEvtID;
+      fSegLastEvt = fEvent->fEvtID;
+
+      if (fWriter)
+	{
+	  // Queue a copy of the event for the I/O thread. fEvent stays
+	  // valid for the caller.
+	  if (!fWriter->IsRunning())
+	    fWriter->Start();  // filling again after WriteTree
+	  TSBSSimEvent* const* ev = fWriter->Acquire();
+	  fEvent->Copy( *ev[0] );
+	  if (fOTruthTree)
+	    {
+	      ev[1]->fRunID = fEvent->fRunID;
+	      ev[1]->fEvtID = fEvent->fEvtID;
+	      ev[1]->fWeight = fEvent->fWeight;
+	      ev[0]->MoveTruthTo( *ev[1] );
+	    }
+	  fWriter->Push();
+	  return;
+	}
+      // Move the MC truth out of the event for its own tree,
+      // keyed by the event numbers
+      if (fOTruthTree)
+	{
+	  fTruthEvent->fRunID = fEvent->fRunID;
+	  fTruthEvent->fEvtID = fEvent->fEvtID;
+	  fTruthEvent->fWeight = fEvent->fWeight;
+	  fEvent->MoveTruthTo( *fTruthEvent );
+	}
       fOFile->cd();
       //fEvent->Print("all"); 
       fOTree->Fill();
+      if (fOTruthTree)
+	{
+	  fOTruthTree->Fill();
+	  fTruthEvent->MoveTruthTo( *fEvent );
+	}
     }
 }
 
@@ -1419,15 +1607,217 @@ TSBSSimGEMDigitization::WriteTree () const
 {
   //cout << "write tree " << fOFile << " " << fOTree << endl;
   
+  // Write out the queued events and give the trees back to this thread
+  if (fWriter)
+    fWriter->Stop();
   if (fOFile && fOTree) {
     fOFile->cd();
     fOTree->Write();
   }
+  if (fOTruthTree) {
+    if (fOTruthFile) fOTruthFile->cd();
+    fOTruthTree->Write();
+  }
 }
 
 void
 TSBSSimGEMDigitization::CloseTree () const
 {
+  if (fWriter)
+    fWriter->Stop();
+  if (fOTruthFile) fOTruthFile->Close();
   if (fOFile) fOFile->Close();
+  if (fSegment > 0)
+    WriteManifest();
+}
+
+TString
+TSBSSimGEMDigitization::GetSegmentFileName (Int_t iseg) const
+{
+  // Name of the output file of segment iseg (1, 2, ...)
+
+  return fOutBaseName + Form("_p%d.root", iseg);
+}
+
+Long64_t
+TSBSSimGEMDigitization::GetOutputBytes () const
+{
+  // Compressed size of the output tree(s) so far. Baskets not yet
+  // flushed are not counted.
+
+  if (fWriter)
+    return fWriter->GetZipBytes();
+  Long64_t nbytes = fOTree ? fOTree->GetZipBytes() : 0;
+  if (fOTruthTree)
+    nbytes += fOTruthTree->GetZipBytes();
+  return nbytes;
+}
+
+Bool_t
+TSBSSimGEMDigitization::SegmentFull () const
+{
+  if (fSegEvents == 0)
+    return false;
+  if (fOutSegEvents > 0 && fSegEvents >= fOutSegEvents)
+    return true;
+  if (fOutSegMB > 0 && GetOutputBytes() >= fOutSegMB*1e6)
+    return true;
+  return false;
+}
+
+TSBSSimGEMDigitization::Segment_t
+TSBSSimGEMDigitization::CurrentSegment () const
+{
+  Segment_t seg;
+  seg.fFile = GetSegmentFileName(fSegment);
+  seg.fTruthFile = fOTruthFile ? TSBSSimEvent::GetTruthFileName(seg.fFile) : "";
+  seg.fEntries = fSegEvents;
+  seg.fFirstEvt = fSegEvents > 0 ? fSegFirstEvt : -1;
+  seg.fLastEvt = fSegEvents > 0 ? fSegLastEvt : -1;
+  return seg;
+}
+
+void
+TSBSSimGEMDigitization::NextSegment ()
+{
+  // Close the current output segment and open the next one
+
+  WriteTree();
+  CloseTree();
+  fSegments.push_back( CurrentSegment() );
+  // The trees were deleted along with their files
+  delete fWriter;     fWriter = 0;
+  delete fOFile;      fOFile = 0;
+  delete fOTruthFile; fOTruthFile = 0;
+  fOTree = 0;
+  fOTruthTree = 0;
+
+  fSegment++;
+  fSegEvents = 0;
+  OpenOutput (GetSegmentFileName(fSegment));
+}
+
+void
+TSBSSimGEMDigitization::WriteManifest () const
+{
+  // Write the list of output segments to fOutBaseName.manifest:
+  // one line per segment with its number, file, number of entries,
+  // first and last event number, file size and MC truth file ("-" if none)
+
+  std::vector<Segment_t> segs(fSegments);
+  segs.push_back( CurrentSegment() );
+
+  TString mname = fOutBaseName + ".manifest";
+  FILE* fm = fopen( mname, "w" );
+  if (!fm)
+    {
+      cerr << "Error: cannot write manifest " << mname << endl;
+      return;
+    }
+  Long64_t ntot = 0;
+  for (size_t i = 0; i < segs.size(); ++i)
+    ntot += segs[i].fEntries;
+  fprintf( fm, "# Digitized output %s: %d segments, %lld events\n",
+	   fOutBaseName.Data(), (Int_t)segs.size(), ntot );
+  fprintf( fm, "# Segment limits: %d events, %g MB\n", fOutSegEvents, fOutSegMB );
+  fprintf( fm, "# segment file entries first_event last_event bytes truth_file\n" );
+  for (size_t i = 0; i < segs.size(); ++i)
+    {
+      const Segment_t& seg = segs[i];
+      FileStat_t st;
+      Long64_t size = gSystem->GetPathInfo(seg.fFile, st) == 0 ? st.fSize : -1;
+      fprintf( fm, "%d %s %lld %d %d %lld %s\n", (Int_t)i+1, seg.fFile.Data(),
+	       seg.fEntries, seg.fFirstEvt, seg.fLastEvt, size,
+	       seg.fTruthFile.IsNull() ? "-" : seg.fTruthFile.Data() );
+    }
+  fclose(fm);
+}
+
+void
+TSBSSimGEMDigitization::BenchmarkTree (const char* infile, Long64_t nevents,
+				       const char* compress) const
+{
+  TFile* fin = TFile::Open(infile, "READ");
+  if (fin == 0 || fin->IsZombie())
+    {
+      cerr << "Error: cannot open benchmark input file " << infile << endl;
+      delete fin;
+      return;
+    }
+  TTree* tin = static_cast<TTree*>( fin->Get(treeName) );
+  if (!tin)
+    {
+      cerr << "Error: no tree " << treeName << " in " << infile << endl;
+      delete fin;
+      return;
+    }
+  TSBSSimEvent* ev = 0;
+  tin->SetBranchAddress( eventBranchName, &ev );
+  if (nevents <= 0 || nevents > tin->GetEntries())
+    nevents = tin->GetEntries();
+
+  cout << "Output tree benchmark: " << nevents << " events of " << infile
+       << ", basket size " << fOutBasketSize << ", auto-flush " << fOutAutoFlush
+       << ", split level " << fOutSplitLevel << endl;
+  printf("%10s %12s %12s %12s %12s %8s\n", "compress", "raw (MB)", "file (MB)",
+	 "write MB/s", "read MB/s", "ratio");
+
+  TObjArray* settings = TString(compress).Tokenize(",");
+  for (Int_t is = 0; is < settings->GetLast()+1; is++)
+    {
+      Int_t comp = static_cast<TObjString*>(settings->At(is))->GetString().Atoi();
+      TString ofile = TString::Format("digbench_%d.root", comp);
+
+      // Write. Only the filling and flushing is timed, not the input.
+      TStopwatch wtime;
+      wtime.Reset();
+      TFile* fout = new TFile( ofile, "RECREATE", "", comp );
+      TTree* tout = new TTree( treeName, "Tree of digitized values");
+      MakeEventBranch( tout, &ev );
+      for (Long64_t i = 0; i < nevents; i++)
+	{
+	  tin->GetEntry(i);
+	  if (ev->HasOldStrips())
+	    ev->UpgradeStrips();
+	  wtime.Start(kFALSE);
+	  tout->Fill();
+	  wtime.Stop();
+	}
+      wtime.Start(kFALSE);
+      fout->Write();
+      wtime.Stop();
+      Double_t rawMB = tout->GetTotBytes()/1e6;
+      fout->Close();
+      delete fout;
+      Long64_t fsize = 0;
+      FileStat_t st;
+      if (gSystem->GetPathInfo(ofile, st) == 0)
+	fsize = st.fSize;
+
+      // Read back
+      TStopwatch rtime;
+      TFile* fread = new TFile( ofile, "READ" );
+      TTree* tread = static_cast<TTree*>( fread->Get(treeName) );
+      TSBSSimEvent* rev = 0;
+      Double_t readMB = 0;
+      if (tread)
+	{
+	  tread->SetBranchAddress( eventBranchName, &rev );
+	  for (Long64_t i = 0; i < tread->GetEntries(); i++)
+	    readMB += tread->GetEntry(i)/1e6;
+	}
+      rtime.Stop();
+      delete fread;
+      delete rev;
+      gSystem->Unlink(ofile);
+
+      Double_t wt = wtime.RealTime(), rt = rtime.RealTime();
+      printf("%10d %12.2f %12.2f %12.1f %12.1f %8.2f\n", comp, rawMB, fsize/1e6,
+	     wt > 0 ? rawMB/wt : 0., rt > 0 ? readMB/rt : 0.,
+	     fsize > 0 ? 1e6*rawMB/fsize : 0.);
+    }
+  delete settings;
+  delete fin;
+  delete ev;
 }
 
@@ -15,11 +15,13 @@
 
 class TFile;
 class TTree;
+class TBranch;
 
 class TSBSGEMSimHitData;
 class TSBSGEMHit;
 class TSBSSpec;
 class TSBSSimEvent;
+class TSBSTreeWriter;
 class TSBSGeant4File;
 
 // First an auxiliary class
@@ -114,8 +116,23 @@ class TSBSSimGEMDigitization: public THaAnalysisObject
   //   Call SetTreeEvent in main loop (before or after Digitize)
   //   Call FillTree in main loop (after Digitize and SetTreeEvent)
   // Call WriteTree and CloseTree after main loop
+  // With out_segment_events and/or out_segment_mb in the database, the
+  // output is split into files ofile_p1.root, ofile_p2.root, ... as read
+  // by the replay scripts; CloseTree writes their list to ofile.manifest.
+  // With out_asyncqueue > 0 in the database, FillTree hands a copy of the
+  // event to a background thread filling the tree(s); WriteTree waits
+  // for the queued events to be written.
+  // The MC truth (tracks, clusters, cluster data of the strips) can be
+  // written apart from the digitized data, in a tree of the same entries:
+  enum ETruthOutput {
+    kTruthInEvent = 0,  // in the event tree (default)
+    kTruthTree,         // in tree truthTreeName of the output file
+    kTruthFile          // in tree truthTreeName of a separate file,
+                        //   see TSBSSimEvent::GetTruthFileName
+  };
 
-  void InitTree (const TSBSSpec& spect, const TString& ofile);
+  void InitTree (const TSBSSpec& spect, const TString& ofile,
+		 ETruthOutput truth = kTruthInEvent);
   //dpulication of the SetTreeEvent routine with G4SBS file input instead of EVIO file
   void SetTreeEvent (const TSBSGEMSimHitData& tsgd,
 		     const TSBSGeant4File& f,
@@ -130,6 +147,15 @@ class TSBSSimGEMDigitization: public THaAnalysisObject
   void WriteTree () const;
   void CloseTree () const;
 
+  // Benchmark of the output tree settings: write the first nevents events
+  // of the digitized file infile with each of the given compression settings
+  // (comma-separated ROOT settings, 100*algorithm+level, e.g. 404 = LZ4 4,
+  // 505 = ZSTD 5) and the basket size, auto-flush and split level of the
+  // database. Print the write and read speeds (MB/s of uncompressed data)
+  // and the compression ratio.
+  void BenchmarkTree (const char* infile, Long64_t nevents = 100,
+		      const char* compress = "101,404,505,207") const;
+
   // Access to results
   Short_t GetType (UInt_t ich, UInt_t ip, Int_t n) const {return fDP[ich][ip]->GetType (n);}
   Int_t   GetTotADC (UInt_t ich, UInt_t ip, Int_t n) const {return fDP[ich][ip]->GetTotADC (n);}
@@ -247,6 +273,8 @@ class TSBSSimGEMDigitization: public THaAnalysisObject
   TRandom3 fTrnd;     // time randomizer
   UInt_t   fRNIon;    // number of ions
   std::vector<IonPar_t> fRIon;
+  std::vector<Double_t> fRIonXs; // ion positions in strip frame of the current plane (m)
+  std::vector<Double_t> fRIonYs;
   Double_t fRSMax;
   Double_t fRTotalCharge;
   Double_t fRTime0;
@@ -256,9 +284,50 @@ class TSBSSimGEMDigitization: public THaAnalysisObject
 
   // Tree
 
+  // Output tree settings
+  Int_t    fOutCompress;    // ROOT compression settings (100*algorithm+level), <0: ROOT default
+  Int_t    fOutBasketSize;  // basket size of the event branches (bytes)
+  Int_t    fOutAutoFlush;   // auto-flush (>0: entries, <0: bytes), 0: ROOT default
+  Int_t    fOutSplitLevel;  // split level of the event branch
+  Int_t    fOutAsyncQueue;  // >0: fill the output tree(s) in a background thread,
+                            //   with a queue of this many events
+  Int_t    fOutSegEvents;   // >0: start a new output segment after this many events
+  Double_t fOutSegMB;       // >0: start a new output segment at this size (MB, compressed)
+
+  // Output segments (fOutSegEvents or fOutSegMB set)
+  struct Segment_t {
+    TString  fFile;       // file name
+    TString  fTruthFile;  // MC truth file name, empty if none
+    Long64_t fEntries;    // number of events
+    Int_t    fFirstEvt;   // first and last event number
+    Int_t    fLastEvt;
+  };
+
+  TBranch* MakeEventBranch (TTree* tree, TSBSSimEvent** ev) const;
+  void OpenOutput (const TString& ofile);
+  void InitTruthTree (const TString& ofile, ETruthOutput truth);
+  TString   GetSegmentFileName (Int_t iseg) const;
+  Long64_t  GetOutputBytes () const;
+  Bool_t    SegmentFull () const;
+  Segment_t CurrentSegment () const;
+  void      NextSegment ();
+  void      WriteManifest () const;
+
   TFile* fOFile;          // Output ROOT file
   TTree* fOTree;          // Output tree
   TSBSSimEvent* fEvent;   // Output event structure, written to tree
+  TFile* fOTruthFile;     // Output file for the MC truth (kTruthFile)
+  TTree* fOTruthTree;     // Output tree for the MC truth, 0 if in fOTree
+  TSBSSimEvent* fTruthEvent; // MC truth of fEvent, written to fOTruthTree
+  TSBSTreeWriter* fWriter;   // Background writer of the output trees (fOutAsyncQueue>0)
+
+  ETruthOutput fTruthOutput; // MC truth output of InitTree
+  TString  fOutBaseName;  // output file name without ".root" (segmented output)
+  Int_t    fSegment;      // current segment (1, 2, ...), 0: not segmented
+  Long64_t fSegEvents;    // events written to the current segment
+  Int_t    fSegFirstEvt;  // first and last event number in the current segment
+  Int_t    fSegLastEvt;
+  std::vector<Segment_t> fSegments; // closed segments
 
   Bool_t fFilledStrips;   // True if no data changed since last SetTreeStrips
 
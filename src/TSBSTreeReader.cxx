@@ -0,0 +1,187 @@
+#include "TSBSTreeReader.h"
+#include "TSBSSimEvent.h"
+
+#include "TTree.h"
+#include "TBranch.h"
+#include "TROOT.h"
+#include "RVersion.h"
+
+#include <cstdio>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+//_____________________________________________________________________________
+struct TSBSTreeReader::Impl {
+  static const UInt_t kNBuf = 2;
+
+  Impl() : fTree(0), fAddr(0), fEntry(0), fCurrent(-1), fDone(false),
+	   fStop(false), fRunning(false)
+  {
+    for( UInt_t i = 0; i < kNBuf; i++ ) {
+      fBuf[i] = 0;
+      fBytes[i] = 0;
+    }
+  }
+
+  void Run();
+
+  TTree*          fTree;
+  TSBSSimEvent*   fAddr;         // branch address, set by the I/O thread
+  TSBSSimEvent*   fBuf[kNBuf];   // event buffers
+  Int_t           fBytes[kNBuf]; // GetEntry result of each buffer
+  Long64_t        fEntry;        // next entry to read
+  deque<UInt_t>   fFree;         // buffers available to the I/O thread
+  deque<UInt_t>   fFull;         // buffers read, in entry order
+  Int_t           fCurrent;      // buffer held by the caller
+  bool            fDone;         // end of tree or read error
+  bool            fStop;
+  bool            fRunning;
+
+  mutex              fMutex;
+  condition_variable fCond;
+  thread             fThread;
+};
+
+//_____________________________________________________________________________
+void TSBSTreeReader::Impl::Run()
+{
+  // I/O thread: read the entries into the free buffers
+
+  unique_lock<mutex> lock(fMutex);
+  while( true ) {
+    while( fFree.empty() && !fStop )
+      fCond.wait(lock);
+    if( fStop )
+      break;
+    UInt_t ib = fFree.front();
+    fFree.pop_front();
+    lock.unlock();
+
+    // The branch uses the pointer fAddr; TTree picks up the change
+    TSBSSimEvent* ev = fBuf[ib];
+    fAddr = ev;
+    ev->Clear();
+    Int_t nbytes = ( fEntry < fTree->GetEntries() ) ? fTree->GetEntry(fEntry++) : 0;
+    if( nbytes > 0 && ev->HasOldStrips() )
+      ev->UpgradeStrips();
+
+    lock.lock();
+    fBytes[ib] = nbytes;
+    fFull.push_back(ib);
+    fCond.notify_all();
+    if( nbytes <= 0 ) {
+      fDone = true;
+      break;
+    }
+  }
+}
+
+//_____________________________________________________________________________
+TSBSTreeReader::TSBSTreeReader() : fImpl( new Impl )
+{
+}
+
+//_____________________________________________________________________________
+TSBSTreeReader::~TSBSTreeReader()
+{
+  Stop();
+  for( UInt_t i = 0; i < Impl::kNBuf; i++ )
+    delete fImpl->fBuf[i];
+  delete fImpl;
+}
+
+//_____________________________________________________________________________
+Int_t TSBSTreeReader::Start( TTree* tree, Long64_t first )
+{
+  // Point the event branch to the reader's own event pointer and start
+  // the I/O thread.
+
+  if( fImpl->fRunning )
+    return 0;
+  if( !tree )
+    return -1;
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  fprintf(stderr, "%s: asynchronous tree reading needs ROOT >= 6.06\n",
+	  __PRETTY_FUNCTION__);
+  return -1;
+#endif
+
+  TBranch* br = tree->GetBranch(eventBranchName);
+  if( !br ) {
+    fprintf(stderr, "%s: no branch \"%s\" in tree %s\n", __PRETTY_FUNCTION__,
+	    eventBranchName, tree->GetName());
+    return -1;
+  }
+  fImpl->fFree.clear();
+  fImpl->fFull.clear();
+  for( UInt_t i = 0; i < Impl::kNBuf; i++ ) {
+    if( !fImpl->fBuf[i] )
+      fImpl->fBuf[i] = new TSBSSimEvent(1);
+    fImpl->fFree.push_back(i);
+  }
+  fImpl->fTree = tree;
+  fImpl->fAddr = fImpl->fBuf[0];
+  br->SetAddress( &fImpl->fAddr );
+  fImpl->fEntry = first;
+  fImpl->fCurrent = -1;
+  fImpl->fDone = false;
+  fImpl->fStop = false;
+
+  fImpl->fThread = thread( &Impl::Run, fImpl );
+  fImpl->fRunning = true;
+  return 0;
+}
+
+//_____________________________________________________________________________
+Bool_t TSBSTreeReader::IsRunning() const
+{
+  return fImpl->fRunning;
+}
+
+//_____________________________________________________________________________
+TSBSSimEvent* TSBSTreeReader::Next( Int_t& nbytes )
+{
+  nbytes = 0;
+  if( !fImpl->fRunning )
+    return 0;
+
+  unique_lock<mutex> lock(fImpl->fMutex);
+  if( fImpl->fCurrent >= 0 ) {
+    fImpl->fFree.push_back(fImpl->fCurrent);
+    fImpl->fCurrent = -1;
+    fImpl->fCond.notify_all();
+  }
+  while( fImpl->fFull.empty() && !fImpl->fDone )
+    fImpl->fCond.wait(lock);
+  if( fImpl->fFull.empty() )
+    return 0;
+  fImpl->fCurrent = fImpl->fFull.front();
+  fImpl->fFull.pop_front();
+  nbytes = fImpl->fBytes[fImpl->fCurrent];
+  return fImpl->fBuf[fImpl->fCurrent];
+}
+
+//_____________________________________________________________________________
+void TSBSTreeReader::Stop()
+{
+  if( !fImpl->fRunning )
+    return;
+
+  {
+    lock_guard<mutex> lock(fImpl->fMutex);
+    fImpl->fStop = true;
+    fImpl->fCond.notify_all();
+  }
+  fImpl->fThread.join();
+  fImpl->fRunning = false;
+  if( TBranch* br = fImpl->fTree->GetBranch(eventBranchName) )
+    fImpl->fTree->ResetBranchAddress(br);
+  fImpl->fTree = 0;
+}
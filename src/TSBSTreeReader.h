@@ -0,0 +1,54 @@
+#ifndef __TSBSTREEREADER_H
+#define __TSBSTREEREADER_H
+
+#include <Rtypes.h>
+
+class TTree;
+class TSBSSimEvent;
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSTreeReader
+//
+// Read-ahead of a tree of TSBSSimEvent (branch eventBranchName), used by
+// TSBSSimFile.
+//
+// A dedicated I/O thread reads and deserializes the entries in order into
+// a double buffer of preallocated events: while the caller analyzes one
+// event, the next one is read into the other buffer.
+//
+//   reader.Start(tree, first);
+//   while( (ev = reader.Next(nbytes)) && nbytes > 0 ) {
+//     ... use *ev until the next call to Next
+//   }
+//   reader.Stop();
+//
+// The tree (and any other tree of the same file) must not be used by the
+// caller between Start and Stop.
+
+class TSBSTreeReader {
+ public:
+  TSBSTreeReader();
+  virtual ~TSBSTreeReader();
+
+  // Start reading tree from entry first on. Return 0 on success
+  Int_t  Start( TTree* tree, Long64_t first = 0 );
+  Bool_t IsRunning() const;
+
+  // Event of the next entry, waiting for it if not yet read. nbytes is
+  // the result of TTree::GetEntry for it (0 at the end of the tree,
+  // < 0 on error). Returns 0 after the end of the tree.
+  // The previous event returned is given back to the I/O thread.
+  TSBSSimEvent* Next( Int_t& nbytes );
+  // End the I/O thread and restore the tree's own branch address
+  void   Stop();
+
+ private:
+  struct Impl;
+  Impl*  fImpl;
+
+  // Copy and assignment not allowed
+  TSBSTreeReader( const TSBSTreeReader& );
+  TSBSTreeReader& operator=( const TSBSTreeReader& );
+};
+
+#endif//__TSBSTREEREADER_H
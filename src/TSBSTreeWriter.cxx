@@ -0,0 +1,230 @@
+#include "TSBSTreeWriter.h"
+#include "TSBSSimEvent.h"
+
+#include "TTree.h"
+#include "TBranch.h"
+#include "TROOT.h"
+#include "RVersion.h"
+
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+//_____________________________________________________________________________
+struct TSBSTreeWriter::Impl {
+  Impl( UInt_t n ) : fQueueSize(n), fCurrent(-1), fBusy(false), fStop(false),
+		     fRunning(false), fNErrors(0), fZipBytes(0) {}
+
+  void Run();
+
+  vector<TTree*>        fTrees;
+  vector<TSBSSimEvent*> fAddr;     // branch addresses, set by the I/O thread
+  UInt_t                fQueueSize;
+  vector< vector<TSBSSimEvent*> > fEntries; // [entry][tree]
+  deque<UInt_t>         fFree;     // entries available to Acquire
+  deque<UInt_t>         fFull;     // entries waiting to be written
+  Int_t                 fCurrent;  // entry acquired by the producer
+  bool                  fBusy;     // the I/O thread is writing an entry
+  bool                  fStop;
+  bool                  fRunning;
+  Int_t                 fNErrors;
+  Long64_t              fZipBytes;
+
+  mutex                 fMutex;
+  condition_variable    fCond;
+  thread                fThread;
+};
+
+//_____________________________________________________________________________
+void TSBSTreeWriter::Impl::Run()
+{
+  // I/O thread: fill the trees with the queued entries
+
+  unique_lock<mutex> lock(fMutex);
+  while( true ) {
+    while( fFull.empty() && !fStop )
+      fCond.wait(lock);
+    if( fFull.empty() )
+      break;
+    UInt_t ie = fFull.front();
+    fFull.pop_front();
+    fBusy = true;
+    lock.unlock();
+
+    Int_t nerr = 0;
+    Long64_t nbytes = 0;
+    for( size_t it = 0; it < fTrees.size(); it++ ) {
+      // The branches use the pointers in fAddr; TTree picks up the change
+      fAddr[it] = fEntries[ie][it];
+      if( fTrees[it]->Fill() < 0 )
+	nerr++;
+      nbytes += fTrees[it]->GetZipBytes();
+    }
+
+    lock.lock();
+    fNErrors += nerr;
+    fZipBytes = nbytes;
+    fBusy = false;
+    fFree.push_back(ie);
+    fCond.notify_all();
+  }
+}
+
+//_____________________________________________________________________________
+TSBSTreeWriter::TSBSTreeWriter( UInt_t queuesize )
+  : fImpl( new Impl(queuesize > 0 ? queuesize : 1) )
+{
+}
+
+//_____________________________________________________________________________
+TSBSTreeWriter::~TSBSTreeWriter()
+{
+  Stop();
+  for( size_t ie = 0; ie < fImpl->fEntries.size(); ie++ )
+    for( size_t it = 0; it < fImpl->fEntries[ie].size(); it++ )
+      delete fImpl->fEntries[ie][it];
+  delete fImpl;
+}
+
+//_____________________________________________________________________________
+void TSBSTreeWriter::AddTree( TTree* tree )
+{
+  if( fImpl->fRunning ) {
+    fprintf(stderr, "%s: cannot add a tree while running\n", __PRETTY_FUNCTION__);
+    return;
+  }
+  fImpl->fTrees.push_back(tree);
+}
+
+//_____________________________________________________________________________
+Int_t TSBSTreeWriter::Start()
+{
+  // Point the event branches to the writer's own event pointers, allocate
+  // the queue entries and start the I/O thread.
+
+  if( fImpl->fRunning )
+    return 0;
+  if( fImpl->fTrees.empty() )
+    return -1;
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  fprintf(stderr, "%s: asynchronous tree writing needs ROOT >= 6.06\n",
+	  __PRETTY_FUNCTION__);
+  return -1;
+#endif
+
+  const size_t ntrees = fImpl->fTrees.size();
+  fImpl->fAddr.assign( ntrees, 0 );
+  fImpl->fEntries.resize( fImpl->fQueueSize );
+  for( UInt_t ie = 0; ie < fImpl->fQueueSize; ie++ ) {
+    while( fImpl->fEntries[ie].size() < ntrees )
+      fImpl->fEntries[ie].push_back( new TSBSSimEvent(5) );
+  }
+  for( size_t it = 0; it < ntrees; it++ ) {
+    fImpl->fAddr[it] = fImpl->fEntries[0][it];
+    TBranch* br = fImpl->fTrees[it]->GetBranch(eventBranchName);
+    if( !br ) {
+      fprintf(stderr, "%s: no branch \"%s\" in tree %s\n", __PRETTY_FUNCTION__,
+	      eventBranchName, fImpl->fTrees[it]->GetName());
+      return -1;
+    }
+    br->SetAddress( &fImpl->fAddr[it] );
+  }
+  fImpl->fFree.clear();
+  fImpl->fFull.clear();
+  for( UInt_t ie = 0; ie < fImpl->fQueueSize; ie++ )
+    fImpl->fFree.push_back(ie);
+  fImpl->fCurrent = -1;
+  fImpl->fStop = false;
+  fImpl->fNErrors = 0;
+  fImpl->fZipBytes = 0;
+  for( size_t it = 0; it < ntrees; it++ )
+    fImpl->fZipBytes += fImpl->fTrees[it]->GetZipBytes();
+
+  fImpl->fThread = thread( &Impl::Run, fImpl );
+  fImpl->fRunning = true;
+  return 0;
+}
+
+//_____________________________________________________________________________
+Bool_t TSBSTreeWriter::IsRunning() const
+{
+  return fImpl->fRunning;
+}
+
+//_____________________________________________________________________________
+TSBSSimEvent* const* TSBSTreeWriter::Acquire()
+{
+  if( !fImpl->fRunning )
+    return 0;
+
+  unique_lock<mutex> lock(fImpl->fMutex);
+  if( fImpl->fCurrent < 0 ) {
+    while( fImpl->fFree.empty() )
+      fImpl->fCond.wait(lock);
+    fImpl->fCurrent = fImpl->fFree.front();
+    fImpl->fFree.pop_front();
+  }
+  return &fImpl->fEntries[fImpl->fCurrent][0];
+}
+
+//_____________________________________________________________________________
+void TSBSTreeWriter::Push()
+{
+  unique_lock<mutex> lock(fImpl->fMutex);
+  if( fImpl->fCurrent < 0 )
+    return;
+  fImpl->fFull.push_back(fImpl->fCurrent);
+  fImpl->fCurrent = -1;
+  fImpl->fCond.notify_all();
+}
+
+//_____________________________________________________________________________
+void TSBSTreeWriter::Flush()
+{
+  if( !fImpl->fRunning )
+    return;
+
+  unique_lock<mutex> lock(fImpl->fMutex);
+  while( !fImpl->fFull.empty() || fImpl->fBusy )
+    fImpl->fCond.wait(lock);
+}
+
+//_____________________________________________________________________________
+void TSBSTreeWriter::Stop()
+{
+  if( !fImpl->fRunning )
+    return;
+
+  {
+    lock_guard<mutex> lock(fImpl->fMutex);
+    fImpl->fStop = true;
+    fImpl->fCond.notify_all();
+  }
+  fImpl->fThread.join();
+  fImpl->fRunning = false;
+  if( fImpl->fNErrors > 0 )
+    fprintf(stderr, "%s: %d tree fill errors\n", __PRETTY_FUNCTION__,
+	    fImpl->fNErrors);
+}
+
+//_____________________________________________________________________________
+Int_t TSBSTreeWriter::GetNErrors() const
+{
+  lock_guard<mutex> lock(fImpl->fMutex);
+  return fImpl->fNErrors;
+}
+
+//_____________________________________________________________________________
+Long64_t TSBSTreeWriter::GetZipBytes() const
+{
+  lock_guard<mutex> lock(fImpl->fMutex);
+  return fImpl->fZipBytes;
+}
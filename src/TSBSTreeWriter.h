@@ -0,0 +1,64 @@
+#ifndef __TSBSTREEWRITER_H
+#define __TSBSTREEWRITER_H
+
+#include <Rtypes.h>
+
+class TTree;
+class TSBSSimEvent;
+
+////////////////////////////////////////////////////////////////////////////
+// TSBSTreeWriter
+//
+// Asynchronous filling of trees of TSBSSimEvent (branch eventBranchName),
+// used by TSBSSimGEMDigitization for its output tree(s).
+//
+// The events to write are handed to a dedicated I/O thread through a
+// bounded queue of preallocated entries (one event per tree), so that
+// the streaming and compression overlap with the digitization of the
+// next events. The producer waits when all entries are queued.
+//
+//   writer.AddTree(tree);        // for each tree, before Start
+//   writer.Start();
+//   per event:
+//     TSBSSimEvent* const* ev = writer.Acquire();
+//     ... copy the event(s) into ev[0], ev[1], ...
+//     writer.Push();
+//   writer.Stop();               // write out the queue, end the thread
+//
+// The trees must not be used by the caller between Start and Stop.
+
+class TSBSTreeWriter {
+ public:
+  TSBSTreeWriter( UInt_t queuesize = 8 );
+  virtual ~TSBSTreeWriter();
+
+  void   AddTree( TTree* tree );
+  // Start the I/O thread. Return 0 on success
+  Int_t  Start();
+  Bool_t IsRunning() const;
+
+  // Events of the next entry, one per tree in AddTree order.
+  // Waits for a free entry if the queue is full.
+  TSBSSimEvent* const* Acquire();
+  // Queue the entry returned by the last Acquire
+  void   Push();
+  // Wait until all queued entries are written
+  void   Flush();
+  // Flush and end the I/O thread
+  void   Stop();
+
+  // Number of failed TTree::Fill calls
+  Int_t  GetNErrors() const;
+  // Compressed bytes written to the trees, as of the last filled entry
+  Long64_t GetZipBytes() const;
+
+ private:
+  struct Impl;
+  Impl*  fImpl;
+
+  // Copy and assignment not allowed
+  TSBSTreeWriter( const TSBSTreeWriter& );
+  TSBSTreeWriter& operator=( const TSBSTreeWriter& );
+};
+
+#endif//__TSBSTREEWRITER_H
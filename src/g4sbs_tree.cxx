@@ -28,6 +28,8 @@ g4sbs_tree::g4sbs_tree(TTree *tree, int det_opt, bool pythia, bool ecalbox, bool
 g4sbs_tree::~g4sbs_tree()
 {
    if (!fChain) return;
+   // files of a TChain are owned by the chain
+   if (fChain->InheritsFrom(TChain::Class())) return;
    delete fChain->GetCurrentFile();
 }
 